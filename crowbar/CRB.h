@@ -5,13 +5,86 @@
 #include <stdio.h>
 
 typedef struct CRB_Interpreter_tag CRB_Interpreter; /* 指向解释器的指针 */
+typedef struct CRB_Program_tag CRB_Program; /* 编译好的程序 */
+
+/* 执行结果 */
+typedef enum {
+    CRB_STATUS_OK = 0,
+    CRB_STATUS_STEP_LIMIT,  /* 超过步数限制 */
+    CRB_STATUS_HEAP_LIMIT,  /* 超过堆大小限制 */
+    CRB_STATUS_TIMEOUT,     /* 超过执行时间 */
+    CRB_STATUS_RUNTIME_ERROR, /* 运行时错误(没有被try捕获) */
+    CRB_STATUS_COMPILE_ERROR  /* 语法错误 */
+} CRB_Status;
+
+/* 资源限制, 0表示不限制. 步数在循环每一轮和每次函数调用时加一 */
+typedef struct {
+    long max_steps;
+    long max_heap_size;     /* 字节 */
+    long timeout_msec;
+} CRB_Limits;
 
 CRB_Interpreter *CRB_create_interpreter(void);
 
-void CRB_compile(CRB_Interpreter *interpreter, FILE *fp);  /* 生成分析树 */
+CRB_Status CRB_compile(CRB_Interpreter *interpreter, FILE *fp);  /* 生成分析树, 语法错误时返回CRB_STATUS_COMPILE_ERROR */
+
+/* 严格模式: 编译时分析所有函数体(默认第一次调用时才分析) */
+void CRB_set_strict_mode(CRB_Interpreter *interpreter, int strict);
+
+/* GC之后合并内容相同的字符串, 重复的字符串很多时可以减小堆(默认关闭) */
+void CRB_set_string_dedup(CRB_Interpreter *interpreter, int dedup);
+
+CRB_Status CRB_interpreter(CRB_Interpreter *interpreter);  /* 运行, 出错或超过资源限制时中止 */
+
+/* 之后的每次CRB_interpreter(或从c语言调用函数)都按这个限制执行, NULL取消限制 */
+void CRB_set_limits(CRB_Interpreter *interpreter, CRB_Limits *limits);
+
+/* 最近一次执行的结果 */
+CRB_Status CRB_get_status(CRB_Interpreter *interpreter);
+char *CRB_get_status_message(CRB_Status status);
+/* 出错时是带行号的错误信息, 否则同CRB_get_status_message */
+char *CRB_get_error_message(CRB_Interpreter *interpreter);
 
-void CRB_interpreter(CRB_Interpreter *interpreter);  /* 运行 */
+/*
+ * 回到编译刚完成时的状态: 清空全局变量,堆和栈,分析树保留.
+ * 之后可以重新注入全局变量再调用CRB_interpreter, 不需要重新编译.
+ * */
+void CRB_reset_interpreter(CRB_Interpreter *interpreter);
 
 void CRB_dispose_interpreter(CRB_Interpreter *interpreter);  /* 执行完之后回收解释器 */
 
+/*
+ * 程序共享: 一个解释器编译(或加载缓存)之后,用CRB_get_program取出程序,
+ * 再用CRB_set_program交给其他解释器执行. 程序有引用计数,
+ * 每个CRB_get_program都要对应一个CRB_release_program.
+ * 还没编译的函数体在第一次调用时在锁里编译, 共享程序的解释器可以在不同线程里执行.
+ * */
+CRB_Program *CRB_get_program(CRB_Interpreter *interpreter);
+void CRB_set_program(CRB_Interpreter *interpreter, CRB_Program *program);
+void CRB_release_program(CRB_Program *program);
+
+/* 预编译缓存(.crbc), 缓存有效时加载返回1, 否则返回0 */
+int CRB_load_compiled(CRB_Interpreter *interpreter, char *path, char *source_path);
+
+/* 把编译好的分析树写入缓存, 成功返回1 */
+int CRB_save_compiled(CRB_Interpreter *interpreter, char *path, char *source_path);
+
+/* 源文件对应的缓存路径(foo.crb -> foo.crbc), 用MEM_free释放 */
+char *CRB_compiled_path(char *source_path);
+
+/*
+ * 批量执行: worker_count个线程执行files里的脚本和manifest清单里的任务(manifest可以为NULL),
+ * 清单每行是"脚本 参数...", 参数以字符串数组的形式放在全局变量ARGS里.
+ * limits不为NULL时每个脚本分别按这个限制执行.
+ * 结束后向report输出每个脚本的状态和耗时, 全部成功返回0.
+ * */
+int CRB_run_batch(int worker_count, CRB_Limits *limits, char *manifest, int file_count, char **files, FILE *report);
+
+/*
+ * fork服务: interpreter编译并执行完顶层代码后调用, 在socket_path上监听.
+ * 每个连接fork一个子进程, 连接作为子进程的标准输入输出,
+ * 第一行作为字符串参数调用entry函数. 只有出错时才返回.
+ * */
+int CRB_serve_forked(CRB_Interpreter *interpreter, char *socket_path, char *entry);
+
 #endif
@@ -16,6 +16,8 @@ typedef struct CRB_String_tag CRB_String;
 typedef struct CRB_LocalEnvironment_tag CRB_LocalEnvironment;
 typedef struct CRB_Object_tag CRB_Object;
 typedef struct CRB_Array_tag CRB_Array;
+typedef struct CRB_Map_tag CRB_Map;
+typedef struct CRB_Matrix_tag CRB_Matrix;
 
 /* v2 end */
 
@@ -32,7 +34,10 @@ typedef enum {
     CRB_STRING_VALUE ,
     CRB_NATIVE_POINTER_VALUE ,
     CRB_NULL_VALUE ,
-    CRB_ARRAY_VALUE
+    CRB_ARRAY_VALUE ,
+    CRB_GENERATOR_VALUE ,
+    CRB_MAP_VALUE ,
+    CRB_MATRIX_VALUE
 } CRB_ValueType;
 
 /* 指针类型 */
@@ -60,10 +65,24 @@ typedef CRB_Value CRB_NativeFunctionProc(CRB_Interpreter *interpreter, CRB_Local
 /* 注册c语言函数 */
 void CRB_add_native_function(CRB_Interpreter *interpreter, char *name, CRB_NativeFunctionProc *proc);
 
+/* 注入全局变量, 在CRB_interpreter之前调用(CRB_reset_interpreter之后需要重新注入) */
+void CRB_add_global_variable(CRB_Interpreter *inter, char *identifier, CRB_Value *value);
+
+/*
+ * 从c语言直接调用函数. CRB_lookup_function找一次, 之后反复CRB_call_function.
+ * crowbar函数的句柄在程序释放之前有效(共享同一程序的解释器之间也可以用),
+ * 内置函数的句柄只在查找它的解释器里有效. 找不到返回NULL.
+ * 返回值里的对象保留到下一次CRB_call_function或CRB_reset_interpreter为止.
+ * */
+typedef struct FunctionDefinition_tag CRB_Function;
+CRB_Function *CRB_lookup_function(CRB_Interpreter *inter, char *name);
+CRB_Value CRB_call_function(CRB_Interpreter *inter, CRB_Function *func, int arg_count, CRB_Value *args);
+
 
 /* v2 */
 CRB_Object* CRB_create_array(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int size);
 char* CRB_value_to_string(CRB_Value *value);
+void CRB_write_value(FILE *fp, CRB_Value *value);
 CRB_Object* crb_create_crowbar_string(CRB_Interpreter *inter, CRB_LocalEnvironment *env, char *str);
 void chain_string(CRB_Interpreter *inter, CRB_Value *left, CRB_Value *right, CRB_Value *result);
 
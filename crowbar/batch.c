@@ -0,0 +1,480 @@
+/*
+ * File : batch.c
+ * CreateDate : 2026-10-19 15:20:08
+ * */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+/*
+ * 批量执行
+ *
+ * 每个工作线程有自己的解释器和任务队列, 任务一开始按顺序分成连续的几段.
+ * 线程从自己队列的尾部取任务, 自己的做完了就从别的队列头部偷.
+ * 同一个脚本只编译(或加载缓存)一次, 程序在工作线程之间共享.
+ * */
+
+#define LINE_ALLOC_SIZE (256)
+
+typedef struct {
+    char *path;
+    CRB_Program *program;   /* 第一次用到时加载 */
+    CRB_Status status;      /* 有语法错误时不再加载 */
+    char *error_message;
+    pthread_mutex_t mutex;
+} BatchScript;
+
+typedef struct {
+    int script;             /* scripts的下标 */
+    int arg_count;
+    char **args;
+    int found;
+    CRB_Status status;
+    char *error_message;    /* 出错时的错误信息 */
+    double elapsed;         /* 毫秒 */
+} BatchJob;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    int *jobs;
+    int top;                /* 被偷的一端 */
+    int bottom;             /* 自己取的一端 */
+} WorkQueue;
+
+typedef struct Batch_tag Batch;
+
+typedef struct {
+    Batch *batch;
+    int id;
+    WorkQueue queue;
+    pthread_t thread;
+} Worker;
+
+struct Batch_tag {
+    BatchScript *scripts;
+    int script_count;
+    int script_alloc_size;
+    BatchJob *jobs;
+    int job_count;
+    int job_alloc_size;
+    Worker *workers;
+    int worker_count;
+    CRB_Limits *limits;
+};
+
+static double now_msec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static int search_script(Batch *batch, char *path)
+{
+    int i;
+
+    for (i = 0; i < batch->script_count; ++i) {
+        if (!strcmp(batch->scripts[i].path, path)) {
+            return i;
+        }
+    }
+
+    if (batch->script_count == batch->script_alloc_size) {
+        batch->script_alloc_size = batch->script_alloc_size ? batch->script_alloc_size * 2 : 16;
+        batch->scripts = MEM_realloc(batch->scripts, sizeof(BatchScript) * batch->script_alloc_size);
+    }
+    batch->scripts[batch->script_count].path = MEM_strdup(path);
+    batch->scripts[batch->script_count].program = NULL;
+    batch->scripts[batch->script_count].status = CRB_STATUS_OK;
+    batch->scripts[batch->script_count].error_message = NULL;
+    batch->script_count++;
+
+    return batch->script_count - 1;
+}
+
+static void add_job(Batch *batch, char *path, int arg_count, char **args)
+{
+    BatchJob *job;
+    int i;
+
+    if (batch->job_count == batch->job_alloc_size) {
+        batch->job_alloc_size = batch->job_alloc_size ? batch->job_alloc_size * 2 : 64;
+        batch->jobs = MEM_realloc(batch->jobs, sizeof(BatchJob) * batch->job_alloc_size);
+    }
+    job = &batch->jobs[batch->job_count];
+    job->script = search_script(batch, path);
+    job->arg_count = arg_count;
+    job->args = MEM_malloc(sizeof(char*) * (arg_count + 1));
+    for (i = 0; i < arg_count; ++i) {
+        job->args[i] = MEM_strdup(args[i]);
+    }
+    job->found = 1;
+    job->status = CRB_STATUS_OK;
+    job->error_message = NULL;
+    job->elapsed = 0.0;
+    batch->job_count++;
+}
+
+static char *read_line(FILE *fp)
+{
+    char *line = NULL;
+    int alloc_size = 0;
+    int length = 0;
+
+    for (;;) {
+        if (alloc_size - length < LINE_ALLOC_SIZE / 2) {
+            alloc_size += LINE_ALLOC_SIZE;
+            line = MEM_realloc(line, alloc_size);
+        }
+        if (NULL == fgets(line + length, alloc_size - length, fp)) {
+            break;
+        }
+        length += strlen(line + length);
+        if (length > 0 && '\n' == line[length - 1]) {
+            break;
+        }
+    }
+
+    if (0 == length) {
+        MEM_free(line);
+        return NULL;
+    }
+
+    return line;
+}
+
+/*
+ * 清单每行一个任务: 脚本 参数1 参数2 ...
+ * 空行和#开头的行跳过, 参数用空白分隔
+ * */
+static int read_manifest(Batch *batch, char *manifest)
+{
+    FILE *fp;
+    char *line;
+    char **fields = NULL;
+    int field_alloc_size = 0;
+    int field_count;
+    char *p;
+
+    fp = fopen(manifest, "r");
+    if (NULL == fp) {
+        fprintf(stderr, "%s not found\n", manifest);
+        return 0;
+    }
+
+    while ((line = read_line(fp)) != NULL) {
+        field_count = 0;
+        for (p = line; ;) {
+            while (*p && isspace((unsigned char)*p)) {
+                p++;
+            }
+            if ('\0' == *p || (0 == field_count && '#' == *p)) {
+                break;
+            }
+            if (field_count == field_alloc_size) {
+                field_alloc_size += 16;
+                fields = MEM_realloc(fields, sizeof(char*) * field_alloc_size);
+            }
+            fields[field_count++] = p;
+            while (*p && !isspace((unsigned char)*p)) {
+                p++;
+            }
+            if (*p) {
+                *p++ = '\0';
+            }
+        }
+        if (field_count > 0) {
+            add_job(batch, fields[0], field_count - 1, fields + 1);
+        }
+        MEM_free(line);
+    }
+    MEM_free(fields);
+    fclose(fp);
+
+    return 1;
+}
+
+/* 文件不存在时返回NULL, 语法错误时错误信息记在script里 */
+static CRB_Program *load_program(BatchScript *script)
+{
+    CRB_Interpreter *interpreter;
+    CRB_Program *program = NULL;
+    char *cache;
+    FILE *fp;
+
+    fp = fopen(script->path, "r");
+    if (NULL == fp) {
+        return NULL;
+    }
+
+    interpreter = CRB_create_interpreter();
+    cache = CRB_compiled_path(script->path);
+    if (!CRB_load_compiled(interpreter, cache, script->path)) {
+        script->status = CRB_compile(interpreter, fp);
+        if (CRB_STATUS_OK == script->status) {
+            CRB_save_compiled(interpreter, cache, script->path);
+        } else {
+            script->error_message = MEM_strdup(CRB_get_error_message(interpreter));
+        }
+    }
+    MEM_free(cache);
+    fclose(fp);
+
+    if (CRB_STATUS_OK == script->status) {
+        program = CRB_get_program(interpreter);
+    }
+    CRB_dispose_interpreter(interpreter);
+
+    return program;
+}
+
+static CRB_Program *get_program(BatchScript *script)
+{
+    CRB_Program *program;
+
+    pthread_mutex_lock(&script->mutex);
+    if (NULL == script->program && CRB_STATUS_OK == script->status) {
+        script->program = load_program(script);
+    }
+    program = script->program;
+    pthread_mutex_unlock(&script->mutex);
+
+    return program;
+}
+
+/* 参数作为字符串数组放进全局变量ARGS */
+static void add_args(CRB_Interpreter *inter, int arg_count, char **args)
+{
+    CRB_Value v;
+    CRB_Value str;
+    int i;
+
+    v.type = CRB_ARRAY_VALUE;
+    v.u.object = crb_create_array_i(inter, arg_count);
+    /* 创建字符串时可能GC, 数组先放到栈上 */
+    push_value(inter, &v);
+    for (i = 0; i < arg_count; ++i) {
+        str.type = CRB_STRING_VALUE;
+        str.u.object = crb_create_crowbar_string_i(inter, MEM_strdup(args[i]));
+        v.u.object->u.array.array[i] = str;
+    }
+    pop_value(inter);
+
+    CRB_add_global_variable(inter, "ARGS", &v);
+}
+
+static void run_job(CRB_Interpreter *inter, BatchScript *script, BatchJob *job)
+{
+    CRB_Program *program;
+    double start;
+
+    start = now_msec();
+    program = get_program(script);
+    if (NULL == program) {
+        if (CRB_STATUS_OK == script->status) {
+            fprintf(stderr, "%s not found\n", script->path);
+            job->found = 0;
+        } else {
+            job->status = script->status;
+            job->error_message = MEM_strdup(script->error_message);
+        }
+        job->elapsed = now_msec() - start;
+        return;
+    }
+
+    CRB_set_program(inter, program);
+    add_args(inter, job->arg_count, job->args);
+    job->status = CRB_interpreter(inter);
+    if (CRB_STATUS_RUNTIME_ERROR == job->status || CRB_STATUS_COMPILE_ERROR == job->status) {
+        job->error_message = MEM_strdup(CRB_get_error_message(inter));
+    }
+    CRB_reset_interpreter(inter);
+    job->elapsed = now_msec() - start;
+}
+
+static int pop_job(WorkQueue *queue)
+{
+    int job = -1;
+
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->top < queue->bottom) {
+        job = queue->jobs[--queue->bottom];
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return job;
+}
+
+static int steal_job(WorkQueue *queue)
+{
+    int job = -1;
+
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->top < queue->bottom) {
+        job = queue->jobs[queue->top++];
+    }
+    pthread_mutex_unlock(&queue->mutex);
+
+    return job;
+}
+
+/* 任务不会在执行中增加, 所有队列都空了就结束 */
+static int next_job(Worker *worker)
+{
+    Batch *batch = worker->batch;
+    int job;
+    int i;
+
+    job = pop_job(&worker->queue);
+    for (i = 1; job < 0 && i < batch->worker_count; ++i) {
+        job = steal_job(&batch->workers[(worker->id + i) % batch->worker_count].queue);
+    }
+
+    return job;
+}
+
+static void *worker_main(void *arg)
+{
+    Worker *worker = arg;
+    Batch *batch = worker->batch;
+    CRB_Interpreter *inter;
+    int job;
+
+    inter = CRB_create_interpreter();
+    CRB_set_limits(inter, batch->limits);
+    while ((job = next_job(worker)) >= 0) {
+        run_job(inter, &batch->scripts[batch->jobs[job].script], &batch->jobs[job]);
+    }
+    CRB_dispose_interpreter(inter);
+
+    return NULL;
+}
+
+static void dispose_batch(Batch *batch)
+{
+    int i;
+    int j;
+
+    for (i = 0; i < batch->job_count; ++i) {
+        for (j = 0; j < batch->jobs[i].arg_count; ++j) {
+            MEM_free(batch->jobs[i].args[j]);
+        }
+        MEM_free(batch->jobs[i].args);
+        MEM_free(batch->jobs[i].error_message);
+    }
+    for (i = 0; i < batch->script_count; ++i) {
+        if (batch->scripts[i].program) {
+            CRB_release_program(batch->scripts[i].program);
+        }
+        pthread_mutex_destroy(&batch->scripts[i].mutex);
+        MEM_free(batch->scripts[i].error_message);
+        MEM_free(batch->scripts[i].path);
+    }
+    for (i = 0; i < batch->worker_count; ++i) {
+        pthread_mutex_destroy(&batch->workers[i].queue.mutex);
+        MEM_free(batch->workers[i].queue.jobs);
+    }
+    MEM_free(batch->jobs);
+    MEM_free(batch->scripts);
+    MEM_free(batch->workers);
+}
+
+int CRB_run_batch(int worker_count, CRB_Limits *limits, char *manifest, int file_count, char **files, FILE *report)
+{
+    Batch batch;
+    Worker *worker;
+    int begin;
+    int end;
+    int failed;
+    int started;
+    int error;
+    double start;
+    int i;
+    int j;
+
+    memset(&batch, 0, sizeof(Batch));
+    batch.limits = limits;
+    if (manifest && !read_manifest(&batch, manifest)) {
+        return 1;
+    }
+    for (i = 0; i < file_count; ++i) {
+        add_job(&batch, files[i], 0, NULL);
+    }
+    /* scripts不再扩容之后才初始化锁 */
+    for (i = 0; i < batch.script_count; ++i) {
+        pthread_mutex_init(&batch.scripts[i].mutex, NULL);
+    }
+
+    if (worker_count < 1) {
+        worker_count = 1;
+    }
+    if (worker_count > batch.job_count && batch.job_count > 0) {
+        worker_count = batch.job_count;
+    }
+    batch.worker_count = worker_count;
+    batch.workers = MEM_malloc(sizeof(Worker) * worker_count);
+    for (i = 0; i < worker_count; ++i) {
+        worker = &batch.workers[i];
+        worker->batch = &batch;
+        worker->id = i;
+        pthread_mutex_init(&worker->queue.mutex, NULL);
+        begin = (int)((long)batch.job_count * i / worker_count);
+        end = (int)((long)batch.job_count * (i + 1) / worker_count);
+        worker->queue.jobs = MEM_malloc(sizeof(int) * (end - begin + 1));
+        /* 从尾部取, 倒着放让每个线程按原来的顺序执行 */
+        for (j = begin; j < end; ++j) {
+            worker->queue.jobs[end - 1 - j] = j;
+        }
+        worker->queue.top = 0;
+        worker->queue.bottom = end - begin;
+    }
+
+    start = now_msec();
+    for (started = 0; started < worker_count; ++started) {
+        error = pthread_create(&batch.workers[started].thread, NULL, worker_main, &batch.workers[started]);
+        if (error != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(error));
+            break;
+        }
+    }
+    /* 没起来的线程的队列由别的线程偷着做完, 一个都没起来时在当前线程做 */
+    if (0 == started) {
+        worker_main(&batch.workers[0]);
+    }
+    for (i = 0; i < started; ++i) {
+        pthread_join(batch.workers[i].thread, NULL);
+    }
+
+    failed = 0;
+    for (i = 0; i < batch.job_count; ++i) {
+        fprintf(report, "%s\t%s\t%.3f ms", batch.scripts[batch.jobs[i].script].path,
+                batch.jobs[i].found ? CRB_get_status_message(batch.jobs[i].status) : "not found",
+                batch.jobs[i].elapsed);
+        if (batch.jobs[i].error_message) {
+            fprintf(report, "\t%s", batch.jobs[i].error_message);
+        }
+        fprintf(report, "\n");
+        if (!batch.jobs[i].found || batch.jobs[i].status != CRB_STATUS_OK) {
+            failed++;
+        }
+    }
+    fprintf(report, "%d scripts, %d failed, %d workers, %.3f ms\n",
+            batch.job_count, failed, started > 0 ? started : 1, now_msec() - start);
+
+    dispose_batch(&batch);
+
+    return failed ? 1 : 0;
+}
+
+/* vim: set tabstop=4 set shiftwidth=4 */
@@ -0,0 +1,892 @@
+/*
+ * File : cache.c
+ * CreateDate : 2026-10-19 09:12:40
+ * */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+/*
+ * 预编译缓存(.crbc)
+ *
+ * | CacheHeader |
+ * | 分析树节点 (指针字段保存的是映射在首选地址base时的地址) |
+ * | 字符串 (相同内容只保存一份) |
+ * | 一块全0 (节点区域以'\0'结尾, 读字符串不会越过节点区域) |
+ * | 函数表 (CachedFunction数组) |
+ * | 重定位表 (需要修正的指针字段的偏移, 每个函数和顶层语句各占一段) |
+ *
+ * 加载时用mmap(MAP_PRIVATE)映射整个文件, 节点直接留在映射里使用.
+ * 映射在首选地址时指针不用改, 页面只读不写, 别的进程和fork出来的子进程
+ * 共享page cache里的同一份. 首选地址被占用时, 顶层语句在加载时重定位,
+ * 函数第一次调用时才重定位自己的那一段, 只有用到的页面被复制.
+ * 头和源文件的大小,修改时间对得上, 头后面的内容校验和也对得上才用缓存.
+ * 校验时只读不写, 不影响页面共享.
+ * */
+
+#define CACHE_MAGIC "CRBC"
+#define CACHE_VERSION (9)
+#define CACHE_SUFFIX "c"
+#define CACHE_ALIGN_SIZE (sizeof(double))
+#define cache_align(size) (((size) + CACHE_ALIGN_SIZE - 1) / CACHE_ALIGN_SIZE * CACHE_ALIGN_SIZE)
+#define STRING_TABLE_INIT_SIZE (256)
+/* 首选地址: 0x3f00 << 32开始, 每个源文件按路径散列到一个4G的槽 */
+#define CACHE_BASE_SLOT_FIRST (0x3f00)
+#define CACHE_BASE_SLOT_MASK (0xff)
+
+typedef struct {
+    char magic[4];
+    int version;
+    int pointer_size;
+    int expression_size;    /* 结构体大小不同说明是别的版本编译的 */
+    int statement_size;
+    int function_size;
+    long source_mtime;
+    long source_mtime_nsec;
+    long source_size;
+    size_t base;            /* 指针字段按映射在这个地址计算 */
+    size_t image_size;
+    size_t statement_list;
+    int statement_reloc;    /* 顶层语句在重定位表里的范围 */
+    int statement_reloc_count;
+    size_t function_table;
+    int function_count;
+    size_t reloc_table;
+    int reloc_count;
+    unsigned int checksum;  /* 头后面的全部内容, 文件损坏时不用它 */
+} CacheHeader;
+
+/* 函数表的一项: 函数定义和它在重定位表里的范围 */
+struct CachedFunction_tag {
+    size_t function;
+    int reloc_start;
+    int reloc_count;
+};
+
+typedef struct {
+    char *string;
+    size_t offset;
+} StringEntry;
+
+typedef struct {
+    char *buffer;
+    size_t base;
+    size_t size;
+    size_t alloc_size;
+    size_t *reloc;
+    int reloc_count;
+    int reloc_alloc_size;
+    StringEntry *strings;
+    int string_count;
+    int string_alloc_size;
+} ImageWriter;
+
+static size_t write_bytes(ImageWriter *w, void *src, size_t size)
+{
+    size_t offset;
+    size_t new_size;
+
+    offset = w->size;
+    new_size = cache_align(offset + size);
+    if (new_size > w->alloc_size) {
+        while (new_size > w->alloc_size) {
+            w->alloc_size = w->alloc_size ? w->alloc_size * 2 : LINE_BUF_SIZE;
+        }
+        w->buffer = MEM_realloc(w->buffer, w->alloc_size);
+    }
+    memcpy(w->buffer + offset, src, size);
+    memset(w->buffer + offset + size, 0, new_size - offset - size);
+    w->size = new_size;
+
+    return offset;
+}
+
+/* 在offset处的指针字段里写入映射在首选地址时目标的地址,并登记到重定位表 */
+static void set_pointer(ImageWriter *w, size_t offset, size_t target)
+{
+    size_t address;
+
+    address = target ? w->base + target : 0;
+    memcpy(w->buffer + offset, &address, sizeof(size_t));
+    if (0 == target) {
+        return;
+    }
+
+    if (w->reloc_count == w->reloc_alloc_size) {
+        w->reloc_alloc_size = w->reloc_alloc_size ? w->reloc_alloc_size * 2 : LINE_BUF_SIZE;
+        w->reloc = MEM_realloc(w->reloc, sizeof(size_t) * w->reloc_alloc_size);
+    }
+    w->reloc[w->reloc_count] = offset;
+    w->reloc_count++;
+}
+
+static unsigned int hash_string(char *str)
+{
+    unsigned int h = 5381;
+
+    while (*str) {
+        h = h * 33 + (unsigned char)*str;
+        str++;
+    }
+
+    return h;
+}
+
+/*
+ * FNV-1a, 按size_t一次取一个字. 映像按CACHE_ALIGN_SIZE对齐,
+ * 大小总是sizeof(size_t)的倍数
+ * */
+static unsigned int image_checksum(char *image, size_t size)
+{
+    unsigned int h = 2166136261U;
+    size_t word;
+    size_t i;
+
+    for (i = sizeof(CacheHeader); i + sizeof(size_t) <= size; i += sizeof(size_t)) {
+        memcpy(&word, image + i, sizeof(size_t));
+        /* 分两次移位, size_t只有32位时也不超过宽度 */
+        h = (h ^ (unsigned int)(word ^ (word >> 16 >> 16))) * 16777619U;
+    }
+
+    return h;
+}
+
+/*
+ * 同一个源文件每次都用同一个首选地址, 不同的文件尽量错开.
+ * 只是给mmap的提示, 被占用时加载的一方重定位.
+ * */
+static size_t preferred_base(char *source_path)
+{
+    size_t slot;
+
+    if (sizeof(size_t) < 8) {
+        return 0;
+    }
+    slot = CACHE_BASE_SLOT_FIRST + (hash_string(source_path) & CACHE_BASE_SLOT_MASK);
+
+    /* 分两次移位, size_t只有32位时也不超过宽度 */
+    return slot << 16 << 16;
+}
+
+static void rehash_strings(ImageWriter *w)
+{
+    StringEntry *old;
+    int old_size;
+    int i;
+    unsigned int pos;
+
+    old = w->strings;
+    old_size = w->string_alloc_size;
+    w->string_alloc_size = old_size ? old_size * 2 : STRING_TABLE_INIT_SIZE;
+    w->strings = MEM_malloc(sizeof(StringEntry) * w->string_alloc_size);
+    for (i = 0; i < w->string_alloc_size; ++i) {
+        w->strings[i].string = NULL;
+    }
+
+    for (i = 0; i < old_size; ++i) {
+        if (NULL == old[i].string) {
+            continue;
+        }
+        pos = hash_string(old[i].string) & (w->string_alloc_size - 1);
+        while (w->strings[pos].string) {
+            pos = (pos + 1) & (w->string_alloc_size - 1);
+        }
+        w->strings[pos] = old[i];
+    }
+    MEM_free(old);
+}
+
+/* 字符串驻留: 相同的标识符和字面量只写一次 */
+static size_t write_string(ImageWriter *w, char *str)
+{
+    unsigned int pos;
+
+    if (NULL == str) {
+        return 0;
+    }
+
+    if ((w->string_count + 1) * 2 > w->string_alloc_size) {
+        rehash_strings(w);
+    }
+
+    pos = hash_string(str) & (w->string_alloc_size - 1);
+    while (w->strings[pos].string) {
+        if (!strcmp(w->strings[pos].string, str)) {
+            return w->strings[pos].offset;
+        }
+        pos = (pos + 1) & (w->string_alloc_size - 1);
+    }
+
+    w->strings[pos].string = str;
+    w->strings[pos].offset = write_bytes(w, str, strlen(str) + 1);
+    w->string_count++;
+
+    return w->strings[pos].offset;
+}
+
+static size_t write_expression(ImageWriter *w, Expression *expr);
+static size_t write_block(ImageWriter *w, Block *block);
+
+static size_t write_argument_list(ImageWriter *w, ArgumentList *list)
+{
+    size_t head = 0;
+    size_t prev = 0;
+    size_t offset;
+    ArgumentList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        offset = write_bytes(w, pos, sizeof(ArgumentList));
+        set_pointer(w, offset + offsetof(ArgumentList, expression), write_expression(w, pos->expression));
+        set_pointer(w, offset + offsetof(ArgumentList, next), 0);
+        if (prev) {
+            set_pointer(w, prev + offsetof(ArgumentList, next), offset);
+        } else {
+            head = offset;
+        }
+        prev = offset;
+    }
+
+    return head;
+}
+
+static size_t write_expression_list(ImageWriter *w, ExpressionList *list)
+{
+    size_t head = 0;
+    size_t prev = 0;
+    size_t offset;
+    ExpressionList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        offset = write_bytes(w, pos, sizeof(ExpressionList));
+        set_pointer(w, offset + offsetof(ExpressionList, expression), write_expression(w, pos->expression));
+        set_pointer(w, offset + offsetof(ExpressionList, next), 0);
+        if (prev) {
+            set_pointer(w, prev + offsetof(ExpressionList, next), offset);
+        } else {
+            head = offset;
+        }
+        prev = offset;
+    }
+
+    return head;
+}
+
+static size_t write_expression(ImageWriter *w, Expression *expr)
+{
+    size_t offset;
+    size_t u;
+
+    if (NULL == expr) {
+        return 0;
+    }
+
+    offset = write_bytes(w, expr, sizeof(Expression));
+    u = offset + offsetof(Expression, u);
+
+    switch (expr->type) {
+        case BOOLEAN_EXPRESSION:
+        case INT_EXPRESSION:
+        case DOUBLE_EXPRESSION:
+        case NULL_EXPRESSION:
+            break;
+        case STRING_EXPRESSION:
+            set_pointer(w, u, write_string(w, expr->u.string_value));
+            break;
+        case IDENTIFIER_EXPRESSION:
+            set_pointer(w, u, write_string(w, expr->u.identifier));
+            break;
+        case ASSIGN_EXPRESSION:
+            set_pointer(w, u + offsetof(AssignExpression, left), write_expression(w, expr->u.assign_expression.left));
+            set_pointer(w, u + offsetof(AssignExpression, operand), write_expression(w, expr->u.assign_expression.operand));
+            break;
+        case ADD_EXPRESSION:
+        case SUB_EXPRESSION:
+        case MUL_EXPRESSION:
+        case DIV_EXPRESSION:
+        case MOD_EXPRESSION:
+        case EQ_EXPRESSION:
+        case NE_EXPRESSION:
+        case GT_EXPRESSION:
+        case GE_EXPRESSION:
+        case LT_EXPRESSION:
+        case LE_EXPRESSION:
+        case LOGICAL_AND_EXPRESSION:
+        case LOGICAL_OR_EXPRESSION:
+            set_pointer(w, u + offsetof(BinaryExpression, left), write_expression(w, expr->u.binary_expression.left));
+            set_pointer(w, u + offsetof(BinaryExpression, right), write_expression(w, expr->u.binary_expression.right));
+            break;
+        case MINUS_EXPRESSION:
+            set_pointer(w, u, write_expression(w, expr->u.minus_expression));
+            break;
+        case FUNCTION_CALL_EXPRESSION:
+            set_pointer(w, u + offsetof(FunctionCallExpression, identifier), write_string(w, expr->u.function_call_expression.identifier));
+            set_pointer(w, u + offsetof(FunctionCallExpression, argument), write_argument_list(w, expr->u.function_call_expression.argument));
+            break;
+        case METHOD_CALL_EXPRESSION:
+            set_pointer(w, u + offsetof(MethodCallExpression, expression), write_expression(w, expr->u.method_call_expression.expression));
+            set_pointer(w, u + offsetof(MethodCallExpression, identifier), write_string(w, expr->u.method_call_expression.identifier));
+            set_pointer(w, u + offsetof(MethodCallExpression, argument), write_argument_list(w, expr->u.method_call_expression.argument));
+            break;
+        case ARRAY_EXPRESSION:
+            set_pointer(w, u, write_expression_list(w, expr->u.array_literal));
+            break;
+        case MAP_EXPRESSION:
+            set_pointer(w, u, write_expression_list(w, expr->u.map_literal));
+            break;
+        case INDEX_EXPRESSION:
+            set_pointer(w, u + offsetof(IndexExpression, array), write_expression(w, expr->u.index_expression.array));
+            set_pointer(w, u + offsetof(IndexExpression, index), write_expression(w, expr->u.index_expression.index));
+            break;
+        case INCREMENT_EXPRESSION:
+        case DECREMENT_EXPRESSION:
+            set_pointer(w, u + offsetof(IncrementOrDecrement, operand), write_expression(w, expr->u.inc_dec.operand));
+            break;
+        case EXPRESSION_TYPE_COUNT_PLUS_1:
+        default:
+            DBG_panic(("bad case. type:%d\n", expr->type));
+    }
+
+    return offset;
+}
+
+static size_t write_identifier_list(ImageWriter *w, IdentifierList *list)
+{
+    size_t head = 0;
+    size_t prev = 0;
+    size_t offset;
+    IdentifierList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        offset = write_bytes(w, pos, sizeof(IdentifierList));
+        set_pointer(w, offset + offsetof(IdentifierList, name), write_string(w, pos->name));
+        set_pointer(w, offset + offsetof(IdentifierList, next), 0);
+        if (prev) {
+            set_pointer(w, prev + offsetof(IdentifierList, next), offset);
+        } else {
+            head = offset;
+        }
+        prev = offset;
+    }
+
+    return head;
+}
+
+static size_t write_elsif_list(ImageWriter *w, Elsif *list)
+{
+    size_t head = 0;
+    size_t prev = 0;
+    size_t offset;
+    Elsif *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        offset = write_bytes(w, pos, sizeof(Elsif));
+        set_pointer(w, offset + offsetof(Elsif, condition), write_expression(w, pos->condition));
+        set_pointer(w, offset + offsetof(Elsif, block), write_block(w, pos->block));
+        set_pointer(w, offset + offsetof(Elsif, next), 0);
+        if (prev) {
+            set_pointer(w, prev + offsetof(Elsif, next), offset);
+        } else {
+            head = offset;
+        }
+        prev = offset;
+    }
+
+    return head;
+}
+
+static size_t write_statement(ImageWriter *w, Statement *st)
+{
+    size_t offset;
+    size_t u;
+
+    offset = write_bytes(w, st, sizeof(Statement));
+    u = offset + offsetof(Statement, u);
+
+    switch (st->type) {
+        case EXPRESSION_STATEMENT:
+            set_pointer(w, u, write_expression(w, st->u.expression_s));
+            break;
+        case GLOBAL_STATEMENT:
+            set_pointer(w, u + offsetof(GlobalStatement, identifier_list), write_identifier_list(w, st->u.global_s.identifier_list));
+            break;
+        case IF_STATEMENT:
+            set_pointer(w, u + offsetof(IfStatement, condition), write_expression(w, st->u.if_s.condition));
+            set_pointer(w, u + offsetof(IfStatement, then_block), write_block(w, st->u.if_s.then_block));
+            set_pointer(w, u + offsetof(IfStatement, elsif_list), write_elsif_list(w, st->u.if_s.elsif_list));
+            set_pointer(w, u + offsetof(IfStatement, else_block), write_block(w, st->u.if_s.else_block));
+            break;
+        case WHILE_STATEMENT:
+            set_pointer(w, u + offsetof(WhileStatement, condition), write_expression(w, st->u.while_s.condition));
+            set_pointer(w, u + offsetof(WhileStatement, block), write_block(w, st->u.while_s.block));
+            break;
+        case FOR_STATEMENT:
+            set_pointer(w, u + offsetof(ForStatement, init), write_expression(w, st->u.for_s.init));
+            set_pointer(w, u + offsetof(ForStatement, condition), write_expression(w, st->u.for_s.condition));
+            set_pointer(w, u + offsetof(ForStatement, post), write_expression(w, st->u.for_s.post));
+            set_pointer(w, u + offsetof(ForStatement, block), write_block(w, st->u.for_s.block));
+            break;
+        case RETURN_STATEMENT:
+            set_pointer(w, u + offsetof(ReturnStatement, return_value), write_expression(w, st->u.return_s.return_value));
+            break;
+        case BREAK_STATEMENT:
+        case CONTINUE_STATEMENT:
+            break;
+        case TRY_STATEMENT:
+            set_pointer(w, u + offsetof(TryStatement, try_block), write_block(w, st->u.try_s.try_block));
+            set_pointer(w, u + offsetof(TryStatement, exception), write_string(w, st->u.try_s.exception));
+            set_pointer(w, u + offsetof(TryStatement, catch_block), write_block(w, st->u.try_s.catch_block));
+            break;
+        case YIELD_STATEMENT:
+            set_pointer(w, u + offsetof(YieldStatement, yield_value), write_expression(w, st->u.yield_s.yield_value));
+            break;
+        case STATEMENT_TYPE_COUNT_PLUS_1:
+        default:
+            DBG_panic(("bad case...%d", st->type));
+    }
+
+    return offset;
+}
+
+static size_t write_statement_list(ImageWriter *w, StatementList *list)
+{
+    size_t head = 0;
+    size_t prev = 0;
+    size_t offset;
+    StatementList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        offset = write_bytes(w, pos, sizeof(StatementList));
+        set_pointer(w, offset + offsetof(StatementList, statement), write_statement(w, pos->statement));
+        set_pointer(w, offset + offsetof(StatementList, next), 0);
+        if (prev) {
+            set_pointer(w, prev + offsetof(StatementList, next), offset);
+        } else {
+            head = offset;
+        }
+        prev = offset;
+    }
+
+    return head;
+}
+
+static size_t write_block(ImageWriter *w, Block *block)
+{
+    size_t offset;
+
+    if (NULL == block) {
+        return 0;
+    }
+
+    offset = write_bytes(w, block, sizeof(Block));
+    set_pointer(w, offset + offsetof(Block, statement_list), write_statement_list(w, block->statement_list));
+
+    return offset;
+}
+
+static size_t write_parameter_list(ImageWriter *w, ParameterList *list)
+{
+    size_t head = 0;
+    size_t prev = 0;
+    size_t offset;
+    ParameterList *pos;
+
+    for (pos = list; pos; pos = pos->next) {
+        offset = write_bytes(w, pos, sizeof(ParameterList));
+        set_pointer(w, offset + offsetof(ParameterList, name), write_string(w, pos->name));
+        set_pointer(w, offset + offsetof(ParameterList, next), 0);
+        if (prev) {
+            set_pointer(w, prev + offsetof(ParameterList, next), offset);
+        } else {
+            head = offset;
+        }
+        prev = offset;
+    }
+
+    return head;
+}
+
+static size_t write_function_body(ImageWriter *w, FunctionBody *body)
+{
+    size_t offset;
+
+    if (NULL == body) {
+        return 0;
+    }
+
+    offset = write_bytes(w, body, sizeof(FunctionBody));
+    set_pointer(w, offset + offsetof(FunctionBody, text), write_string(w, body->text));
+
+    return offset;
+}
+
+static size_t write_function(ImageWriter *w, FunctionDefinition *f)
+{
+    size_t offset;
+
+    offset = write_bytes(w, f, sizeof(FunctionDefinition));
+    set_pointer(w, offset + offsetof(FunctionDefinition, name), write_string(w, f->name));
+    set_pointer(w, offset + offsetof(FunctionDefinition, u.crowbar_f.parameter), write_parameter_list(w, f->u.crowbar_f.parameter));
+    set_pointer(w, offset + offsetof(FunctionDefinition, u.crowbar_f.block), write_block(w, f->u.crowbar_f.block));
+    set_pointer(w, offset + offsetof(FunctionDefinition, u.crowbar_f.lazy_body), write_function_body(w, f->u.crowbar_f.lazy_body));
+    set_pointer(w, offset + offsetof(FunctionDefinition, next), 0);
+
+    return offset;
+}
+
+static void dispose_writer(ImageWriter *w)
+{
+    MEM_free(w->buffer);
+    MEM_free(w->reloc);
+    MEM_free(w->strings);
+}
+
+static CRB_Boolean stat_source(char *source_path, CacheHeader *header)
+{
+    struct stat st;
+
+    if (stat(source_path, &st) != 0) {
+        return CRB_FALSE;
+    }
+    header->source_mtime = (long)st.st_mtim.tv_sec;
+    header->source_mtime_nsec = (long)st.st_mtim.tv_nsec;
+    header->source_size = (long)st.st_size;
+
+    return CRB_TRUE;
+}
+
+static void init_header(CacheHeader *header)
+{
+    memset(header, 0, sizeof(CacheHeader));
+    memcpy(header->magic, CACHE_MAGIC, sizeof(header->magic));
+    header->version = CACHE_VERSION;
+    header->pointer_size = sizeof(void*);
+    header->expression_size = sizeof(Expression);
+    header->statement_size = sizeof(Statement);
+    header->function_size = sizeof(FunctionDefinition);
+}
+
+/* foo.crb -> foo.crbc */
+char *CRB_compiled_path(char *source_path)
+{
+    char *path;
+
+    path = MEM_malloc(strlen(source_path) + strlen(CACHE_SUFFIX) + 1);
+    strcpy(path, source_path);
+    strcat(path, CACHE_SUFFIX);
+
+    return path;
+}
+
+int CRB_save_compiled(CRB_Interpreter *interpreter, char *path, char *source_path)
+{
+    ImageWriter w;
+    CacheHeader header;
+    FunctionDefinition *pos;
+    CachedFunction *functions;
+    int function_count;
+    int i;
+    char *tmp_path;
+    FILE *fp;
+    int ok;
+
+    init_header(&header);
+    if (!stat_source(source_path, &header)) {
+        return 0;
+    }
+
+    memset(&w, 0, sizeof(ImageWriter));
+    w.base = preferred_base(source_path);
+    header.base = w.base;
+    write_bytes(&w, &header, sizeof(CacheHeader));
+
+    function_count = 0;
+    for (pos = interpreter->program->function_list; pos; pos = pos->next) {
+        if (CROWBAR_FUNCTION_DEFINITION == pos->type) {
+            function_count++;
+        }
+    }
+    functions = MEM_malloc(sizeof(CachedFunction) * (function_count + 1));
+    i = 0;
+    for (pos = interpreter->program->function_list; pos; pos = pos->next) {
+        if (CROWBAR_FUNCTION_DEFINITION == pos->type) {
+            functions[i].reloc_start = w.reloc_count;
+            functions[i].function = write_function(&w, pos);
+            functions[i].reloc_count = w.reloc_count - functions[i].reloc_start;
+            i++;
+        }
+    }
+    header.statement_reloc = w.reloc_count;
+    header.statement_list = write_statement_list(&w, interpreter->program->statement_list);
+    header.statement_reloc_count = w.reloc_count - header.statement_reloc;
+    /* 节点区域的最后一个字节是'\0', 损坏的字符串指针最多读到这里 */
+    write_bytes(&w, "", 1);
+    header.function_count = function_count;
+    header.function_table = write_bytes(&w, functions, sizeof(CachedFunction) * function_count);
+    MEM_free(functions);
+    header.reloc_count = w.reloc_count;
+    header.reloc_table = write_bytes(&w, w.reloc, sizeof(size_t) * w.reloc_count);
+    header.image_size = w.size;
+    header.checksum = image_checksum(w.buffer, w.size);
+    memcpy(w.buffer, &header, sizeof(CacheHeader));
+
+    /* 先写临时文件再rename,避免别的进程读到写了一半的缓存 */
+    tmp_path = MEM_malloc(strlen(path) + 32);
+    sprintf(tmp_path, "%s.%ld.tmp", path, (long)getpid());
+    ok = 0;
+    fp = fopen(tmp_path, "wb");
+    if (fp) {
+        ok = (fwrite(w.buffer, 1, w.size, fp) == w.size);
+        ok = (fclose(fp) == 0) && ok;
+        if (ok) {
+            ok = (rename(tmp_path, path) == 0);
+        }
+        if (!ok) {
+            remove(tmp_path);
+        }
+    }
+    MEM_free(tmp_path);
+    dispose_writer(&w);
+
+    return ok;
+}
+
+/* 偏移在[from, to)里, 按指针对齐, 后面还放得下size字节 */
+static CRB_Boolean check_offset(size_t offset, size_t size, size_t from, size_t to)
+{
+    return offset >= from && offset <= to && size <= to - offset && 0 == offset % sizeof(size_t);
+}
+
+/* count个entry_size大小的项组成的表放在[from, to)里 */
+static CRB_Boolean check_table(size_t offset, int count, size_t entry_size, size_t from, size_t to)
+{
+    return count >= 0 && check_offset(offset, 0, from, to)
+        && (size_t)count <= (to - offset) / entry_size;
+}
+
+/* 重定位表里[start, start + count)这一段 */
+static CRB_Boolean check_reloc_range(CacheHeader *header, int start, int count)
+{
+    return start >= 0 && count >= 0 && start <= header->reloc_count && count <= header->reloc_count - start;
+}
+
+/* 只看头和源文件, 头后面的内容映射之后再校验 */
+static CRB_Boolean check_header(CacheHeader *header, size_t file_size, char *source_path)
+{
+    CacheHeader expect;
+
+    init_header(&expect);
+    if (!stat_source(source_path, &expect)) {
+        return CRB_FALSE;
+    }
+
+    return !memcmp(header->magic, expect.magic, sizeof(expect.magic))
+        && header->version == expect.version
+        && header->pointer_size == expect.pointer_size
+        && header->expression_size == expect.expression_size
+        && header->statement_size == expect.statement_size
+        && header->function_size == expect.function_size
+        && header->source_mtime == expect.source_mtime
+        && header->source_mtime_nsec == expect.source_mtime_nsec
+        && header->source_size == expect.source_size
+        && header->image_size == file_size
+        && header->function_table > sizeof(CacheHeader)
+        && check_table(header->function_table, header->function_count, sizeof(CachedFunction), sizeof(CacheHeader), header->reloc_table)
+        && check_table(header->reloc_table, header->reloc_count, sizeof(size_t), header->function_table, file_size)
+        && check_reloc_range(header, header->statement_reloc, header->statement_reloc_count)
+        && (0 == header->statement_list
+            || check_offset(header->statement_list, sizeof(StatementList), sizeof(CacheHeader), header->function_table));
+}
+
+/*
+ * 保存的指针值换成这次映射里的地址, 目标不在节点区域里时返回NULL.
+ * 节点区域以'\0'结尾(加载时检查过), 指向区域里的字符串一定在区域里结束
+ * */
+static void *resolve_pointer(char *image, CacheHeader *header, size_t value, size_t size)
+{
+    size_t offset = value - header->base;
+
+    if (!check_offset(offset, size, sizeof(CacheHeader), header->function_table)) {
+        return NULL;
+    }
+
+    return image + offset;
+}
+
+/*
+ * 重定位表的一段: 字段和它指向的目标都要在节点区域里.
+ * 先全部检查再修改, 失败时映射没有被改过, 再来一次结果一样.
+ * 映射在首选地址时只检查不修改.
+ * */
+static CRB_Boolean relocate_range(char *image, CacheHeader *header, int start, int count)
+{
+    size_t *reloc;
+    size_t value;
+    char *address;
+    int i;
+
+    reloc = (size_t*)(image + header->reloc_table) + start;
+    for (i = 0; i < count; ++i) {
+        if (!check_offset(reloc[i], sizeof(size_t), sizeof(CacheHeader), header->function_table)) {
+            return CRB_FALSE;
+        }
+        memcpy(&value, image + reloc[i], sizeof(size_t));
+        if (NULL == resolve_pointer(image, header, value, 1)) {
+            return CRB_FALSE;
+        }
+    }
+
+    if (image == (char*)header->base) {
+        return CRB_TRUE;
+    }
+    for (i = 0; i < count; ++i) {
+        memcpy(&value, image + reloc[i], sizeof(size_t));
+        address = resolve_pointer(image, header, value, 1);
+        memcpy(image + reloc[i], &address, sizeof(char*));
+    }
+
+    return CRB_TRUE;
+}
+
+/* 函数表指到的地方要像一个函数定义, 函数体到第一次调用时再检查 */
+static CRB_Boolean check_functions(char *image, CacheHeader *header)
+{
+    CachedFunction *functions;
+    FunctionDefinition *func;
+    int i;
+
+    functions = (CachedFunction*)(image + header->function_table);
+    for (i = 0; i < header->function_count; ++i) {
+        if (!check_offset(functions[i].function, sizeof(FunctionDefinition), sizeof(CacheHeader), header->function_table)
+                || !check_reloc_range(header, functions[i].reloc_start, functions[i].reloc_count)) {
+            return CRB_FALSE;
+        }
+        func = (FunctionDefinition*)(image + functions[i].function);
+        if (func->type != CROWBAR_FUNCTION_DEFINITION
+                || NULL == resolve_pointer(image, header, (size_t)func->name, 1)) {
+            return CRB_FALSE;
+        }
+    }
+
+    return CRB_TRUE;
+}
+
+int CRB_load_compiled(CRB_Interpreter *interpreter, char *path, char *source_path)
+{
+    int fd;
+    struct stat st;
+    char *image;
+    CacheHeader header;
+    CachedFunction *functions;
+    FunctionDefinition *cached;
+    FunctionDefinition *func;
+    CRB_Program *program;
+    int i;
+
+    program = interpreter->program;
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CacheHeader)
+            || pread(fd, &header, sizeof(CacheHeader), 0) != (ssize_t)sizeof(CacheHeader)
+            || !check_header(&header, st.st_size, source_path)) {
+        close(fd);
+        return 0;
+    }
+
+    /*
+     * 首选地址只是提示, 被占用时内核换一个地址.
+     * MAP_PRIVATE: 重定位时只复制被写到的页, 文件本身不会被改
+     * */
+    image = mmap((void*)header.base, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == (void*)image) {
+        return 0;
+    }
+
+    if (header.checksum != image_checksum(image, st.st_size)
+            || '\0' != image[header.function_table - 1]
+            || !check_functions(image, &header)
+            || !relocate_range(image, &header, header.statement_reloc, header.statement_reloc_count)) {
+        munmap(image, st.st_size);
+        return 0;
+    }
+
+    /* 函数定义复制出来挂到函数列表上, 映射里的页面不用写 */
+    functions = (CachedFunction*)(image + header.function_table);
+    for (i = header.function_count - 1; i >= 0; --i) {
+        cached = (FunctionDefinition*)(image + functions[i].function);
+        func = MEM_storage_malloc(program->program_storage, sizeof(FunctionDefinition));
+        func->name = resolve_pointer(image, &header, (size_t)cached->name, 1);
+        func->type = CROWBAR_FUNCTION_DEFINITION;
+        func->u.crowbar_f.parameter = NULL;
+        func->u.crowbar_f.block = NULL;
+        func->u.crowbar_f.lazy_body = NULL;
+        func->u.crowbar_f.cached = &functions[i];
+        func->next = program->function_list;
+        program->function_list = func;
+    }
+    program->statement_list = (StatementList*)(header.statement_list ? image + header.statement_list : NULL);
+
+    program->compiled_image = image;
+    program->compiled_image_size = st.st_size;
+
+    return 1;
+}
+
+/*
+ * 第一次调用缓存里的函数: 重定位它的那一段, 再取出参数列表和函数体.
+ * 在编译锁里调用. 缓存损坏时返回CRB_FALSE, 函数保持原样.
+ * */
+CRB_Boolean crb_load_cached_function(CRB_Program *program, FunctionDefinition *func)
+{
+    char *image = program->compiled_image;
+    CacheHeader *header = (CacheHeader*)image;
+    CachedFunction *entry = func->u.crowbar_f.cached;
+    FunctionDefinition *cached;
+    ParameterList *parameter = NULL;
+    Block *block = NULL;
+    FunctionBody *lazy_body = NULL;
+
+    cached = (FunctionDefinition*)(image + entry->function);
+    if ((cached->u.crowbar_f.parameter
+                && NULL == (parameter = resolve_pointer(image, header, (size_t)cached->u.crowbar_f.parameter, sizeof(ParameterList))))
+            || (cached->u.crowbar_f.block
+                && NULL == (block = resolve_pointer(image, header, (size_t)cached->u.crowbar_f.block, sizeof(Block))))
+            || (cached->u.crowbar_f.lazy_body
+                && NULL == (lazy_body = resolve_pointer(image, header, (size_t)cached->u.crowbar_f.lazy_body, sizeof(FunctionBody))))
+            || !relocate_range(image, header, entry->reloc_start, entry->reloc_count)) {
+        return CRB_FALSE;
+    }
+
+    func->u.crowbar_f.parameter = parameter;
+    func->u.crowbar_f.lazy_body = lazy_body;
+    func->u.crowbar_f.cached = NULL;
+    /* 不加锁的调用方看到block不是NULL就直接执行 */
+    func->u.crowbar_f.block = block;
+
+    return CRB_TRUE;
+}
+
+void crb_dispose_compiled(CRB_Program *program)
+{
+    if (program->compiled_image) {
+        munmap(program->compiled_image, program->compiled_image_size);
+        program->compiled_image = NULL;
+        program->compiled_image_size = 0;
+    }
+}
+
+/* vim: set tabstop=4 set shiftwidth=4 */
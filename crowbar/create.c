@@ -51,6 +51,17 @@ Expression* crb_create_array_expression(ExpressionList *list)
     return expr;
 }
 
+/* list里键和值交替排列 */
+Expression* crb_create_map_expression(ExpressionList *list)
+{
+    Expression *expr;
+
+    expr = crb_alloc_expression(MAP_EXPRESSION);
+    expr->u.map_literal = list;
+
+    return expr;
+}
+
 ExpressionList* crb_create_expression_list(Expression *expr)
 {
     ExpressionList *el;
@@ -75,27 +86,68 @@ ExpressionList* crb_chain_expression_list(ExpressionList *list, Expression *expr
     return list;
 }
 
-void crb_function_define(char *identifier, ParameterList *parameter_list, Block *block)
+static FunctionDefinition *alloc_function_define(char *identifier, ParameterList *parameter_list)
 {
     FunctionDefinition *f;
     CRB_Interpreter *inter;
 
-    if (crb_search_function(identifier))
+    inter = crb_get_current_interpreter();
+
+    if (crb_search_function(inter, identifier))
     {
-        crb_runtime_error(FUNCTION_MULTIOPLE_DEFINE_ERR, STRING_MESSAGE_ARGUMENT, "name", identifier, MESSAGE_ARGUMENT_END);
-        return;
+        crb_compile_error(FUNCTION_MULTIOPLE_DEFINE_ERR, STRING_MESSAGE_ARGUMENT, "name", identifier, MESSAGE_ARGUMENT_END);
+        return NULL;
     }
 
-    inter = crb_get_current_interpreter();
-
     f = crb_malloc(sizeof(FunctionDefinition));
     f->name = identifier;
     f->type = CROWBAR_FUNCTION_DEFINITION;
     f->u.crowbar_f.parameter = parameter_list;
-    f->u.crowbar_f.block = block;
+    f->u.crowbar_f.block = NULL;
+    f->u.crowbar_f.lazy_body = NULL;
+    f->u.crowbar_f.cached = NULL;
     /* 加到函数列表前面 */
-    f->next = inter->function_list;
-    inter->function_list = f;
+    f->next = inter->program->function_list;
+    inter->program->function_list = f;
+
+    return f;
+}
+
+void crb_function_define(char *identifier, ParameterList *parameter_list, Block *block)
+{
+    FunctionDefinition *f;
+
+    f = alloc_function_define(identifier, parameter_list);
+    if (f) {
+        f->u.crowbar_f.block = block;
+    }
+}
+
+FunctionBody* crb_create_function_body(char *text, int line_number)
+{
+    FunctionBody *body;
+
+    body = crb_malloc(sizeof(FunctionBody));
+    body->text = text;
+    body->line_number = line_number;
+
+    return body;
+}
+
+void crb_lazy_function_define(char *identifier, ParameterList *parameter_list, FunctionBody *body)
+{
+    FunctionDefinition *f;
+
+    f = alloc_function_define(identifier, parameter_list);
+    if (f) {
+        f->u.crowbar_f.lazy_body = body;
+    }
+}
+
+/* 延迟编译的函数体分析完成 */
+void crb_function_body_define(Block *block)
+{
+    crb_get_current_interpreter()->current_function->u.crowbar_f.block = block;
 }
 
 ParameterList *crb_create_parameter(char *identifier)
@@ -198,7 +250,7 @@ static Expression convert_value_to_expression(CRB_Value *v)
         expr.u.int_value = v->u.int_value;
     } else if (CRB_DOUBLE_VALUE == v->type) {
         expr.type = DOUBLE_EXPRESSION;
-        expr.u.int_value = v->u.double_value;
+        expr.u.double_value = v->u.double_value;
     } else {
         DBG_assert(CRB_BOOLEAN_VALUE == v->type, ("v->type:%d\n", v->type)); 
         /* ((CRB_BOOLEAN_VALUE == v->type) ? (void)(0) : ((DBG_set(dbg_default_controller, "create.c", 133)), (DBG_set_expression("CRB_BOOLEAN_VALUE == v->type")), DBG_assert_func ("v->type:%d\n", v->type))); */
@@ -420,5 +472,27 @@ Statement *crb_create_continue_statement(void)
     return alloc_statement(CONTINUE_STATEMENT);
 }
 
+Statement *crb_create_try_statement(Block *try_block, char *exception, Block *catch_block)
+{
+    Statement *st;
+
+    st = alloc_statement(TRY_STATEMENT);
+    st->u.try_s.try_block = try_block;
+    st->u.try_s.exception = exception;
+    st->u.try_s.catch_block = catch_block;
+
+    return st;
+}
+
+Statement *crb_create_yield_statement(Expression *expression)
+{
+    Statement *st;
+
+    st = alloc_statement(YIELD_STATEMENT);
+    st->u.yield_s.yield_value = expression;
+
+    return st;
+}
+
 /* vim: set tabstop=4 set shiftwidth=4 */
 
@@ -2,6 +2,7 @@
 #define PRIVATE_CROWBAR_H_INCLUDED
 
 #include <stdio.h>
+#include <setjmp.h>
 
 #include "MEM.h"
 #include "CRB.h"
@@ -12,6 +13,7 @@
 
 #define MESSAGE_ARGUMENT_MAX (256)
 #define LINE_BUF_SIZE (1024)
+#define NUMBER_BUF_SIZE (32) /* crb_format_int/crb_format_double的缓冲区 */
 
 /* 数学运算 */
 #define dkc_is_math_operator(operator) \
@@ -36,6 +38,8 @@ typedef enum {
     PARSE_ERR = 1, /* 语法分析错误 */
     CHARACTER_INVALID_ERR, /* 字符无效 */
     FUNCTION_MULTIOPLE_DEFINE_ERR, /* 函数重复定义   */
+    INT_LITERAL_OVERFLOW_ERR, /* 整数字面量超出范围 */
+    FUNCTION_BODY_UNTERMINATED_ERR, /* 函数体的{到文件结束也没有配对 */
     COMPILE_ERROR_COUNT_PLUS_1
 } CompilerError;
 
@@ -66,6 +70,23 @@ typedef enum {
     NEW_ARRAY_ARGUMENT_TYPE_ERR,
     INC_DEC_OPERAND_TYPE_ERR, /* 自增 自减 操作数 类型错误 */
     ARRAY_RESIZE_ARGUMENT_ERR,
+    YIELD_OUTSIDE_GENERATOR_ERR, /* 不在生成器里yield */
+    YIELD_IN_NATIVE_CALLBACK_ERR, /* 内置函数调回的函数里yield */
+    GENERATOR_ARGUMENT_ERR,
+    GENERATOR_RUNNING_ERR, /* 生成器正在执行时又调用next() */
+    GENERATOR_STACK_OVERFLOW_ERR, /* 生成器里函数调用太深, c栈不够 */
+    NATIVE_ARGUMENT_ERR, /* 内置函数的参数不正确 */
+    MAP_KEY_TYPE_ERR, /* 散列表的键不是字符串或整数 */
+    MESSAGE_VALUE_ERR, /* 不能传给其他线程的值 */
+    CHANNEL_CLOSED_ERR,
+    WORKER_ERR, /* join时工作线程出错 */
+    MATRIX_SHAPE_ERR, /* 矩阵的维数或长度不符合运算的要求 */
+    MATRIX_ELEMENT_TYPE_ERR, /* 矩阵里放了数值以外的值 */
+    MATRIX_READ_ONLY_ERR, /* 修改只读映射的矩阵 */
+    MAP_FILE_ERR, /* map_array打开或者映射文件失败 */
+    JSON_PARSE_ERR, /* json_parse的文本格式不对 */
+    JSON_VALUE_ERR, /* json_stringify遇到不能转换的值 */
+    PARALLEL_NESTED_ERR, /* 线程池里的函数又调用parallel_map/parallel_reduce */
     RUNTIME_ERROR_COUNT_PLUS_1  /* 计数加1 */
 } RuntimeError;
 
@@ -113,6 +134,7 @@ typedef enum {
     INDEX_EXPRESSION,
     INCREMENT_EXPRESSION,
     DECREMENT_EXPRESSION,
+    MAP_EXPRESSION,
     EXPRESSION_TYPE_COUNT_PLUS_1
 } ExpressionType;
 
@@ -175,6 +197,7 @@ struct Expression_tag {
         /* v2 */
         MethodCallExpression method_call_expression;
         ExpressionList *array_literal;
+        ExpressionList *map_literal; /* 键和值交替排列 */
         IndexExpression index_expression;
         IncrementOrDecrement inc_dec;
     } u;
@@ -229,6 +252,16 @@ typedef struct {
     Expression *return_value;
 } ReturnStatement;
 
+typedef struct {
+    Expression *yield_value;
+} YieldStatement;
+
+typedef struct {
+    Block *try_block;
+    char *exception; /* catch的变量名 */
+    Block *catch_block;
+} TryStatement;
+
 typedef enum {
     EXPRESSION_STATEMENT = 1,
     GLOBAL_STATEMENT ,
@@ -238,6 +271,8 @@ typedef enum {
     RETURN_STATEMENT ,
     BREAK_STATEMENT ,
     CONTINUE_STATEMENT ,
+    TRY_STATEMENT ,
+    YIELD_STATEMENT ,
     STATEMENT_TYPE_COUNT_PLUS_1 
 } StatementType;
 
@@ -251,6 +286,8 @@ struct Statement_tag {
         WhileStatement while_s;
         ForStatement for_s;
         ReturnStatement return_s;
+        TryStatement try_s;
+        YieldStatement yield_s;
     } u;
 };
 
@@ -265,13 +302,24 @@ typedef enum {
     FUNCTION_DEFINITION_TYPE_COUNT_PLUS_1
 } FunctionDefinitionType;
 
+/* 延迟编译的函数体: 只保存源代码文本,第一次调用时才分析 */
+typedef struct {
+    char *text;
+    int line_number;
+} FunctionBody;
+
+/* 预编译缓存里的函数, 定义在cache.c */
+typedef struct CachedFunction_tag CachedFunction;
+
 typedef struct FunctionDefinition_tag {
     char *name; /* 函数名 */
     FunctionDefinitionType type; /* 类型 */
     union {
         struct {
             ParameterList *parameter;
-            Block *block;
+            Block *block; /* 延迟编译时第一次调用前为NULL */
+            FunctionBody *lazy_body;
+            CachedFunction *cached; /* 从缓存加载的函数第一次调用前才重定位 */
         } crowbar_f;
 
         struct {
@@ -325,9 +373,49 @@ typedef struct RefInNativeFunc_tag {
 typedef enum {
     ARRAY_OBJECT = 1,
     STRING_OBJECT ,
+    GENERATOR_OBJECT ,
+    MAP_OBJECT ,
+    MATRIX_OBJECT ,
     OBJECT_TYPE_COUNT_PLUS_1
 } ObjectType;
 
+/* 生成器, 定义在generator.c */
+typedef struct Generator_tag Generator;
+
+/* 事件循环, 定义在event.c */
+typedef struct EventLoop_tag EventLoop;
+
+/* 工作线程和通道, 定义在worker.c */
+typedef struct ThreadGroup_tag ThreadGroup;
+typedef struct WorkerThread_tag WorkerThread;
+
+/* 数据并行的线程池, 定义在parallel.c */
+typedef struct WorkerPool_tag WorkerPool;
+typedef struct PoolThread_tag PoolThread;
+
+/* 线程之间传递的值, 和堆无关的深拷贝 */
+typedef struct Message_tag Message;
+struct Message_tag {
+    CRB_ValueType type;
+    union {
+        CRB_Boolean boolean_value;
+        int int_value;
+        double double_value;
+        char *string;
+        void *channel;
+        struct {
+            int size;
+            Message *elements;
+        } array;
+        struct {
+            CRB_Boolean is_int;
+            int dimension;
+            int *shape;
+            double *data;
+        } matrix;
+    } u;
+};
+
 /*
  * |   |
  * |   |
@@ -335,9 +423,10 @@ typedef enum {
  * |         | <- |   | <- |   |
  * */
 typedef struct {
-    int current_heap_size;
-    int current_threshold;
+    long current_heap_size; /* 矩阵可以超过2G, 和CRB_Limits的max_heap_size一样用long */
+    long current_threshold;
     CRB_Object *header;
+    CRB_Boolean dedup_pending; /* GC过了, 下一个语句之前合并相同的字符串 */
 } Heap;
 
 struct CRB_Array_tag {
@@ -346,9 +435,63 @@ struct CRB_Array_tag {
     CRB_Value *array;
 };
 
+/* 开放寻址(线性探测)的散列表, 键是字符串或整数, 散列值存在每一项里 */
+typedef enum {
+    MAP_ENTRY_EMPTY = 0,
+    MAP_ENTRY_USED,
+    MAP_ENTRY_REMOVED   /* 删除后留下的墓碑, 查找时不能停在这里 */
+} MapEntryState;
+
+typedef struct {
+    MapEntryState state;
+    unsigned int hash;
+    CRB_Value key;
+    CRB_Value value;
+} MapEntry;
+
+struct CRB_Map_tag {
+    int size;           /* 元素个数 */
+    int used;           /* 元素加墓碑 */
+    int alloc_size;     /* 2的幂 */
+    MapEntry *entries;
+};
+
+/*
+ * 数据连续存放(行优先)的n维矩阵, 整数矩阵也用double存, 取出时转成int.
+ * m[i]这样下标没给全时得到共享数据的视图, 它的数据也是连续的.
+ * */
+struct CRB_Matrix_tag {
+    CRB_Boolean is_int;
+    int dimension;
+    int *shape;         /* dimension个长度, 后面接着dimension个步长 */
+    int *stride;        /* 步长以元素为单位, 指向shape后半段 */
+    double *data;
+    int *int_data;      /* map_array映射的int文件, 这时data是NULL */
+    CRB_Object *base;   /* 视图共享的矩阵, 自己分配数据时是NULL */
+    CRB_Boolean read_only;
+    void *mapped;       /* map_array映射的地址, 回收时munmap */
+    size_t mapped_size;
+};
+
+/* 下标链m[i][j]...求值的中间状态, 下标给全之前不取出中间的行 */
+typedef struct {
+    CRB_Object *matrix; /* 还在累计下标的矩阵, 不是矩阵或者下标已经给全时是NULL */
+    int depth;          /* 已经给了几个下标 */
+    int offset;         /* 相对data的偏移 */
+    CRB_Value value;    /* 元素或视图, 给赋值和自增自减当左值用 */
+} MatrixIndex;
+
+/*
+ * substr/trim/split的结果是共享父字符串字符的视图, 不以'\0'结尾,
+ * 第一次要c字符串(crb_c_string)时才拷贝出来, 之后就和普通字符串一样.
+ * 不确定是不是视图时用crb_string_chars和length.
+ * */
 struct CRB_String_tag {
     CRB_Boolean is_literal;
-    char *string;
+    char *string;       /* 还没拷贝出来的视图是NULL */
+    int length;
+    CRB_Object *parent; /* 视图共享字符的字符串, 它自己不是没拷贝的视图 */
+    int offset;
 };
 
 /*
@@ -366,6 +509,9 @@ struct CRB_Object_tag {
     union {
         CRB_Array array;
         CRB_String string;
+        CRB_Map map;
+        CRB_Matrix matrix;
+        Generator *generator;
     } u;
     struct CRB_Object_tag *prev;
     struct CRB_Object_tag *next;
@@ -374,12 +520,42 @@ struct CRB_Object_tag {
 #define STACK_ALLOC_SIZE (256)
 #define ARRAY_ALLOC_SIZE (256)
 #define HEAP_THRESHOLD_SIZE (1024 * 256)
-#define dkc_is_object_value(type) ( CRB_STRING_VALUE == (type) || CRB_ARRAY_VALUE == (type) )
+#define MAP_ALLOC_SIZE (8)
+#define MATRIX_MAX_DIMENSION (8)
+#define dkc_is_object_value(type) ( CRB_STRING_VALUE == (type) || CRB_ARRAY_VALUE == (type) || CRB_GENERATOR_VALUE == (type) || CRB_MAP_VALUE == (type) || CRB_MATRIX_VALUE == (type) )
+/* 每个生成器自己的c栈, 计入堆大小 */
+#define GENERATOR_STACK_SIZE (256 * 1024)
+
+/* 可变长字符串的初始容量, 写文件时的缓冲区大小 */
+#define VSTR_ALLOC_SIZE (64)
+#define VSTR_FILE_BUF_SIZE (64 * 1024)
 
 typedef struct {
     char *string;
+    int length;
+    int alloc_size;
+    FILE *fp; /* 不是NULL时满了就写出去 */
 }VString ;
 
+/* print/fputs的输出缓冲, 每个FILE*一个, flush()/fclose/执行结束时写出去 */
+typedef struct OutputBuffer_tag {
+    VString buffer;
+    CRB_Boolean write_through; /* 终端和stderr每次都写出去 */
+    struct OutputBuffer_tag *next;
+} OutputBuffer;
+
+/* fgets/read_all/read_lines/read的预读缓冲, 每个FILE*一个, fclose时释放 */
+#define READ_BUF_SIZE (64 * 1024)
+typedef struct InputBuffer_tag {
+    FILE *fp;
+    char *buffer;
+    int start;      /* 还没读走的第一个字符 */
+    int end;
+    int alloc_size;
+    CRB_Boolean regular; /* 普通文件一次读满缓冲区, 管道和终端一次最多读一行, 不会等 */
+    struct InputBuffer_tag *next;
+} InputBuffer;
+
 typedef struct {
     int stack_alloc_size;
     int stack_pointer;
@@ -387,7 +563,12 @@ typedef struct {
 } Stack;
 
 CRB_Object* crb_create_crowbar_string_i(CRB_Interpreter *inter, char *str);
+CRB_Object* crb_create_array_i(CRB_Interpreter *inter, int size);
 CRB_Object* crb_literal_to_crb_string(CRB_Interpreter *inter, char *str);
+CRB_Object* crb_create_string_view_i(CRB_Interpreter *inter, CRB_Object *obj, int offset, int length);
+char* crb_c_string(CRB_Interpreter *inter, CRB_Object *obj);
+void crb_garbage_collect(CRB_Interpreter *inter);
+void crb_dedup_strings(CRB_Interpreter *inter);
 void shrink_stack(CRB_Interpreter *inter, int shrink_size);
 CRB_Value* peek_value(CRB_Interpreter *inter, int index);
 CRB_Value pop_value(CRB_Interpreter *inter);
@@ -398,10 +579,13 @@ Variable* crb_add_global_variable(CRB_Interpreter *inter, char *identifier);
 void push_value(CRB_Interpreter *inter, CRB_Value *value);
 CRB_Value* peek_stack(CRB_Interpreter *inter, int index);
 void dispose_ref_in_native_method(CRB_LocalEnvironment *env);
-void CRB_add_global_variable(CRB_Interpreter *inter, char *identifier, CRB_Value *value);
 Expression* crb_create_index_expression(Expression *array, Expression *index);
 Expression* crb_create_method_call_expression(Expression *expression, char *method_name, ArgumentList *argument);
 Expression* crb_create_incdec_expression(Expression *operand, ExpressionType inc_or_dec);
+Expression* crb_create_array_expression(ExpressionList *list);
+Expression* crb_create_map_expression(ExpressionList *list);
+ExpressionList* crb_create_expression_list(Expression *expr);
+ExpressionList* crb_chain_expression_list(ExpressionList *list, Expression *expr);
 
 void crb_array_resize(CRB_Interpreter *inter, CRB_Object *obj, int new_size);
 void crb_array_add(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value v);
@@ -419,21 +603,74 @@ typedef struct {
     CRB_String *strings;
 } StringPool;
 
+/* 编译结果: 分析树,crowbar函数,字符串字面量. 运行时只读,可以被多个解释器共享 */
+struct CRB_Program_tag {
+    MEM_Storage program_storage;
+    FunctionDefinition *function_list; /* crowbar函数 */
+    StatementList *statement_list;
+    char *compiled_image; /* mmap进来的预编译缓存 */
+    size_t compiled_image_size;
+    int ref_count;
+};
+
 /* 解释器 */
 struct CRB_Interpreter_tag {
     MEM_Storage interpreter_storage; /* 解释器存储 */
     MEM_Storage execute_storage; /* 运行时存储 */
     Variable *variable; /* 变量列表 */
-    FunctionDefinition *function_list;
-    StatementList *statement_list;
+    CRB_Program *program;
+    FunctionDefinition *native_function_list; /* 内置函数,每个解释器一份 */
     int current_line_number;
     /* v2 */
     Heap heap;
     Stack stack;
     CRB_LocalEnvironment *top_environment;
+    CRB_LocalEnvironment *free_environment; /* 用完的局部环境, 下次调用时再用 */
+    CRB_Value call_result; /* CRB_call_function的返回值, GC时作为根 */
+    /* 资源限制 */
+    CRB_Limits limits;
+    long step_count;
+    long next_budget_check; /* 步数到这里时检查限制和时间 */
+    double deadline;        /* 毫秒 */
+    jmp_buf *recovery;      /* 中止时跳回CRB_interpreter/CRB_call_function */
+    CRB_Status status;
+    char *error_message;    /* 最近一次错误, 带行号 */
+    jmp_buf *compile_recovery; /* 编译出错时跳回CRB_compile/延迟编译 */
+    CRB_Boolean strict; /* 严格模式: 不延迟编译函数体,语法错误立即报告 */
+    CRB_Boolean string_dedup; /* GC之后让内容相同的字符串共用一份字符 */
+    CRB_Boolean native_callback; /* 内置函数执行中(包括它调回crowbar函数的途中) */
+    int native_line_number; /* 正在执行的内置函数的调用行, 内置函数报错时用 */
+    FunctionDefinition *current_function; /* 正在延迟编译的函数 */
+    Generator *current_generator; /* 正在执行的生成器 */
+    EventLoop *event_loop;  /* 第一次用到ev_*函数时创建 */
+    ThreadGroup *thread_group; /* 工作线程和根解释器共用 */
+    WorkerThread *worker_list; /* spawn创建的线程 */
+    WorkerPool *worker_pool; /* 第一次parallel_map/parallel_reduce时创建 */
+    PoolThread *pool_thread; /* 线程池里的解释器指向所在的线程, 步数从调用者那里领 */
+    OutputBuffer *output_list;
+    InputBuffer *input_list;
 };
 
 void crb_function_define(char *identifier, ParameterList *parameter_list, Block *block);
+FunctionBody *crb_create_function_body(char *text, int line_number);
+void crb_lazy_function_define(char *identifier, ParameterList *parameter_list, FunctionBody *body);
+void crb_function_body_define(Block *block);
+void crb_compile_function_body(CRB_Interpreter *inter, FunctionDefinition *func);
+void crb_compile_all_functions(CRB_Interpreter *inter);
+void crb_open_execute_storage(CRB_Interpreter *inter);
+void crb_start_budget(CRB_Interpreter *inter);
+void crb_check_budget(CRB_Interpreter *inter);
+void crb_abort(CRB_Interpreter *inter, CRB_Status status);
+void crb_unwind(CRB_Interpreter *inter, int stack_pointer, CRB_LocalEnvironment *env);
+void crb_dispose_environment_chain(CRB_LocalEnvironment *env);
+void crb_dispose_free_environments(CRB_Interpreter *inter);
+
+/* 循环和函数调用时计数, 平时只有一次比较 */
+#define crb_count_step(inter) \
+    (++(inter)->step_count >= (inter)->next_budget_check ? crb_check_budget(inter) : (void)0)
+void crb_scan_function_body(char *text);
+void crb_finish_function_body(void);
+void crb_restart_lexer(FILE *fp);
 ParameterList *crb_create_parameter(char *identifier);
 ParameterList *crb_chain_parameter(ParameterList *list, char *identifier);
 
@@ -469,18 +706,31 @@ Statement *crb_create_expression_statement(Expression *expression);
 Statement *crb_create_return_statement(Expression *expression);
 Statement *crb_create_break_statement(void);
 Statement *crb_create_continue_statement(void);
+Statement *crb_create_try_statement(Block *try_block, char *exception, Block *catch_block);
+Statement *crb_create_yield_statement(Expression *expression);
 
 char *crb_create_identifier(char *str);
 void crb_open_string_literal(void);
 void crb_add_string_literal(int letter);
 void crb_reset_string_literal_buffer(void);
 char *crb_close_string_literal(void);
+char* crb_string_chars(CRB_Object *obj);
+int crb_string_compare(CRB_Object *left, CRB_Object *right);
+CRB_Object* crb_string_substr(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *start, CRB_Value *length, int line_number);
+CRB_Object* crb_string_trim(CRB_Interpreter *inter, CRB_Object *obj);
+CRB_Object* crb_string_split(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *separator, int line_number);
+int crb_string_find(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *sub, CRB_Boolean reverse, int line_number);
+int crb_string_count(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *sub, int line_number);
+CRB_Boolean crb_string_starts_with(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *affix, CRB_Boolean at_end, int line_number);
+CRB_Object* crb_string_replace(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *old_value, CRB_Value *new_value, int line_number);
+CRB_Object* crb_string_join(CRB_Interpreter *inter, CRB_Object *sep, CRB_Value *array, int line_number);
 
 StatementResult crb_execute_statement_list(CRB_Interpreter *inter, CRB_LocalEnvironment *env, StatementList *list);
 
 CRB_Value crb_eval_binary_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env, ExpressionType operator, Expression *left, Expression *right);
 CRB_Value crb_eval_minus_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Expression *operand);
 CRB_Value crb_eval_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Expression *expr);
+CRB_Value* crb_get_identifier_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env, char *identifier);
 
 void crb_refer_string(CRB_String *str);
 void crb_release_string(CRB_String *str);
@@ -496,18 +746,125 @@ void *crb_execute_malloc(CRB_Interpreter *inter, size_t size);
 Variable* crb_search_local_variable(CRB_LocalEnvironment *env, char *identifier);
 Variable* crb_search_global_variable(CRB_Interpreter *inter, char *identifier);
 Variable* crb_add_local_variable(CRB_LocalEnvironment *env, char *identifier);
-FunctionDefinition *crb_search_function(char *name);
+FunctionDefinition *crb_search_function(CRB_Interpreter *inter, char *name);
 char *crb_get_operator_string(ExpressionType type);
+void crb_vstr_clear(VString *v);
+void crb_vstr_open_file(VString *v, FILE *fp);
+void crb_vstr_flush(VString *v);
+void crb_vstr_append_chars(VString *v, char *chars, int length);
+void crb_vstr_append_string(VString *v, char *str);
+void crb_vstr_append_character(VString *v, int ch);
+void crb_vstr_append_value(VString *v, CRB_Value *value);
 
 void crb_compile_error(CompilerError id, ...);
-void crb_runtime_error(int line_number, RuntimeError id, ...);
+void crb_runtime_error(CRB_Interpreter *inter, int line_number, RuntimeError id, ...);
 
 CRB_Value crb_nv_print_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
 CRB_Value crb_nv_fopen_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
 CRB_Value crb_nv_fclose_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
 CRB_Value crb_nv_fgets_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
 CRB_Value crb_nv_fputs_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_flush_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+void crb_flush_output(CRB_Interpreter *inter, FILE *fp);
+void crb_dispose_output(CRB_Interpreter *inter);
+void crb_dispose_file_input(CRB_Interpreter *inter, FILE *fp);
+void crb_dispose_input(CRB_Interpreter *inter);
+CRB_Value crb_nv_read_all_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_read_lines_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_read_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
 CRB_Value crb_nv_new_array_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_new_map_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_heap_size_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
 void crb_add_std_fp(CRB_Interpreter *inter);
 
+/* heap.c */
+void crb_gc_mark(CRB_Object *obj);
+void crb_gc_mark_environment(CRB_LocalEnvironment *env);
+CRB_Object* crb_create_generator_i(CRB_Interpreter *inter);
+CRB_Object* crb_create_map_i(CRB_Interpreter *inter);
+void crb_map_rehash(CRB_Interpreter *inter, CRB_Object *obj, int new_alloc_size);
+CRB_Object* crb_create_matrix_i(CRB_Interpreter *inter, CRB_Boolean is_int, int dimension, int *shape);
+CRB_Object* crb_create_matrix_view_i(CRB_Interpreter *inter, CRB_Object *matrix, int depth, int offset);
+CRB_Object* crb_create_mapped_matrix_i(CRB_Interpreter *inter, CRB_Boolean is_int, CRB_Boolean read_only);
+
+/* map.c */
+unsigned int crb_hash_string(char *str, int length);
+CRB_Value* crb_map_search(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *key, int line_number);
+CRB_Value* crb_map_lvalue(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *key, int line_number);
+CRB_Boolean crb_map_remove(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *key, int line_number);
+CRB_Object* crb_map_keys(CRB_Interpreter *inter, CRB_Object *obj);
+CRB_Object* crb_map_values(CRB_Interpreter *inter, CRB_Object *obj);
+
+/* number.c */
+int crb_format_int(char *buf, int value);
+int crb_format_double(char *buf, double value);
+CRB_Boolean crb_parse_int(char *chars, int length, int *value);
+CRB_Boolean crb_parse_double(char *chars, int length, double *value);
+CRB_Value crb_nv_parse_int_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_parse_double_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+
+/* json.c */
+CRB_Value crb_nv_json_parse_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_json_stringify_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+
+/* matrix.c */
+CRB_Value crb_nv_new_matrix_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_new_int_matrix_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_map_array_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+void crb_unmap_matrix(CRB_Matrix *matrix);
+double crb_matrix_element(CRB_Matrix *matrix, int offset);
+void crb_matrix_index_start(CRB_Value *value, MatrixIndex *index);
+void crb_matrix_index_add(CRB_Interpreter *inter, MatrixIndex *index, CRB_Value *subscript, int line_number);
+void crb_matrix_load(CRB_Interpreter *inter, MatrixIndex *index);
+void crb_matrix_store(CRB_Interpreter *inter, MatrixIndex *index, int line_number);
+CRB_Object* crb_matrix_shape(CRB_Interpreter *inter, CRB_Object *obj);
+CRB_Object* crb_matrix_transpose(CRB_Interpreter *inter, CRB_Object *obj, int line_number);
+CRB_Object* crb_matrix_matmul(CRB_Interpreter *inter, CRB_Object *left, CRB_Object *right, int line_number);
+CRB_Value crb_matrix_reduce(CRB_Interpreter *inter, CRB_Object *obj, char *name, CRB_Value *axis, int line_number);
+
+/* generator.c */
+CRB_Value crb_nv_generator_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_generator_next(CRB_Interpreter *inter, Generator *gen, int line_number);
+CRB_Boolean crb_generator_done(Generator *gen);
+void crb_generator_yield(CRB_Interpreter *inter, CRB_Value *value, int line_number);
+void crb_check_generator_stack(CRB_Interpreter *inter, int line_number);
+void crb_mark_generator(Generator *gen);
+void crb_mark_running_generators(CRB_Interpreter *inter);
+void crb_dispose_generator(Generator *gen);
+
+/* event.c */
+CRB_Value crb_nv_ev_popen_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_ev_open_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_ev_connect_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_ev_on_line_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_ev_write_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_ev_close_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_ev_timer_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_ev_run_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+void crb_dispose_event_loop(CRB_Interpreter *inter);
+
+/* worker.c */
+CRB_Value crb_nv_channel_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_send_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_recv_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_close_channel_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_spawn_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_join_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+void crb_value_to_message(CRB_Interpreter *inter, CRB_Value *value, Message *msg);
+CRB_Value crb_message_to_value(CRB_Interpreter *inter, Message *msg);
+void crb_dispose_message(Message *msg);
+void crb_share_thread_group(CRB_Interpreter *parent, CRB_Interpreter *child);
+CRB_Boolean crb_has_running_workers(CRB_Interpreter *inter);
+void crb_dispose_workers(CRB_Interpreter *inter);
+
+/* parallel.c */
+CRB_Value crb_nv_parallel_map_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Value crb_nv_parallel_reduce_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args);
+CRB_Boolean crb_take_pool_steps(CRB_Interpreter *inter);
+void crb_dispose_worker_pool(CRB_Interpreter *inter);
+
+/* cache.c */
+CRB_Boolean crb_load_cached_function(CRB_Program *program, FunctionDefinition *func);
+void crb_dispose_compiled(CRB_Program *program);
+
 #endif
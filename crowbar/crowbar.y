@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include "crowbar.h"
 #define YYDEBUG 1
+int yylex(void);
+int yyerror(const char *str);
 %}
 %union {
     char                *identifier;
@@ -14,15 +16,17 @@
     Block               *block;
     Elsif               *elsif;
     IdentifierList      *identifier_list;
+    FunctionBody        *function_body;
 }
 %token <expression>     INT_LITERAL
 %token <expression>     DOUBLE_LITERAL
 %token <expression>     STRING_LITERAL
 %token <identifier>     IDENTIFIER
+%token <function_body>  FUNCTION_BODY
 %token FUNCTION IF ELSE ELSIF WHILE FOR RETURN_T BREAK CONTINUE NULL_T
         LP RP LC RC LB RB SEMICOLON COMMA ASSIGN LOGICAL_AND LOGICAL_OR
         EQ NE GT GE LT LE ADD SUB MUL DIV MOD TRUE_T FALSE_T GLOBAL_T DOT
-        INCREMENT DECREMENT
+        INCREMENT DECREMENT FUNCTION_BODY_START TRY CATCH YIELD COLON
 %type   <parameter_list> parameter_list
 %type   <argument_list> argument_list
 %type   <expression> expression expression_opt
@@ -30,15 +34,24 @@
         equality_expression relational_expression
         additive_expression multiplicative_expression
         unary_expression postfix_expression primary_expression array_literal
-%type   <expression_list> expression_list
+        map_literal
+%type   <expression_list> expression_list map_entry_list
 %type   <statement> statement global_statement
         if_statement while_statement for_statement
-        return_statement break_statement continue_statement
+        return_statement break_statement continue_statement try_statement
+        yield_statement
 %type   <statement_list> statement_list
 %type   <block> block
 %type   <elsif> elsif elsif_list
 %type   <identifier_list> identifier_list
 %%
+compile_unit
+        : translation_unit
+        | FUNCTION_BODY_START block
+        {
+            crb_function_body_define($2);
+        }
+        ;
 translation_unit
         : definition_or_statement
         | translation_unit definition_or_statement
@@ -49,8 +62,8 @@ definition_or_statement
         {
             CRB_Interpreter *inter = crb_get_current_interpreter();
 
-            inter->statement_list
-                = crb_chain_statement_list(inter->statement_list, $1);
+            inter->program->statement_list
+                = crb_chain_statement_list(inter->program->statement_list, $1);
         }
         ;
 function_definition
@@ -62,6 +75,14 @@ function_definition
         {
             crb_function_define($2, NULL, $5);
         }
+        | FUNCTION IDENTIFIER LP parameter_list RP FUNCTION_BODY
+        {
+            crb_lazy_function_define($2, $4, $6);
+        }
+        | FUNCTION IDENTIFIER LP RP FUNCTION_BODY
+        {
+            crb_lazy_function_define($2, NULL, $5);
+        }
         ;
 parameter_list
         : IDENTIFIER
@@ -233,6 +254,7 @@ primary_expression
             $$ = crb_create_null_expression();
         }
         | array_literal
+        | map_literal
         ;
 array_literal
         : LC expression_list RC
@@ -244,6 +266,26 @@ array_literal
             $$ = crb_create_array_expression($2);
         }
         ;
+map_literal
+        : LC map_entry_list RC
+        {
+            $$ = crb_create_map_expression($2);
+        }
+        | LC map_entry_list COMMA RC
+        {
+            $$ = crb_create_map_expression($2);
+        }
+        ;
+map_entry_list
+        : expression COLON expression
+        {
+            $$ = crb_chain_expression_list(crb_create_expression_list($1), $3);
+        }
+        | map_entry_list COMMA expression COLON expression
+        {
+            $$ = crb_chain_expression_list(crb_chain_expression_list($1, $3), $5);
+        }
+        ;
 expression_list
         : /* empty */
         {
@@ -270,6 +312,8 @@ statement
         | return_statement
         | break_statement
         | continue_statement
+        | try_statement
+        | yield_statement
         ;
 global_statement
         : GLOBAL_T identifier_list SEMICOLON
@@ -356,6 +400,18 @@ continue_statement
             $$ = crb_create_continue_statement();
         }
         ;
+try_statement
+        : TRY block CATCH LP IDENTIFIER RP block
+        {
+            $$ = crb_create_try_statement($2, $5, $7);
+        }
+        ;
+yield_statement
+        : YIELD expression_opt SEMICOLON
+        {
+            $$ = crb_create_yield_statement($2);
+        }
+        ;
 block
         : LC statement_list RC
         {
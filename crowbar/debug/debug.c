@@ -14,10 +14,11 @@ struct DBG_Controller_tag {
     int current_debug_level;
 };
 
-static DBG_Controller st_current_controller;
-static char *st_current_file_name;
-static char *st_assert_expression;
-static int st_current_line;
+/* DBG_set和DBG_assert_func之间不能被别的线程改掉, 每个线程一份 */
+static __thread DBG_Controller st_current_controller;
+static __thread char *st_current_file_name;
+static __thread char *st_assert_expression;
+static __thread int st_current_line;
 
 struct DBG_Controller_tag st_dbg_default_controller = {
     NULL,
@@ -16,39 +16,6 @@ extern MessageFormat crb_compile_error_message_format[];
 extern MessageFormat crb_runtime_error_message_format[];
 
 
-static void clear_v_string(VString *s) 
-{
-    s->string = NULL;
-}
-
-int my_strlen(char *str)
-{
-    if (NULL == str) {
-        return 0;
-    }
-    return strlen(str);
-}
-
-static void add_string(VString *v, char *str)
-{
-    int new_size;
-    int old_len;
-
-    old_len = my_strlen(v->string);
-    new_size = old_len + strlen(str) + 1;
-    v->string = MEM_realloc(v->string, new_size);
-    strcpy(&v->string[old_len], str);
-}
-
-static void add_character(VString *v, int ch)
-{
-    int current_len;
-    current_len = my_strlen(v->string);
-    v->string = MEM_realloc(v->string, current_len + 2);
-    v->string[current_len] = ch;
-    v->string[current_len + 1] = '\0';
-}
-
 typedef struct {
     MessageArgumentType type;
     char *name;
@@ -97,6 +64,7 @@ static void create_message_argument(MessageArgument *arg, va_list ap)
         index++;
         assert(index < MESSAGE_ARGUMENT_MAX);
     }
+    arg[index].type = MESSAGE_ARGUMENT_END;
     /* fprintf(stderr, "create_message_argument index:%d\n", index); */
 }
 
@@ -126,7 +94,7 @@ static void format_message(MessageFormat *format, VString *v, va_list ap)
     create_message_argument(arg, ap);
     for (i = 0; format->format[i] != '\0'; ++i) {
         if (format->format[i] != '$') {
-            add_character(v, format->format[i]);
+            crb_vstr_append_character(v, format->format[i]);
             continue;
         }
         assert(format->format[i+1] == '(');
@@ -145,24 +113,21 @@ static void format_message(MessageFormat *format, VString *v, va_list ap)
         /* fprintf(stderr, "format_message search arg_name %s ok\n", arg_name); */
         switch (cur_arg.type) {
             case INT_MESSAGE_ARGUMENT:
-                sprintf(buf, "%d", cur_arg.u.int_val);
-                add_string(v, buf);
+                crb_vstr_append_chars(v, buf, crb_format_int(buf, cur_arg.u.int_val));
                 break;
             case DOUBLE_MESSAGE_ARGUMENT:
-                sprintf(buf, "%f", cur_arg.u.double_val);
-                add_string(v, buf);
+                crb_vstr_append_chars(v, buf, crb_format_double(buf, cur_arg.u.double_val));
                 break;
             case STRING_MESSAGE_ARGUMENT:
-                strcpy(buf, cur_arg.u.string_val);
-                add_string(v, buf);
+                crb_vstr_append_string(v, cur_arg.u.string_val);
                 break;
             case POINTER_MESSAGE_ARGUMENT:
                 sprintf(buf, "%p", cur_arg.u.pointer_val);
-                add_string(v, buf);
+                crb_vstr_append_string(v, buf);
                 break;
             case CHARACTER_MESSAGE_ARGUMENT:
                 sprintf(buf, "%c", cur_arg.u.character_val);
-                add_string(v, buf);
+                crb_vstr_append_string(v, buf);
                 break;
             case MESSAGE_ARGUMENT_END:
                 assert(0);
@@ -194,40 +159,68 @@ void self_check()
     }
 }
 
+/*
+ * 错误信息(带行号)保存在解释器里, 之后跳回恢复点,
+ * 没有恢复点时(不是在编译或执行中)输出后退出.
+ * */
+static void set_error_message(CRB_Interpreter *inter, int line_number, VString *message)
+{
+    char buf[LINE_BUF_SIZE];
+
+    sprintf(buf, "%d:", line_number);
+    MEM_free(inter->error_message);
+    inter->error_message = MEM_malloc(strlen(buf) + message->length + 1);
+    strcpy(inter->error_message, buf);
+    if (message->string) {
+        strcat(inter->error_message, message->string);
+    }
+    MEM_free(message->string);
+}
+
 void crb_compile_error(CompilerError id, ...)
 {
     va_list ap;
     VString message;
-    int line_number;
+    CRB_Interpreter *inter;
 
     /* fprintf(stderr, "crb_compile_error.....id:%d\n", id); */
     self_check();
     va_start(ap, id);
-    line_number = crb_get_current_interpreter()->current_line_number;
-    clear_v_string(&message);
+    inter = crb_get_current_interpreter();
+    crb_vstr_clear(&message);
     format_message(&crb_compile_error_message_format[id], &message, ap);
-    /* fprintf(stderr, "%3d:%s\n", line_number, message.string); */
     va_end(ap);
+    set_error_message(inter, inter->current_line_number, &message);
 
+    if (inter->compile_recovery) {
+        longjmp(*inter->compile_recovery, 1);
+    }
+    fprintf(stderr, "%s\n", inter->error_message);
     exit(1);
 }
 
-void crb_runtime_error(int line_number, RuntimeError id, ...)
+void crb_runtime_error(CRB_Interpreter *inter, int line_number, RuntimeError id, ...)
 {
     va_list ap;
     VString message;
 
     /* fprintf(stderr, "crb_runtime_error.....id:%d\n", id); */
-    /* fprintf(stderr, "+++++++\n"); */
     self_check();
-    /* fprintf(stderr, "=======\n"); */
     va_start(ap, id);
-    clear_v_string(&message);
-    /* fprintf(stderr, "-------\n"); */
+    crb_vstr_clear(&message);
     format_message(&crb_runtime_error_message_format[id], &message, ap);
-    fprintf(stderr, "%3d:%s\n", line_number, message.string); 
     va_end(ap);
+    set_error_message(inter, line_number, &message);
 
+    /* 编译时常量折叠出的错误算作编译错误, 执行中跳回最近的try或CRB_interpreter */
+    if (inter->compile_recovery) {
+        longjmp(*inter->compile_recovery, 1);
+    }
+    if (inter->recovery) {
+        crb_abort(inter, CRB_STATUS_RUNTIME_ERROR);
+    }
+    crb_flush_output(inter, NULL);
+    fprintf(stderr, "%s\n", inter->error_message);
     exit(1);
 }
 
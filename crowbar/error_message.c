@@ -20,6 +20,12 @@ MessageFormat crb_compile_error_message_format[] = {
     {
         "函数名重复($(name))",
     },
+    {
+        "整数($(token))超出范围",
+    },
+    {
+        "函数体的{没有对应的}",
+    },
     {
         "dummy",
     }
@@ -105,6 +111,57 @@ MessageFormat crb_runtime_error_message_format[] = {
     {
         "数组的resize()必须传入整数类型",
     },
+    {
+        "yield只能在生成器里使用",
+    },
+    {
+        "内置函数调回的函数里不能yield",
+    },
+    {
+        "generator()的第一个参数必须是函数名",
+    },
+    {
+        "生成器正在执行,不能再调用next()",
+    },
+    {
+        "生成器里的函数调用太深",
+    },
+    {
+        "$(name)的参数不正确",
+    },
+    {
+        "散列表的键必须是字符串或整数",
+    },
+    {
+        "$(type)不能传给其他线程",
+    },
+    {
+        "通道已经关闭",
+    },
+    {
+        "工作线程出错($(message))",
+    },
+    {
+        "矩阵的形状不符合$(name)的要求",
+    },
+    {
+        "矩阵的元素只能是整数或实数",
+    },
+    {
+        "只读映射的矩阵不能修改",
+    },
+    {
+        "不能映射文件$(name)($(message))",
+    },
+    {
+        "JSON格式不正确(第$(position)个字符附近)",
+    },
+    {
+        "$(type)不能转换成JSON",
+    },
+    {
+        "$(name)不能在parallel_map/parallel_reduce的函数里调用",
+    },
     {
         "dummy",
     }
@@ -97,7 +97,7 @@ static void eval_identifier_expression(CRB_Interpreter *inter, CRB_LocalEnvironm
         v = vp->value;
     } else {
         /* fprintf(stderr, "eval_identifier_expression search_global_variable_from_env else vp:%p\n", vp); */
-        crb_runtime_error(expr->line_number, VARIABLE_NOT_FOUND_ERR, STRING_MESSAGE_ARGUMENT, "token", expr->u.identifier, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, expr->line_number, VARIABLE_NOT_FOUND_ERR, STRING_MESSAGE_ARGUMENT, "name", expr->u.identifier, MESSAGE_ARGUMENT_END);
     }
 
     push_value(inter, &v);
@@ -105,7 +105,8 @@ static void eval_identifier_expression(CRB_Interpreter *inter, CRB_LocalEnvironm
 
 static void eval_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Expression *expr);
 
-static CRB_Value* get_identifier_value(CRB_Interpreter *inter, CRB_LocalEnvironment *env, char *identifier)
+/* 变量不存在时新建, 赋值和catch绑定异常时用 */
+CRB_Value* crb_get_identifier_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env, char *identifier)
 {
     Variable *new_var;
     Variable *left;
@@ -132,46 +133,125 @@ static CRB_Value* get_identifier_value(CRB_Interpreter *inter, CRB_LocalEnvironm
     return &left->value;
 }
 
-CRB_Value* get_array_element_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Expression *expr)
+/*
+ * 栈顶是容器和下标, 取出元素之后两个都弹出.
+ * 散列表里没有这个键时, create为真则插入null, 否则返回NULL
+ * */
+static CRB_Value* lookup_element(CRB_Interpreter *inter, Expression *expr, CRB_Boolean create)
 {
     CRB_Value array;
     CRB_Value index;
+    CRB_Value *dest;
 
-    fprintf(stderr,"get_array_element_lvalue eval_expression(env:%p array expr:%p)\n", env, expr->u.index_expression.array);
-    eval_expression(inter, env, expr->u.index_expression.array);
-    fprintf(stderr,"get_array_element_lvalue eval_expression(env:%p index expr:%p)\n", env, expr->u.index_expression.index);
-    eval_expression(inter, env, expr->u.index_expression.index);
+    /* 插入时可能GC, 键在栈上留到插入之后 */
+    if (CRB_MAP_VALUE == peek_stack(inter, 1)->type) {
+        if (create) {
+            dest = crb_map_lvalue(inter, peek_stack(inter, 1)->u.object, peek_stack(inter, 0), expr->line_number);
+        } else {
+            dest = crb_map_search(inter, peek_stack(inter, 1)->u.object, peek_stack(inter, 0), expr->line_number);
+        }
+        shrink_stack(inter, 2);
+        return dest;
+    }
 
     index = pop_value(inter);
     array = pop_value(inter);
 
     if (array.type != CRB_ARRAY_VALUE) {
-        crb_runtime_error(expr->line_number, INDEX_OPERAND_NOT_ARRAY_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, expr->line_number, INDEX_OPERAND_NOT_ARRAY_ERR, MESSAGE_ARGUMENT_END);
     }
 
     if (index.type != CRB_INT_VALUE) {
-        crb_runtime_error(expr->line_number, INDEX_OPERAND_NOT_INT_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, expr->line_number, INDEX_OPERAND_NOT_INT_ERR, MESSAGE_ARGUMENT_END);
     }
 
     if (index.u.int_value < 0 ||
             index.u.int_value >= array.u.object->u.array.size) {
-        crb_runtime_error(expr->line_number, ARRAY_INDEX_OUT_OF_BOUNDS_ERR, INT_MESSAGE_ARGUMENT, "size", array.u.object->u.array.size,
+        crb_runtime_error(inter, expr->line_number, ARRAY_INDEX_OUT_OF_BOUNDS_ERR, INT_MESSAGE_ARGUMENT, "size", array.u.object->u.array.size,
                 INT_MESSAGE_ARGUMENT, "index", index.u.int_value, MESSAGE_ARGUMENT_END);
     }
 
     return &array.u.object->u.array.array[index.u.int_value];
 }
 
-CRB_Value* get_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Expression *expr)
+/*
+ * 下标链a[i][j]...除了最后一个下标的部分求值, 结果留在栈顶.
+ * 栈顶是矩阵时下标累计在index里, 矩阵留在栈上, 不取出中间的行
+ * */
+static void eval_index_operand(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Expression *expr, MatrixIndex *index)
+{
+    CRB_Value *element;
+    CRB_Value null_value;
+
+    if (expr->type != INDEX_EXPRESSION) {
+        eval_expression(inter, env, expr);
+        crb_matrix_index_start(peek_stack(inter, 0), index);
+        return;
+    }
+
+    eval_index_operand(inter, env, expr->u.index_expression.array, index);
+    eval_expression(inter, env, expr->u.index_expression.index);
+    if (index->matrix) {
+        crb_matrix_index_add(inter, index, peek_stack(inter, 0), expr->line_number);
+        shrink_stack(inter, 1);
+        if (index->depth < index->matrix->u.matrix.dimension) {
+            return;
+        }
+        /* 下标已经给全, 中间结果是元素本身 */
+        crb_matrix_load(inter, index);
+        shrink_stack(inter, 1);
+        push_value(inter, &index->value);
+        index->matrix = NULL;
+        return;
+    }
+
+    element = lookup_element(inter, expr, CRB_FALSE);
+    if (NULL == element) {
+        null_value.type = CRB_NULL_VALUE;
+        push_value(inter, &null_value);
+    } else {
+        push_value(inter, element);
+    }
+    crb_matrix_index_start(peek_stack(inter, 0), index);
+}
+
+/*
+ * 矩阵的元素不是CRB_Value, 返回的是index->value里的拷贝,
+ * 这时index->matrix不是NULL, 改完之后要用crb_matrix_store写回去
+ * */
+static CRB_Value* get_element_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Expression *expr, CRB_Boolean create, MatrixIndex *index)
+{
+    eval_index_operand(inter, env, expr->u.index_expression.array, index);
+    eval_expression(inter, env, expr->u.index_expression.index);
+
+    if (index->matrix) {
+        crb_matrix_index_add(inter, index, peek_stack(inter, 0), expr->line_number);
+        shrink_stack(inter, 1);
+        /* 创建视图时矩阵还在栈上 */
+        crb_matrix_load(inter, index);
+        shrink_stack(inter, 1);
+        return &index->value;
+    }
+
+    return lookup_element(inter, expr, create);
+}
+
+CRB_Value* get_array_element_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Expression *expr, MatrixIndex *index)
+{
+    return get_element_lvalue(inter, env, expr, CRB_TRUE, index);
+}
+
+CRB_Value* get_lvalue(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Expression *expr, MatrixIndex *index)
 {
     CRB_Value *dest;
     /* fprintf(stderr, "get_lvalue start %d...\n", expr->type); */
+    index->matrix = NULL;
     if (IDENTIFIER_EXPRESSION == expr->type) {
-        dest = get_identifier_value(inter, env, expr->u.identifier);
+        dest = crb_get_identifier_lvalue(inter, env, expr->u.identifier);
     } else if (INDEX_EXPRESSION == expr->type) {
-        dest = get_array_element_lvalue(inter, env, expr);
+        dest = get_array_element_lvalue(inter, env, expr, index);
     } else {
-        crb_runtime_error(expr->line_number, NOT_LVALUE_ERROR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, expr->line_number, NOT_LVALUE_ERROR, MESSAGE_ARGUMENT_END);
     }
 
     return dest;
@@ -181,6 +261,7 @@ static void eval_assign_expression(CRB_Interpreter *inter, CRB_LocalEnvironment
 {
     CRB_Value *src;
     CRB_Value *dest;
+    MatrixIndex index;
 
     /* fprintf(stderr, "eval_assign_expression left:%d... expr:%d\n", left->type, expr->type); */ 
     fprintf(stderr, "eval_assign_expression eval_expression(env:%p left:%p %s expr:%p)\n", env, left, left->u.identifier, expr);
@@ -188,9 +269,12 @@ static void eval_assign_expression(CRB_Interpreter *inter, CRB_LocalEnvironment
     src = peek_stack(inter, 0);
     /* fprintf(stderr, "eval_assign_expression peek_stack ok\n"); */
 
-    dest = get_lvalue(inter, env, left);
+    dest = get_lvalue(inter, env, left, &index);
     /* fprintf(stderr, "eval_assign_expression get_lvalue ok\n"); */
     *dest = *src;
+    if (index.matrix) {
+        crb_matrix_store(inter, &index, left->line_number);
+    }
 }
 
 static CRB_Boolean eval_binary_boolean(CRB_Interpreter *inter, ExpressionType operator, CRB_Boolean left, CRB_Boolean right, int line_number)
@@ -202,7 +286,7 @@ static CRB_Boolean eval_binary_boolean(CRB_Interpreter *inter, ExpressionType op
         result = left != right;
     } else {
         char *op_str = crb_get_operator_string(operator);
-        crb_runtime_error(line_number, NOT_BOOLEAN_OPERATOR_ERR, STRING_MESSAGE_ARGUMENT, "operator", op_str, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, line_number, NOT_BOOLEAN_OPERATOR_ERR, STRING_MESSAGE_ARGUMENT, "operator", op_str, MESSAGE_ARGUMENT_END);
     }
 
     return result;
@@ -237,11 +321,15 @@ static void eval_binary_int(CRB_Interpreter *inter, ExpressionType operator, int
             result->u.int_value = left * right;
             break;
         case DIV_EXPRESSION:
-            /* 0 */
+            if (0 == right) {
+                crb_runtime_error(inter, line_number, DIVISION_BY_ZERO_ERR, MESSAGE_ARGUMENT_END);
+            }
             result->u.int_value = left / right;
             break;
         case MOD_EXPRESSION:
-            /* 0 */
+            if (0 == right) {
+                crb_runtime_error(inter, line_number, DIVISION_BY_ZERO_ERR, MESSAGE_ARGUMENT_END);
+            }
             result->u.int_value = left % right;
             break;
         case LOGICAL_AND_EXPRESSION:
@@ -273,6 +361,7 @@ static void eval_binary_int(CRB_Interpreter *inter, ExpressionType operator, int
         case INDEX_EXPRESSION:
         case INCREMENT_EXPRESSION:
         case DECREMENT_EXPRESSION:
+        case MAP_EXPRESSION:
         case EXPRESSION_TYPE_COUNT_PLUS_1:
         default:
             DBG_panic(("bad case...%d line:%d\n", operator, line_number));
@@ -282,7 +371,7 @@ static void eval_binary_int(CRB_Interpreter *inter, ExpressionType operator, int
 static void eval_binary_double(CRB_Interpreter *inter, ExpressionType operator, double left, double right, CRB_Value *result, int line_number)
 {
     if (dkc_is_math_operator(operator)) {
-        result->type = CRB_INT_VALUE;
+        result->type = CRB_DOUBLE_VALUE;
     } else if (dkc_is_compare_operator(operator)) {
         result->type = CRB_BOOLEAN_VALUE;
     } else {
@@ -340,18 +429,19 @@ static void eval_binary_double(CRB_Interpreter *inter, ExpressionType operator,
         case MINUS_EXPRESSION:
         case FUNCTION_CALL_EXPRESSION:
         case NULL_EXPRESSION:
+        case MAP_EXPRESSION:
         case EXPRESSION_TYPE_COUNT_PLUS_1:
         default:
             DBG_panic(("bad case...%d line:%d\n", operator, line_number));
     }
 }
 
-static CRB_Boolean eval_compare_string(ExpressionType operator, CRB_Value *left, CRB_Value *right, int line_number)
+static CRB_Boolean eval_compare_string(CRB_Interpreter *inter, ExpressionType operator, CRB_Value *left, CRB_Value *right, int line_number)
 {
     CRB_Boolean result;
     int cmp;
 
-    cmp = strcmp(left->u.object->u.string.string, right->u.object->u.string.string);
+    cmp = crb_string_compare(left->u.object, right->u.object);
 
     if (EQ_EXPRESSION == operator) {
         result = (cmp == 0);
@@ -367,7 +457,7 @@ static CRB_Boolean eval_compare_string(ExpressionType operator, CRB_Value *left,
         result = (cmp <= 0);
     } else {
         char *op_str = crb_get_operator_string(operator);
-        crb_runtime_error(line_number, BAD_OPERATOR_FOR_STRING_ERR, STRING_MESSAGE_ARGUMENT, "operator", op_str, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, line_number, BAD_OPERATOR_FOR_STRING_ERR, STRING_MESSAGE_ARGUMENT, "operator", op_str, MESSAGE_ARGUMENT_END);
     }
 
     return result;
@@ -383,7 +473,7 @@ static CRB_Boolean eval_binary_null(CRB_Interpreter *inter, ExpressionType opera
         result = !(CRB_NULL_VALUE == left->type && CRB_NULL_VALUE == right->type);
     } else {
         char *op_str = crb_get_operator_string(operator);
-        crb_runtime_error(line_number, BAD_OPERATOR_FOR_STRING_ERR, STRING_MESSAGE_ARGUMENT, "operator", op_str, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, line_number, BAD_OPERATOR_FOR_STRING_ERR, STRING_MESSAGE_ARGUMENT, "operator", op_str, MESSAGE_ARGUMENT_END);
     }
 
     return result;
@@ -391,21 +481,22 @@ static CRB_Boolean eval_binary_null(CRB_Interpreter *inter, ExpressionType opera
 
 void chain_string(CRB_Interpreter *inter, CRB_Value *left, CRB_Value *right, CRB_Value *result)
 {
-    int len;
+    int left_len;
+    int right_len;
     char *str;
     char *right_str;
-    CRB_Object *right_obj;
 
     right_str = CRB_value_to_string(right);
+    right_len = strlen(right_str);
 
-    right_obj = crb_create_crowbar_string_i(inter, right_str);
-
+    /* 左边可能是视图, 按长度拷贝 */
     result->type = CRB_STRING_VALUE;
-    len = strlen(left->u.object->u.string.string) + strlen(right_obj->u.string.string);
-    str = MEM_malloc(len + 1);
+    left_len = left->u.object->u.string.length;
+    str = MEM_malloc(left_len + right_len + 1);
 
-    strcpy(str, left->u.object->u.string.string);
-    strcat(str, right_obj->u.string.string);
+    memcpy(str, crb_string_chars(left->u.object), left_len);
+    memcpy(str + left_len, right_str, right_len + 1);
+    MEM_free(right_str);
     result->u.object = crb_create_crowbar_string_i(inter, str);
 }
 
@@ -446,7 +537,7 @@ void eval_binary_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env, E
 
     } else if (CRB_STRING_VALUE == left_val->type && CRB_STRING_VALUE == right_val->type) { /* string 比较 */
         result.type = CRB_BOOLEAN_VALUE;
-        result.u.boolean_value = eval_compare_string(operator, left_val, right_val, left->line_number);
+        result.u.boolean_value = eval_compare_string(inter, operator, left_val, right_val, left->line_number);
 
     } else if (CRB_NULL_VALUE == left_val->type || CRB_NULL_VALUE == right_val->type) {
         result.type = CRB_BOOLEAN_VALUE;
@@ -455,7 +546,7 @@ void eval_binary_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env, E
     } else {
         char *op_str = crb_get_operator_string(operator);
         /* fprintf(stderr, "eval_binary_expression runtime error left:%d right:%d\n", left_val->type, right_val->type); */
-        crb_runtime_error(left->line_number, BAD_OPERATOR_FOR_STRING_ERR, STRING_MESSAGE_ARGUMENT, "operator", op_str, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, left->line_number, BAD_OPERATOR_FOR_STRING_ERR, STRING_MESSAGE_ARGUMENT, "operator", op_str, MESSAGE_ARGUMENT_END);
     }
 
     pop_value(inter);
@@ -482,7 +573,7 @@ static CRB_Value eval_logical_and_or_expression(CRB_Interpreter *inter, CRB_Loca
     left_val = pop_value(inter);
 
     if (left_val.type != CRB_BOOLEAN_VALUE) {
-        crb_runtime_error(left->line_number, NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, left->line_number, NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
     }
 
     if (LOGICAL_AND_EXPRESSION == operator) {
@@ -502,7 +593,7 @@ static CRB_Value eval_logical_and_or_expression(CRB_Interpreter *inter, CRB_Loca
     eval_expression(inter, env, right);
     right_val = pop_value(inter);
     if (right_val.type != CRB_BOOLEAN_VALUE) {
-        crb_runtime_error(right->line_number, NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, right->line_number, NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
     }
     result.u.boolean_value = right_val.u.boolean_value;
 
@@ -524,7 +615,7 @@ CRB_Value crb_eval_minus_expression(CRB_Interpreter *inter, CRB_LocalEnvironment
         result.type = CRB_DOUBLE_VALUE;
         result.u.double_value = -operand_val.u.double_value;
     } else {
-        crb_runtime_error(operand->line_number, MINUS_OPERAND_TYPE_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, operand->line_number, MINUS_OPERAND_TYPE_ERR, MESSAGE_ARGUMENT_END);
     }
 
     push_value(inter, &result);
@@ -534,7 +625,13 @@ static CRB_LocalEnvironment* alloc_local_environment(CRB_Interpreter *inter)
 {
     CRB_LocalEnvironment *ret;
 
-    ret = MEM_malloc(sizeof(CRB_LocalEnvironment));
+    /* 每次函数调用都要一个, 用完的留在free_environment里 */
+    if (inter->free_environment) {
+        ret = inter->free_environment;
+        inter->free_environment = ret->next;
+    } else {
+        ret = MEM_malloc(sizeof(CRB_LocalEnvironment));
+    }
     ret->variable = NULL;
     ret->global_variable = NULL;
     ret->ref_in_native_method = NULL;
@@ -557,10 +654,8 @@ void dispose_ref_in_native_method(CRB_LocalEnvironment *env)
     }
 }
 
-static void dispose_local_environment(CRB_Interpreter *inter)
+static void clear_local_environment(CRB_LocalEnvironment *env)
 {
-    CRB_LocalEnvironment *env = inter->top_environment;
-
     while(env->variable) {
         Variable *tmp;
         tmp = env->variable;
@@ -576,17 +671,63 @@ static void dispose_local_environment(CRB_Interpreter *inter)
     }
 
     dispose_ref_in_native_method(env);
-    inter->top_environment = env->next;
+}
 
+static void free_local_environment(CRB_LocalEnvironment *env)
+{
+    clear_local_environment(env);
     MEM_free(env);
 }
 
+static void dispose_local_environment(CRB_Interpreter *inter)
+{
+    CRB_LocalEnvironment *env = inter->top_environment;
+
+    inter->top_environment = env->next;
+    clear_local_environment(env);
+    env->next = inter->free_environment;
+    inter->free_environment = env;
+}
+
+void crb_dispose_free_environments(CRB_Interpreter *inter)
+{
+    CRB_LocalEnvironment *env;
+
+    while (inter->free_environment) {
+        env = inter->free_environment;
+        inter->free_environment = env->next;
+        MEM_free(env);
+    }
+}
+
+/* 回收挂起的生成器时释放它的整条局部环境链 */
+void crb_dispose_environment_chain(CRB_LocalEnvironment *env)
+{
+    CRB_LocalEnvironment *next;
+
+    for (; env; env = next) {
+        next = env->next;
+        free_local_environment(env);
+    }
+}
+
+/* 中止之后回到恢复点时的栈和局部环境 */
+void crb_unwind(CRB_Interpreter *inter, int stack_pointer, CRB_LocalEnvironment *env)
+{
+    while (inter->top_environment != env) {
+        dispose_local_environment(inter);
+    }
+    inter->stack.stack_pointer = stack_pointer;
+}
+
 static CRB_Value call_native_function(CRB_Interpreter *inter, CRB_LocalEnvironment *env, CRB_LocalEnvironment *caller_env, Expression *expr, CRB_NativeFunctionProc *proc)
 {
     CRB_Value value;
     int arg_count;
     ArgumentList *arg_p;
     CRB_Value *args;
+    int outer_line_number;
+    CRB_Boolean outer_callback;
 
     for (arg_count = 0, arg_p = expr->u.function_call_expression.argument; arg_p; arg_p = arg_p->next) {
         fprintf(stderr, "call_native_function eval_expression(env:%p expr:%p)\n", caller_env, arg_p->expression);
@@ -596,7 +737,14 @@ static CRB_Value call_native_function(CRB_Interpreter *inter, CRB_LocalEnvironme
 
     args = &inter->stack.stack[inter->stack.stack_pointer - arg_count];
 
+    /* 内置函数里可能调回crowbar函数再调别的内置函数, 返回时恢复 */
+    outer_line_number = inter->native_line_number;
+    outer_callback = inter->native_callback;
+    inter->native_line_number = expr->line_number;
+    inter->native_callback = CRB_TRUE;
     value = proc(inter, env, arg_count, args);
+    inter->native_line_number = outer_line_number;
+    inter->native_callback = outer_callback;
     shrink_stack(inter, arg_count);
 
     push_value(inter, &value);
@@ -609,6 +757,10 @@ static void call_crowbar_function(CRB_Interpreter *inter, CRB_LocalEnvironment *
     ArgumentList *arg_p;
     ParameterList *param_p;
 
+    /* 缓存里的函数重定位之后参数列表才能用 */
+    if (NULL == func->u.crowbar_f.block) {
+        crb_compile_function_body(inter, func);
+    }
 
     for (arg_p = expr->u.function_call_expression.argument, param_p = func->u.crowbar_f.parameter; arg_p; arg_p = arg_p->next, param_p = param_p->next) {
 
@@ -616,7 +768,7 @@ static void call_crowbar_function(CRB_Interpreter *inter, CRB_LocalEnvironment *
         Variable *new_var;
 
         if (NULL == param_p) {
-            crb_runtime_error(expr->line_number, ARGUMENT_TOO_MANY_ERR, MESSAGE_ARGUMENT_END);
+            crb_runtime_error(inter, expr->line_number, ARGUMENT_TOO_MANY_ERR, MESSAGE_ARGUMENT_END);
         }
 
         fprintf(stderr,"call_crowbar_function eval_expression(env:%p expr:%p)\n", caller_env, arg_p->expression);
@@ -628,7 +780,7 @@ static void call_crowbar_function(CRB_Interpreter *inter, CRB_LocalEnvironment *
     }
 
     if (param_p) {
-        crb_runtime_error(expr->line_number, ARGUMENT_TOO_FEW_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, expr->line_number, ARGUMENT_TOO_FEW_ERR, MESSAGE_ARGUMENT_END);
     }
 
     result = crb_execute_statement_list(inter, local_env, func->u.crowbar_f.block->statement_list);
@@ -648,9 +800,13 @@ static void eval_function_call_expression(CRB_Interpreter *inter, CRB_LocalEnvir
     CRB_LocalEnvironment *local_env;
     char *identifier = expr->u.function_call_expression.identifier;
 
-    func = crb_search_function(identifier);
+    func = crb_search_function(inter, identifier);
     if (NULL == func) {
-        crb_runtime_error(expr->line_number, FUNCTION_NOT_FOUND_ERR, STRING_MESSAGE_ARGUMENT, "name", identifier, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, expr->line_number, FUNCTION_NOT_FOUND_ERR, STRING_MESSAGE_ARGUMENT, "name", identifier, MESSAGE_ARGUMENT_END);
+    }
+    crb_count_step(inter);
+    if (inter->current_generator) {
+        crb_check_generator_stack(inter, expr->line_number);
     }
     
     local_env = alloc_local_environment(inter);
@@ -669,6 +825,105 @@ static void eval_function_call_expression(CRB_Interpreter *inter, CRB_LocalEnvir
     dispose_local_environment(inter);
 }
 
+CRB_Function *CRB_lookup_function(CRB_Interpreter *inter, char *name)
+{
+    return crb_search_function(inter, name);
+}
+
+/*
+ * 参数直接压栈, crowbar函数再绑定到形参.
+ * 超过资源限制时返回null; 如果是在执行中(比如内置函数里)被调用的, 继续跳回外层.
+ * */
+CRB_Value CRB_call_function(CRB_Interpreter *inter, CRB_Function *func, int arg_count, CRB_Value *args)
+{
+    CRB_LocalEnvironment *local_env;
+    ParameterList *param_p;
+    Variable *new_var;
+    StatementResult result;
+    CRB_Value *arg_base;
+    CRB_Value v;
+    jmp_buf recovery;
+    jmp_buf *outer_recovery;
+    CRB_Boolean outer_callback;
+    int stack_pointer;
+    CRB_LocalEnvironment *top_environment;
+    int i;
+
+    if (NULL == inter->execute_storage) {
+        crb_open_execute_storage(inter);
+    }
+
+    outer_recovery = inter->recovery;
+    outer_callback = inter->native_callback;
+    stack_pointer = inter->stack.stack_pointer;
+    top_environment = inter->top_environment;
+    if (NULL == outer_recovery) {
+        crb_start_budget(inter);
+    }
+    if (setjmp(recovery)) {
+        crb_unwind(inter, stack_pointer, top_environment);
+        inter->recovery = outer_recovery;
+        inter->native_callback = outer_callback;
+        if (outer_recovery) {
+            longjmp(*outer_recovery, 1);
+        }
+        crb_flush_output(inter, NULL);
+        inter->call_result.type = CRB_NULL_VALUE;
+        return inter->call_result;
+    }
+    inter->recovery = &recovery;
+    crb_count_step(inter);
+
+    for (i = 0; i < arg_count; ++i) {
+        push_value(inter, &args[i]);
+    }
+    arg_base = &inter->stack.stack[inter->stack.stack_pointer - arg_count];
+
+    local_env = alloc_local_environment(inter);
+    switch (func->type) {
+    case CROWBAR_FUNCTION_DEFINITION:
+        if (NULL == func->u.crowbar_f.block) {
+            crb_compile_function_body(inter, func);
+        }
+        for (i = 0, param_p = func->u.crowbar_f.parameter; i < arg_count; ++i, param_p = param_p->next) {
+            if (NULL == param_p) {
+                crb_runtime_error(inter, inter->native_line_number, ARGUMENT_TOO_MANY_ERR, MESSAGE_ARGUMENT_END);
+            }
+            new_var = crb_add_local_variable(local_env, param_p->name);
+            new_var->value = arg_base[i];
+        }
+        if (param_p) {
+            crb_runtime_error(inter, inter->native_line_number, ARGUMENT_TOO_FEW_ERR, MESSAGE_ARGUMENT_END);
+        }
+        result = crb_execute_statement_list(inter, local_env, func->u.crowbar_f.block->statement_list);
+        if (RETURN_STATEMENT_RESULT == result.type) {
+            v = result.u.return_value;
+        } else {
+            v.type = CRB_NULL_VALUE;
+        }
+        break;
+    case NATIVE_FUNCTION_DEFINITION:
+        v = func->u.native_f.proc(inter, local_env, arg_count, arg_base);
+        break;
+    case FUNCTION_DEFINITION_TYPE_COUNT_PLUS_1:
+    default:
+        DBG_panic(("bad case..%d\n", func->type));
+    }
+
+    /* 局部环境释放之后返回值就没有根了 */
+    inter->call_result = v;
+    shrink_stack(inter, arg_count);
+    dispose_local_environment(inter);
+    inter->recovery = outer_recovery;
+    inter->native_callback = outer_callback;
+    /* 从c语言调用时, 返回之前输出 */
+    if (NULL == outer_recovery) {
+        crb_flush_output(inter, NULL);
+    }
+
+    return v;
+}
+
 static void eval_array_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env, ExpressionList *list)
 {
     CRB_Value v;
@@ -698,7 +953,27 @@ static void eval_array_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *
     }
 }
 
-static void check_method_argument_count(int line_number, ArgumentList *arg_list, int arg_count) {
+/* 散列表一直在栈上, 每一对键值求值之后插入 */
+static void eval_map_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Expression *expr)
+{
+    CRB_Value v;
+    CRB_Value *dest;
+    ExpressionList *pos;
+
+    v.type = CRB_MAP_VALUE;
+    v.u.object = crb_create_map_i(inter);
+    push_value(inter, &v);
+
+    for (pos = expr->u.map_literal; pos; pos = pos->next->next) {
+        eval_expression(inter, env, pos->expression);
+        eval_expression(inter, env, pos->next->expression);
+        dest = crb_map_lvalue(inter, v.u.object, peek_stack(inter, 1), expr->line_number);
+        *dest = *peek_stack(inter, 0);
+        shrink_stack(inter, 2);
+    }
+}
+
+static void check_method_argument_count(CRB_Interpreter *inter, int line_number, ArgumentList *arg_list, int arg_count) {
     ArgumentList *arg_p;
     int count = 0;
 
@@ -707,9 +982,9 @@ static void check_method_argument_count(int line_number, ArgumentList *arg_list,
     }
 
     if (count < arg_count) {
-        crb_runtime_error(line_number, ARGUMENT_TOO_FEW_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, line_number, ARGUMENT_TOO_FEW_ERR, MESSAGE_ARGUMENT_END);
     } else if (count > arg_count) {
-        crb_runtime_error(line_number, ARGUMENT_TOO_MANY_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, line_number, ARGUMENT_TOO_MANY_ERR, MESSAGE_ARGUMENT_END);
     }
 }
 
@@ -727,7 +1002,7 @@ static void eval_method_call_expression(CRB_Interpreter *inter, CRB_LocalEnviron
     if (CRB_ARRAY_VALUE == left->type) {
         if (!strcmp(expr->u.method_call_expression.identifier, "add")) {
             CRB_Value *add;
-            check_method_argument_count(expr->line_number, expr->u.method_call_expression.argument, 1);
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 1);
             fprintf(stderr , "eval_method_call_expression eval_expression(env:%p expr:%p)\n", env, expr->u.method_call_expression.argument->expression);
             eval_expression(inter, env, expr->u.method_call_expression.argument->expression);
             add = peek_stack(inter, 0);
@@ -736,18 +1011,18 @@ static void eval_method_call_expression(CRB_Interpreter *inter, CRB_LocalEnviron
             result.type = CRB_NULL_VALUE;
 
         } else if (!strcmp(expr->u.method_call_expression.identifier, "size")) {
-            check_method_argument_count(expr->line_number, expr->u.method_call_expression.argument, 0);
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 0);
             result.type = CRB_INT_VALUE;
             result.u.int_value = left->u.object->u.array.size;
 
         } else if (!strcmp(expr->u.method_call_expression.identifier, "resize")) {
             CRB_Value new_size;
-            check_method_argument_count(expr->line_number, expr->u.method_call_expression.argument, 1);
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 1);
             fprintf(stderr, "eval_method_call_expression eval_expression(env:%p, expr:%p)\n", env, expr->u.method_call_expression.argument->expression);
             eval_expression(inter, env, expr->u.method_call_expression.argument->expression);
             new_size = pop_value(inter);
             if (new_size.type != CRB_INT_VALUE) {
-                crb_runtime_error(expr->line_number, ARRAY_RESIZE_ARGUMENT_ERR, MESSAGE_ARGUMENT_END);
+                crb_runtime_error(inter, expr->line_number, ARRAY_RESIZE_ARGUMENT_ERR, MESSAGE_ARGUMENT_END);
             }
 
             crb_array_resize(inter, left->u.object, new_size.u.int_value);
@@ -756,17 +1031,143 @@ static void eval_method_call_expression(CRB_Interpreter *inter, CRB_LocalEnviron
             error_flag = CRB_TRUE;
         }
     } else if (CRB_STRING_VALUE == left->type) {
-        if (!strcmp(expr->u.method_call_expression.identifier, "length")) {
-            check_method_argument_count(expr->line_number, expr->u.method_call_expression.argument, 0);
+        /* 参数求值之后不能再用left */
+        char *name = expr->u.method_call_expression.identifier;
+        CRB_Object *str = left->u.object;
+
+        if (!strcmp(name, "length")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 0);
             result.type = CRB_INT_VALUE;
-            result.u.int_value = strlen(left->u.object->u.string.string);
+            result.u.int_value = str->u.string.length;
+        } else if (!strcmp(name, "substr")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 2);
+            eval_expression(inter, env, expr->u.method_call_expression.argument->expression);
+            eval_expression(inter, env, expr->u.method_call_expression.argument->next->expression);
+            result.type = CRB_STRING_VALUE;
+            result.u.object = crb_string_substr(inter, str, peek_stack(inter, 1), peek_stack(inter, 0), expr->line_number);
+            shrink_stack(inter, 2);
+        } else if (!strcmp(name, "trim")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 0);
+            result.type = CRB_STRING_VALUE;
+            result.u.object = crb_string_trim(inter, str);
+        } else if (!strcmp(name, "split")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 1);
+            eval_expression(inter, env, expr->u.method_call_expression.argument->expression);
+            result.type = CRB_ARRAY_VALUE;
+            result.u.object = crb_string_split(inter, str, peek_stack(inter, 0), expr->line_number);
+            pop_value(inter);
+        } else if (!strcmp(name, "find") || !strcmp(name, "rfind") || !strcmp(name, "count")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 1);
+            eval_expression(inter, env, expr->u.method_call_expression.argument->expression);
+            result.type = CRB_INT_VALUE;
+            if ('c' == name[0]) {
+                result.u.int_value = crb_string_count(inter, str, peek_stack(inter, 0), expr->line_number);
+            } else {
+                result.u.int_value = crb_string_find(inter, str, peek_stack(inter, 0), 'r' == name[0], expr->line_number);
+            }
+            pop_value(inter);
+        } else if (!strcmp(name, "starts_with") || !strcmp(name, "ends_with")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 1);
+            eval_expression(inter, env, expr->u.method_call_expression.argument->expression);
+            result.type = CRB_BOOLEAN_VALUE;
+            result.u.boolean_value = crb_string_starts_with(inter, str, peek_stack(inter, 0), 'e' == name[0], expr->line_number);
+            pop_value(inter);
+        } else if (!strcmp(name, "replace")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 2);
+            eval_expression(inter, env, expr->u.method_call_expression.argument->expression);
+            eval_expression(inter, env, expr->u.method_call_expression.argument->next->expression);
+            result.type = CRB_STRING_VALUE;
+            result.u.object = crb_string_replace(inter, str, peek_stack(inter, 1), peek_stack(inter, 0), expr->line_number);
+            shrink_stack(inter, 2);
+        } else if (!strcmp(name, "join")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 1);
+            eval_expression(inter, env, expr->u.method_call_expression.argument->expression);
+            result.type = CRB_STRING_VALUE;
+            result.u.object = crb_string_join(inter, str, peek_stack(inter, 0), expr->line_number);
+            pop_value(inter);
+        } else {
+            error_flag = CRB_TRUE;
+        }
+    } else if (CRB_MAP_VALUE == left->type) {
+        /* 参数求值时栈可能重新分配, 之后不能再用left */
+        char *name = expr->u.method_call_expression.identifier;
+        CRB_Object *map = left->u.object;
+
+        if (!strcmp(name, "size")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 0);
+            result.type = CRB_INT_VALUE;
+            result.u.int_value = map->u.map.size;
+        } else if (!strcmp(name, "keys") || !strcmp(name, "values")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 0);
+            result.type = CRB_ARRAY_VALUE;
+            result.u.object = ('k' == name[0]) ? crb_map_keys(inter, map) : crb_map_values(inter, map);
+        } else if (!strcmp(name, "contains")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 1);
+            eval_expression(inter, env, expr->u.method_call_expression.argument->expression);
+            result.type = CRB_BOOLEAN_VALUE;
+            result.u.boolean_value = crb_map_search(inter, map, peek_stack(inter, 0), expr->line_number) != NULL;
+            pop_value(inter);
+        } else if (!strcmp(name, "remove")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 1);
+            eval_expression(inter, env, expr->u.method_call_expression.argument->expression);
+            result.type = CRB_BOOLEAN_VALUE;
+            result.u.boolean_value = crb_map_remove(inter, map, peek_stack(inter, 0), expr->line_number);
+            pop_value(inter);
         } else {
             error_flag = CRB_TRUE;
         }
+    } else if (CRB_MATRIX_VALUE == left->type) {
+        /* 和散列表一样, 参数求值之后不能再用left */
+        char *name = expr->u.method_call_expression.identifier;
+        CRB_Object *matrix = left->u.object;
+
+        if (!strcmp(name, "size")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 0);
+            result.type = CRB_INT_VALUE;
+            result.u.int_value = matrix->u.matrix.shape[0];
+        } else if (!strcmp(name, "shape")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 0);
+            result.type = CRB_ARRAY_VALUE;
+            result.u.object = crb_matrix_shape(inter, matrix);
+        } else if (!strcmp(name, "transpose")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 0);
+            result.type = CRB_MATRIX_VALUE;
+            result.u.object = crb_matrix_transpose(inter, matrix, expr->line_number);
+        } else if (!strcmp(name, "matmul")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 1);
+            eval_expression(inter, env, expr->u.method_call_expression.argument->expression);
+            if (peek_stack(inter, 0)->type != CRB_MATRIX_VALUE) {
+                crb_runtime_error(inter, expr->line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+            }
+            result.type = CRB_MATRIX_VALUE;
+            result.u.object = crb_matrix_matmul(inter, matrix, peek_stack(inter, 0)->u.object, expr->line_number);
+            pop_value(inter);
+        } else if (!strcmp(name, "sum") || !strcmp(name, "min") || !strcmp(name, "max")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 1);
+            eval_expression(inter, env, expr->u.method_call_expression.argument->expression);
+            result = crb_matrix_reduce(inter, matrix, name, peek_stack(inter, 0), expr->line_number);
+            pop_value(inter);
+        } else {
+            error_flag = CRB_TRUE;
+        }
+    } else if (CRB_GENERATOR_VALUE == left->type) {
+        if (!strcmp(expr->u.method_call_expression.identifier, "next")) {
+            /* 生成器在自己的栈上执行, left还在调用者的栈上 */
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 0);
+            result = crb_generator_next(inter, left->u.object->u.generator, expr->line_number);
+        } else if (!strcmp(expr->u.method_call_expression.identifier, "done")) {
+            check_method_argument_count(inter, expr->line_number, expr->u.method_call_expression.argument, 0);
+            result.type = CRB_BOOLEAN_VALUE;
+            result.u.boolean_value = crb_generator_done(left->u.object->u.generator);
+        } else {
+            error_flag = CRB_TRUE;
+        }
+    } else {
+        error_flag = CRB_TRUE;
     }
 
     if (error_flag) {
-        crb_runtime_error(expr->line_number, NO_SUCH_METHOD_ERR, STRING_MESSAGE_ARGUMENT, "method_name", expr->u.method_call_expression.identifier, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, expr->line_number, NO_SUCH_METHOD_ERR, STRING_MESSAGE_ARGUMENT, "method_name", expr->u.method_call_expression.identifier, MESSAGE_ARGUMENT_END);
     }
 
     pop_value(inter);
@@ -776,19 +1177,28 @@ static void eval_method_call_expression(CRB_Interpreter *inter, CRB_LocalEnviron
 static void eval_index_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Expression *expr)
 {
     CRB_Value *left;
-    left = get_array_element_lvalue(inter, env, expr);
-    push_value(inter, left);
+    CRB_Value null_value;
+    MatrixIndex index;
+
+    left = get_element_lvalue(inter, env, expr, CRB_FALSE, &index);
+    if (NULL == left) {
+        null_value.type = CRB_NULL_VALUE;
+        push_value(inter, &null_value);
+    } else {
+        push_value(inter, left);
+    }
 }
 
 static void eval_inc_dec_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Expression *expr)
 {
     CRB_Value *operand;
     CRB_Value result;
+    MatrixIndex index;
     int old_value;
 
-    operand = get_lvalue(inter, env, expr->u.inc_dec.operand);
+    operand = get_lvalue(inter, env, expr->u.inc_dec.operand, &index);
     if (operand->type != CRB_INT_VALUE) {
-        crb_runtime_error(expr->line_number, INC_DEC_OPERAND_TYPE_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, expr->line_number, INC_DEC_OPERAND_TYPE_ERR, MESSAGE_ARGUMENT_END);
     }
 
     old_value = operand->u.int_value;
@@ -798,6 +1208,9 @@ static void eval_inc_dec_expression(CRB_Interpreter *inter, CRB_LocalEnvironment
         DBG_assert(DECREMENT_EXPRESSION == expr->type, ("expr->type:%d\n", expr->type));
         operand->u.int_value--;
     }
+    if (index.matrix) {
+        crb_matrix_store(inter, &index, expr->line_number);
+    }
     
     result.type = CRB_INT_VALUE;
     result.u.int_value = old_value;
@@ -875,9 +1288,13 @@ static void eval_expression(CRB_Interpreter *inter, CRB_LocalEnvironment *env, E
             /* fprintf(stderr, "eval_expression INDEX_EXPRESSION:%d !!!!!!! line:%d\n", expr->type, expr->line_number); */
             eval_index_expression(inter, env, expr);
             break;
+        case MAP_EXPRESSION:
+            eval_map_expression(inter, env, expr);
+            break;
         case INCREMENT_EXPRESSION:
         case DECREMENT_EXPRESSION:
             eval_inc_dec_expression(inter, env, expr);
+            break;
         case EXPRESSION_TYPE_COUNT_PLUS_1:
         default:
             DBG_panic(("bad case. type:%d\n", expr->type));
@@ -0,0 +1,596 @@
+/*
+ * File : event.c
+ * CreateDate : 2026-10-19 20:31:05
+ * */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+/*
+ * 事件循环
+ *
+ * 管道,本机socket和文件都是非阻塞的句柄, 注册回调之后由ev_run()统一等待(epoll).
+ *   h = ev_popen("tail -f a.log", "r");
+ *   ev_on_line(h, "on_line");      # on_line(h, line), 结束时line是null
+ *   ev_timer(1000, "on_timer");    # 1秒后调用on_timer()
+ *   ev_run();                      # 没有要等的句柄和定时器时返回
+ * 普通文件不能放进epoll, 总是当作可读/可写处理.
+ * 句柄关闭之后保留到解释器重置, 脚本里留着的引用不会变成野指针.
+ * */
+
+#define EVENT_HANDLE_NAME "crowbar.event"
+#define EVENT_READ_SIZE (4096)
+#define EVENT_MAX_EVENTS (64)
+
+static CRB_NativePointerInfo st_event_handle_info = {
+    EVENT_HANDLE_NAME
+};
+
+typedef struct EventHandle_tag {
+    int fd;
+    FILE *pipe;                 /* ev_popen的, 关闭时pclose等子进程 */
+    CRB_Boolean is_file;
+    CRB_Boolean eof;
+    CRB_Boolean closed;
+    unsigned int events;        /* 当前在epoll里注册的事件 */
+    FunctionDefinition *on_line;
+    char *read_buf;             /* 还没凑成一行的数据 */
+    int read_len;
+    char *write_buf;            /* 还没写出去的数据 */
+    int write_len;
+    int write_pos;
+    struct EventHandle_tag *next;
+} EventHandle;
+
+typedef struct EventTimer_tag {
+    double when;                /* 毫秒 */
+    FunctionDefinition *func;
+    struct EventTimer_tag *next;
+} EventTimer;
+
+struct EventLoop_tag {
+    int epoll_fd;
+    EventHandle *handle_list;
+    EventTimer *timer_list;     /* 按时间排序 */
+};
+
+static double now_msec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static EventLoop *get_loop(CRB_Interpreter *inter)
+{
+    EventLoop *loop = inter->event_loop;
+
+    if (NULL == loop) {
+        loop = MEM_malloc(sizeof(EventLoop));
+        loop->epoll_fd = epoll_create(EVENT_MAX_EVENTS);
+        loop->handle_list = NULL;
+        loop->timer_list = NULL;
+        inter->event_loop = loop;
+    }
+
+    return loop;
+}
+
+static void check_arguments(CRB_Interpreter *inter, char *name, int arg_count, int true_count)
+{
+    if (arg_count != true_count) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+    }
+}
+
+static EventHandle *get_handle(CRB_Interpreter *inter, char *name, CRB_Value *value)
+{
+    if (value->type != CRB_NATIVE_POINTER_VALUE
+            || value->u.native_pointer.info != &st_event_handle_info) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+    }
+
+    return value->u.native_pointer.pointer;
+}
+
+static char *get_string(CRB_Interpreter *inter, char *name, CRB_Value *value)
+{
+    if (value->type != CRB_STRING_VALUE) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+    }
+
+    return crb_c_string(inter, value->u.object);
+}
+
+static FunctionDefinition *get_function(CRB_Interpreter *inter, char *name, CRB_Value *value)
+{
+    FunctionDefinition *func;
+    char *func_name;
+
+    func_name = get_string(inter, name, value);
+    func = crb_search_function(inter, func_name);
+    if (NULL == func) {
+        crb_runtime_error(inter, inter->native_line_number, FUNCTION_NOT_FOUND_ERR, STRING_MESSAGE_ARGUMENT, "name", func_name, MESSAGE_ARGUMENT_END);
+    }
+
+    return func;
+}
+
+/* 按是否有回调和待写数据更新epoll里的事件 */
+static void update_events(EventLoop *loop, EventHandle *handle)
+{
+    struct epoll_event ev;
+    unsigned int events = 0;
+
+    if (handle->is_file || handle->closed) {
+        return;
+    }
+    if (handle->on_line && !handle->eof) {
+        events |= EPOLLIN;
+    }
+    if (handle->write_pos < handle->write_len) {
+        events |= EPOLLOUT;
+    }
+    if (events == handle->events) {
+        return;
+    }
+
+    ev.events = events;
+    ev.data.ptr = handle;
+    if (0 == handle->events) {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, handle->fd, &ev);
+    } else if (0 == events) {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, handle->fd, &ev);
+    } else {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, handle->fd, &ev);
+    }
+    handle->events = events;
+}
+
+static CRB_Value add_handle(CRB_Interpreter *inter, int fd, FILE *pipe, CRB_Boolean is_file)
+{
+    EventLoop *loop = get_loop(inter);
+    EventHandle *handle;
+    CRB_Value value;
+
+    if (!is_file) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    handle = MEM_malloc(sizeof(EventHandle));
+    handle->fd = fd;
+    handle->pipe = pipe;
+    handle->is_file = is_file;
+    handle->eof = CRB_FALSE;
+    handle->closed = CRB_FALSE;
+    handle->events = 0;
+    handle->on_line = NULL;
+    handle->read_buf = NULL;
+    handle->read_len = 0;
+    handle->write_buf = NULL;
+    handle->write_len = 0;
+    handle->write_pos = 0;
+    handle->next = loop->handle_list;
+    loop->handle_list = handle;
+
+    value.type = CRB_NATIVE_POINTER_VALUE;
+    value.u.native_pointer.info = &st_event_handle_info;
+    value.u.native_pointer.pointer = handle;
+
+    return value;
+}
+
+/* ev_popen(command, mode): 子进程的标准输出(r)或标准输入(w) */
+CRB_Value crb_nv_ev_popen_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    FILE *pipe;
+
+    check_arguments(inter, "ev_popen", arg_count, 2);
+    fflush(NULL);
+    pipe = popen(get_string(inter, "ev_popen", &args[0]), get_string(inter, "ev_popen", &args[1]));
+    if (NULL == pipe) {
+        value.type = CRB_NULL_VALUE;
+        return value;
+    }
+
+    return add_handle(inter, fileno(pipe), pipe, CRB_FALSE);
+}
+
+/* ev_open(path, mode): mode同fopen */
+CRB_Value crb_nv_ev_open_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    char *mode;
+    int flags;
+    int fd;
+
+    check_arguments(inter, "ev_open", arg_count, 2);
+    mode = get_string(inter, "ev_open", &args[1]);
+    if ('w' == mode[0]) {
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+    } else if ('a' == mode[0]) {
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+    } else {
+        flags = O_RDONLY;
+    }
+    fd = open(get_string(inter, "ev_open", &args[0]), flags, 0666);
+    if (fd < 0) {
+        value.type = CRB_NULL_VALUE;
+        return value;
+    }
+
+    return add_handle(inter, fd, NULL, CRB_TRUE);
+}
+
+/* ev_connect(port): 连接本机的tcp端口 */
+CRB_Value crb_nv_ev_connect_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    EventHandle *handle;
+    struct sockaddr_in addr;
+    int fd;
+
+    check_arguments(inter, "ev_connect", arg_count, 1);
+    if (args[0].type != CRB_INT_VALUE) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "ev_connect", MESSAGE_ARGUMENT_END);
+    }
+
+    value.type = CRB_NULL_VALUE;
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return value;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)args[0].u.int_value);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    /* 非阻塞连接, 连上之前写的数据先放在缓冲里 */
+    value = add_handle(inter, fd, NULL, CRB_FALSE);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 && errno != EINPROGRESS) {
+        handle = value.u.native_pointer.pointer;
+        close(fd);
+        handle->closed = CRB_TRUE;
+        handle->eof = CRB_TRUE;
+        value.type = CRB_NULL_VALUE;
+    }
+
+    return value;
+}
+
+/* ev_on_line(handle, "func"): 每读到一行调用func(handle, line) */
+CRB_Value crb_nv_ev_on_line_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    EventHandle *handle;
+
+    check_arguments(inter, "ev_on_line", arg_count, 2);
+    handle = get_handle(inter, "ev_on_line", &args[0]);
+    handle->on_line = get_function(inter, "ev_on_line", &args[1]);
+    update_events(get_loop(inter), handle);
+
+    value.type = CRB_NULL_VALUE;
+    return value;
+}
+
+static void flush_handle(EventHandle *handle)
+{
+    int len;
+
+    while (handle->write_pos < handle->write_len) {
+        len = write(handle->fd, handle->write_buf + handle->write_pos, handle->write_len - handle->write_pos);
+        if (len < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (EAGAIN == errno || EWOULDBLOCK == errno || ENOTCONN == errno) {
+                return;
+            }
+            /* 对端关闭了, 剩下的丢掉 */
+            handle->write_pos = handle->write_len;
+            break;
+        }
+        handle->write_pos += len;
+    }
+    handle->write_pos = 0;
+    handle->write_len = 0;
+}
+
+/* ev_write(handle, str): 写不完的部分等可写时再写 */
+CRB_Value crb_nv_ev_write_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    EventHandle *handle;
+    char *str;
+    int len;
+
+    check_arguments(inter, "ev_write", arg_count, 2);
+    handle = get_handle(inter, "ev_write", &args[0]);
+    str = get_string(inter, "ev_write", &args[1]);
+    value.type = CRB_NULL_VALUE;
+    len = strlen(str);
+    if (handle->closed || 0 == len) {
+        return value;
+    }
+
+    handle->write_buf = MEM_realloc(handle->write_buf, handle->write_len + len);
+    memcpy(handle->write_buf + handle->write_len, str, len);
+    handle->write_len += len;
+    flush_handle(handle);
+    update_events(get_loop(inter), handle);
+
+    return value;
+}
+
+static void close_handle(EventLoop *loop, EventHandle *handle)
+{
+    if (handle->closed) {
+        return;
+    }
+
+    /* 关闭前把剩下的数据阻塞写完 */
+    if (handle->write_pos < handle->write_len) {
+        fcntl(handle->fd, F_SETFL, fcntl(handle->fd, F_GETFL) & ~O_NONBLOCK);
+        flush_handle(handle);
+    }
+    if (handle->events) {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, handle->fd, NULL);
+        handle->events = 0;
+    }
+    if (handle->pipe) {
+        pclose(handle->pipe);
+    } else {
+        close(handle->fd);
+    }
+    handle->closed = CRB_TRUE;
+    handle->eof = CRB_TRUE;
+}
+
+CRB_Value crb_nv_ev_close_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+
+    check_arguments(inter, "ev_close", arg_count, 1);
+    close_handle(get_loop(inter), get_handle(inter, "ev_close", &args[0]));
+
+    value.type = CRB_NULL_VALUE;
+    return value;
+}
+
+/* ev_timer(msec, "func"): msec毫秒后调用一次func() */
+CRB_Value crb_nv_ev_timer_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    EventLoop *loop;
+    EventTimer *timer;
+    EventTimer **pos;
+
+    check_arguments(inter, "ev_timer", arg_count, 2);
+    if (args[0].type != CRB_INT_VALUE) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "ev_timer", MESSAGE_ARGUMENT_END);
+    }
+    loop = get_loop(inter);
+
+    timer = MEM_malloc(sizeof(EventTimer));
+    timer->when = now_msec() + args[0].u.int_value;
+    timer->func = get_function(inter, "ev_timer", &args[1]);
+    for (pos = &loop->timer_list; *pos && (*pos)->when <= timer->when; pos = &(*pos)->next) {
+        ;
+    }
+    timer->next = *pos;
+    *pos = timer;
+
+    value.type = CRB_NULL_VALUE;
+    return value;
+}
+
+static void call_on_line(CRB_Interpreter *inter, EventHandle *handle, char *line, int length)
+{
+    CRB_Value args[2];
+    char *str;
+
+    args[0].type = CRB_NATIVE_POINTER_VALUE;
+    args[0].u.native_pointer.info = &st_event_handle_info;
+    args[0].u.native_pointer.pointer = handle;
+    if (line) {
+        str = MEM_malloc(length + 1);
+        memcpy(str, line, length);
+        str[length] = '\0';
+        args[1].type = CRB_STRING_VALUE;
+        args[1].u.object = crb_create_crowbar_string_i(inter, str);
+    } else {
+        args[1].type = CRB_NULL_VALUE;
+    }
+    CRB_call_function(inter, handle->on_line, 2, args);
+}
+
+/* 读到的数据按行交给回调, 结束时剩下的半行也交出去, 最后传null */
+static void read_handle(CRB_Interpreter *inter, EventHandle *handle)
+{
+    char buf[EVENT_READ_SIZE];
+    char *line;
+    char *newline;
+    int len;
+    int start;
+
+    len = read(handle->fd, buf, sizeof(buf));
+    if (len < 0 && (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno)) {
+        return;
+    }
+
+    if (len > 0) {
+        handle->read_buf = MEM_realloc(handle->read_buf, handle->read_len + len);
+        memcpy(handle->read_buf + handle->read_len, buf, len);
+        handle->read_len += len;
+
+        /* 回调里可能关掉句柄, 每行之后都要看一下 */
+        start = 0;
+        while (!handle->closed
+                && (newline = memchr(handle->read_buf + start, '\n', handle->read_len - start)) != NULL) {
+            line = handle->read_buf + start;
+            start = newline - handle->read_buf + 1;
+            call_on_line(inter, handle, line, newline - line + 1);
+        }
+        if (handle->closed) {
+            return;
+        }
+        memmove(handle->read_buf, handle->read_buf + start, handle->read_len - start);
+        handle->read_len -= start;
+        return;
+    }
+
+    handle->eof = CRB_TRUE;
+    update_events(inter->event_loop, handle);
+    if (handle->read_len > 0) {
+        len = handle->read_len;
+        handle->read_len = 0;
+        call_on_line(inter, handle, handle->read_buf, len);
+    }
+    if (!handle->closed) {
+        call_on_line(inter, handle, NULL, 0);
+    }
+}
+
+static CRB_Boolean has_work(EventLoop *loop, CRB_Boolean *file_ready)
+{
+    EventHandle *handle;
+    CRB_Boolean ret = loop->timer_list != NULL;
+
+    *file_ready = CRB_FALSE;
+    for (handle = loop->handle_list; handle; handle = handle->next) {
+        if (handle->closed) {
+            continue;
+        }
+        if (handle->is_file) {
+            if (handle->on_line && !handle->eof) {
+                *file_ready = CRB_TRUE;
+                ret = CRB_TRUE;
+            }
+        } else if (handle->events) {
+            ret = CRB_TRUE;
+        }
+    }
+
+    return ret;
+}
+
+static void run_timers(CRB_Interpreter *inter, EventLoop *loop)
+{
+    EventTimer *timer;
+    FunctionDefinition *func;
+    double now = now_msec();
+
+    while (loop->timer_list && loop->timer_list->when <= now) {
+        timer = loop->timer_list;
+        loop->timer_list = timer->next;
+        /* 回调出错时不会回到这里, 先释放 */
+        func = timer->func;
+        MEM_free(timer);
+        CRB_call_function(inter, func, 0, NULL);
+    }
+}
+
+/* ev_run(): 没有等待中的句柄和定时器时返回 */
+CRB_Value crb_nv_ev_run_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    EventLoop *loop;
+    EventHandle *handle;
+    struct epoll_event events[EVENT_MAX_EVENTS];
+    CRB_Boolean file_ready;
+    int timeout;
+    int n;
+    int i;
+
+    check_arguments(inter, "ev_run", arg_count, 0);
+    loop = get_loop(inter);
+    value.type = CRB_NULL_VALUE;
+
+    while (has_work(loop, &file_ready)) {
+        timeout = -1;
+        if (file_ready) {
+            timeout = 0;
+        } else if (loop->timer_list) {
+            timeout = (int)(loop->timer_list->when - now_msec() + 1);
+            if (timeout < 0) {
+                timeout = 0;
+            }
+        }
+
+        n = epoll_wait(loop->epoll_fd, events, EVENT_MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR) {
+            break;
+        }
+        for (i = 0; i < n; ++i) {
+            handle = events[i].data.ptr;
+            if (handle->closed) {
+                continue;
+            }
+            if (events[i].events & EPOLLOUT) {
+                flush_handle(handle);
+                update_events(loop, handle);
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR) && handle->on_line && !handle->eof) {
+                read_handle(inter, handle);
+            }
+        }
+        if (file_ready) {
+            for (handle = loop->handle_list; handle; handle = handle->next) {
+                if (handle->is_file && !handle->closed && handle->on_line && !handle->eof) {
+                    read_handle(inter, handle);
+                }
+            }
+        }
+        run_timers(inter, loop);
+    }
+
+    return value;
+}
+
+/* 解释器重置或释放时关闭所有句柄 */
+void crb_dispose_event_loop(CRB_Interpreter *inter)
+{
+    EventLoop *loop = inter->event_loop;
+    EventHandle *handle;
+    EventTimer *timer;
+
+    if (NULL == loop) {
+        return;
+    }
+    while (loop->handle_list) {
+        handle = loop->handle_list;
+        loop->handle_list = handle->next;
+        close_handle(loop, handle);
+        MEM_free(handle->read_buf);
+        MEM_free(handle->write_buf);
+        MEM_free(handle);
+    }
+    while (loop->timer_list) {
+        timer = loop->timer_list;
+        loop->timer_list = timer->next;
+        MEM_free(timer);
+    }
+    close(loop->epoll_fd);
+    MEM_free(loop);
+    inter->event_loop = NULL;
+}
+
+/* vim: set tabstop=4 set shiftwidth=4 */
@@ -26,7 +26,7 @@ static StatementResult execute_global_statement(CRB_Interpreter *inter, CRB_Loca
     result.type = NORMAL_STATEMENT_RESULT;
 
     if (NULL == env) {
-        crb_runtime_error(statement->line_number, GLOBAL_STATEMENT_IN_TOPLEVEL_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, statement->line_number, GLOBAL_STATEMENT_IN_TOPLEVEL_ERR, MESSAGE_ARGUMENT_END);
     }
 
     for (pos = statement->u.global_s.identifier_list; pos; pos = pos->next) {
@@ -42,7 +42,7 @@ static StatementResult execute_global_statement(CRB_Interpreter *inter, CRB_Loca
 
         variable = crb_search_global_variable(inter, pos->name);
         if (NULL == variable) {
-            crb_runtime_error(statement->line_number, GLOBAL_VARIABLE_NOT_FOUND_ERR, STRING_MESSAGE_ARGUMENT, "name", pos->name, MESSAGE_ARGUMENT_END);
+            crb_runtime_error(inter, statement->line_number, GLOBAL_VARIABLE_NOT_FOUND_ERR, STRING_MESSAGE_ARGUMENT, "name", pos->name, MESSAGE_ARGUMENT_END);
         }
 
         new_ref = MEM_malloc(sizeof(GlobalVariableRef));
@@ -69,7 +69,7 @@ static StatementResult execute_elsif(CRB_Interpreter *inter, CRB_LocalEnvironmen
     for (pos = elsif_list; pos; pos = pos->next) {
         cond = crb_eval_expression(inter, env, pos->condition);
         if (cond.type != CRB_BOOLEAN_VALUE) {
-            crb_runtime_error(pos->condition->line_number, NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
+            crb_runtime_error(inter, pos->condition->line_number, NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
         }
 
         if (cond.u.boolean_value) {
@@ -92,7 +92,7 @@ static StatementResult execute_if_statement(CRB_Interpreter *inter, CRB_LocalEnv
     result.type = NORMAL_STATEMENT_RESULT;
     cond = crb_eval_expression(inter, env, statement->u.if_s.condition);
     if (cond.type != CRB_BOOLEAN_VALUE) {
-        crb_runtime_error(statement->u.if_s.condition->line_number, NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, statement->u.if_s.condition->line_number, NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
     }
     DBG_assert(CRB_BOOLEAN_VALUE == cond.type, ("cond.type..%d", cond.type));
 
@@ -121,9 +121,10 @@ static StatementResult execute_while_statement(CRB_Interpreter *inter, CRB_Local
     result.type = NORMAL_STATEMENT_RESULT;
 
     for (;;) {
+        crb_count_step(inter);
         cond = crb_eval_expression(inter, env, statement->u.while_s.condition);
         if (cond.type != CRB_BOOLEAN_VALUE) {
-            crb_runtime_error(statement->u.while_s.condition->line_number, NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
+            crb_runtime_error(inter, statement->u.while_s.condition->line_number, NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
         }
         DBG_assert(CRB_BOOLEAN_VALUE == cond.type , ("cond.type..%d", cond.type) );
 
@@ -156,12 +157,13 @@ static StatementResult execute_for_statement(CRB_Interpreter *inter, CRB_LocalEn
     }
 
     for (;;) {
+        crb_count_step(inter);
         if (statement->u.for_s.condition) {
             /* fprintf(stderr, "execute_for_statement before cond\n"); */
             cond = crb_eval_expression(inter, env, statement->u.for_s.condition);
             /* fprintf(stderr, "execute_for_statement after cond:%d for:%d\n", cond.type, statement->u.for_s.condition->type); */
             if (cond.type != CRB_BOOLEAN_VALUE) {
-                crb_runtime_error(statement->u.for_s.condition->line_number, NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
+                crb_runtime_error(inter, statement->u.for_s.condition->line_number, NOT_BOOLEAN_TYPE_ERR, MESSAGE_ARGUMENT_END);
             }
             DBG_assert(CRB_BOOLEAN_VALUE == cond.type , ("cond.type..%d", cond.type) );
 
@@ -215,6 +217,75 @@ static StatementResult execute_continue_statement(CRB_Interpreter *inter, CRB_Lo
     return result;
 }
 
+/*
+ * try块里的运行时错误跳回这里, 栈和局部环境还原后执行catch块,
+ * 错误信息作为字符串绑定到catch的变量. 超过资源限制和语法错误继续往外跳.
+ * */
+static StatementResult execute_try_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Statement *statement)
+{
+    StatementResult result;
+    jmp_buf recovery;
+    jmp_buf *outer_recovery;
+    int stack_pointer;
+    CRB_LocalEnvironment *top_environment;
+    Generator *generator;
+    CRB_Boolean native_callback;
+    int native_line_number;
+    CRB_Value exception;
+    CRB_Value *dest;
+    char *message;
+
+    outer_recovery = inter->recovery;
+    stack_pointer = inter->stack.stack_pointer;
+    top_environment = inter->top_environment;
+    generator = inter->current_generator;
+    native_callback = inter->native_callback;
+    native_line_number = inter->native_line_number;
+    if (0 == setjmp(recovery)) {
+        inter->recovery = &recovery;
+        result = crb_execute_statement_list(inter, env, statement->u.try_s.try_block->statement_list);
+        inter->recovery = outer_recovery;
+        return result;
+    }
+
+    crb_unwind(inter, stack_pointer, top_environment);
+    inter->recovery = outer_recovery;
+    /* 从next()里跳出来时, 回到进入try时正在执行的生成器和内置函数 */
+    inter->current_generator = generator;
+    inter->native_callback = native_callback;
+    inter->native_line_number = native_line_number;
+    if (inter->status != CRB_STATUS_RUNTIME_ERROR) {
+        crb_abort(inter, inter->status);
+    }
+    inter->status = CRB_STATUS_OK;
+
+    message = MEM_malloc(strlen(inter->error_message) + 1);
+    strcpy(message, inter->error_message);
+    exception.type = CRB_STRING_VALUE;
+    exception.u.object = crb_create_crowbar_string_i(inter, message);
+    dest = crb_get_identifier_lvalue(inter, env, statement->u.try_s.exception);
+    *dest = exception;
+
+    return crb_execute_statement_list(inter, env, statement->u.try_s.catch_block->statement_list);
+}
+
+/* 挂起当前生成器, 下一次next()从这里继续 */
+static StatementResult execute_yield_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Statement *statement)
+{
+    StatementResult result;
+    CRB_Value value;
+
+    result.type = NORMAL_STATEMENT_RESULT;
+    if (statement->u.yield_s.yield_value) {
+        value = crb_eval_expression(inter, env, statement->u.yield_s.yield_value);
+    } else {
+        value.type = CRB_NULL_VALUE;
+    }
+    crb_generator_yield(inter, &value, statement->line_number);
+
+    return result;
+}
+
 static StatementResult execute_statement(CRB_Interpreter *inter, CRB_LocalEnvironment *env, Statement *statement)
 {
     StatementResult result;
@@ -246,6 +317,12 @@ static StatementResult execute_statement(CRB_Interpreter *inter, CRB_LocalEnviro
     case CONTINUE_STATEMENT:
         result = execute_continue_statement(inter, env, statement);
         break;
+    case TRY_STATEMENT:
+        result = execute_try_statement(inter, env, statement);
+        break;
+    case YIELD_STATEMENT:
+        result = execute_yield_statement(inter, env, statement);
+        break;
     case STATEMENT_TYPE_COUNT_PLUS_1:
     default:
         DBG_panic(("bad case...%d", statement->type));
@@ -264,6 +341,13 @@ StatementResult crb_execute_statement_list(CRB_Interpreter *inter, CRB_LocalEnvi
 
     for (pos = list; pos; pos = pos->next) {
         /* fprintf(stderr, "pos line:%d\n", pos->statement->line_number); */
+        /*
+         * 内置函数的回调里不合并, 外层的内置函数可能还拿着字符指针, 回到外层的语句再做.
+         * 生成器可能是在内置函数的回调里被next()的, 也不合并
+         * */
+        if (inter->heap.dedup_pending && !inter->native_callback && NULL == inter->current_generator) {
+            crb_dedup_strings(inter);
+        }
         result = execute_statement(inter, env, pos->statement);
         if (result.type != NORMAL_STATEMENT_RESULT) {
             goto FUNC_END;
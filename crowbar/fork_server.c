@@ -0,0 +1,185 @@
+/*
+ * File : fork_server.c
+ * CreateDate : 2026-10-19 17:05:31
+ * */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+/*
+ * fork服务
+ *
+ * 父进程编译好程序并执行完顶层代码之后开始监听unix socket,
+ * 每个连接fork一个子进程. 子进程直接从热的解释器开始(写时复制),
+ * 连接作为标准输入输出(父进程读剩下的stdin丢掉), 读第一行作为参数调用入口函数, 执行完就退出.
+ * 父进程的状态不会被请求修改.
+ * 延迟编译的函数体在监听之前全部编译好, 子进程不用每次重新分析.
+ * 线程不会跟着fork, 顶层代码用过的线程池先结束掉, spawn的线程没有join时不提供服务.
+ * */
+
+#define REQUEST_ALLOC_SIZE (256)
+#define LISTEN_BACKLOG (128)
+
+static char *read_request(FILE *fp)
+{
+    char *line = NULL;
+    int alloc_size = 0;
+    int length = 0;
+    int ch;
+
+    while ((ch = getc(fp)) != EOF && ch != '\n') {
+        if (length + 1 >= alloc_size) {
+            alloc_size += REQUEST_ALLOC_SIZE;
+            line = MEM_realloc(line, alloc_size);
+        }
+        line[length++] = ch;
+    }
+    if (NULL == line) {
+        line = MEM_malloc(1);
+    }
+    line[length] = '\0';
+
+    return line;
+}
+
+static void serve_request(CRB_Interpreter *inter, CRB_Function *entry, int conn)
+{
+    CRB_Value arg;
+
+    /*
+     * 父进程从stdin预读的内容在FILE和InputBuffer里都有一份, 不能带给请求.
+     * freopen换掉stdin清空FILE的缓冲区(STDIN指向的FILE不变), 再把连接放到0号
+     * */
+    if (NULL == freopen("/dev/null", "r", stdin)) {
+        perror("/dev/null");
+        _exit(1);
+    }
+    crb_dispose_file_input(inter, stdin);
+    dup2(conn, 0);
+    dup2(conn, 1);
+    close(conn);
+    /* pclose要等自己的子进程, 父进程自动回收的设置不能带过来 */
+    signal(SIGCHLD, SIG_DFL);
+    /* 请求里用到线程时从头创建 */
+    inter->worker_pool = NULL;
+    inter->worker_list = NULL;
+    inter->thread_group = NULL;
+
+    arg.type = CRB_STRING_VALUE;
+    arg.u.object = crb_create_crowbar_string_i(inter, read_request(stdin));
+    CRB_call_function(inter, entry, 1, &arg);
+    if (CRB_get_status(inter) != CRB_STATUS_OK) {
+        fprintf(stderr, "%s\n", CRB_get_error_message(inter));
+    }
+
+    fflush(stdout);
+    /* 不走exit, 父进程的atexit和缓冲区跟子进程无关 */
+    _exit(0);
+}
+
+static int open_socket(char *socket_path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: path too long\n", socket_path);
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+        || listen(fd, LISTEN_BACKLOG) != 0) {
+        perror(socket_path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int CRB_serve_forked(CRB_Interpreter *inter, char *socket_path, char *entry_name)
+{
+    CRB_Function *entry;
+    struct sigaction action;
+    int listen_fd;
+    int conn;
+    pid_t pid;
+
+    entry = CRB_lookup_function(inter, entry_name);
+    if (NULL == entry) {
+        fprintf(stderr, "%s not found\n", entry_name);
+        return 1;
+    }
+    if (crb_has_running_workers(inter)) {
+        fprintf(stderr, "spawned workers must be joined before serving\n");
+        return 1;
+    }
+    crb_dispose_worker_pool(inter);
+    crb_compile_all_functions(inter);
+
+    /* 结束的子进程由内核回收, 空闲时也不会留下僵尸进程 */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    action.sa_flags = SA_NOCLDWAIT;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, NULL);
+
+    listen_fd = open_socket(socket_path);
+    if (listen_fd < 0) {
+        return 1;
+    }
+
+    for (;;) {
+        conn = accept(listen_fd, NULL, NULL);
+        if (conn < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+
+        /* 缓冲区里的内容不能带到子进程里 */
+        crb_flush_output(inter, NULL);
+        fflush(stdout);
+        fflush(stderr);
+        pid = fork();
+        if (0 == pid) {
+            close(listen_fd);
+            serve_request(inter, entry, conn);
+        }
+        if (pid < 0) {
+            perror("fork");
+        }
+        close(conn);
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+
+    return 1;
+}
+
+/* vim: set tabstop=4 set shiftwidth=4 */
@@ -0,0 +1,307 @@
+/*
+ * File : generator.c
+ * CreateDate : 2026-10-19 19:12:47
+ * */
+
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <ucontext.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+/*
+ * 生成器
+ *
+ * 求值器是递归的c代码, 函数执行到一半没法停下来, 所以每个生成器有自己的c栈(ucontext),
+ * 以及自己的值栈和局部环境链. next()时和解释器当前的栈,环境,恢复点互换之后切过去,
+ * yield或者函数返回时切回来再换回去. 挂起时保存的是生成器自己的状态,
+ * 执行时保存的是调用者的状态, 两种情况GC都从这里mark.
+ *
+ *   g = generator("lines", fp);
+ *   for (line = g.next(); g.done() == false; line = g.next()) { ... }
+ *
+ * 函数返回的那次next()返回函数的返回值, 之后done()为true, next()返回null.
+ *
+ * c栈只有GENERATOR_STACK_SIZE, 在生成器里调用函数时剩下的不到GENERATOR_STACK_MARGIN就报错.
+ * 栈底(低地址)下面还有一页PROT_NONE, 内置函数自己递归漏过检查时也只会SIGSEGV, 不会写坏堆.
+ * */
+
+#define GENERATOR_STACK_MARGIN (64 * 1024)
+
+typedef enum {
+    GENERATOR_SUSPENDED = 1,
+    GENERATOR_RUNNING,
+    GENERATOR_DONE
+} GeneratorState;
+
+struct Generator_tag {
+    CRB_Interpreter *inter;
+    CRB_Object *object;         /* 执行中时防止被回收 */
+    FunctionDefinition *func;
+    int arg_count;
+    CRB_Value *args;
+    GeneratorState state;
+    ucontext_t context;
+    ucontext_t caller;
+    char *c_stack;
+    /* 和解释器互换的执行状态 */
+    Stack stack;
+    CRB_LocalEnvironment *top_environment;
+    jmp_buf *recovery;
+    CRB_Boolean native_callback;
+    CRB_Value value;            /* yield的值, 结束时是返回值 */
+    CRB_Status status;          /* 出错结束时在调用者那边重新抛出 */
+    Generator *resumer;         /* 执行中: 调用next()时正在执行的生成器 */
+};
+
+static void swap_state(CRB_Interpreter *inter, Generator *gen)
+{
+    Stack stack;
+    CRB_LocalEnvironment *top_environment;
+    jmp_buf *recovery;
+    CRB_Boolean native_callback;
+
+    stack = inter->stack;
+    inter->stack = gen->stack;
+    gen->stack = stack;
+
+    top_environment = inter->top_environment;
+    inter->top_environment = gen->top_environment;
+    gen->top_environment = top_environment;
+
+    recovery = inter->recovery;
+    inter->recovery = gen->recovery;
+    gen->recovery = recovery;
+
+    native_callback = inter->native_callback;
+    inter->native_callback = gen->native_callback;
+    gen->native_callback = native_callback;
+}
+
+/* mmap不带MAP_ANONYMOUS是POSIX的写法, 映射/dev/zero */
+static char *alloc_c_stack(CRB_Interpreter *inter)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    char *base;
+    int fd;
+
+    fd = open("/dev/zero", O_RDWR);
+    if (fd < 0) {
+        crb_abort(inter, CRB_STATUS_HEAP_LIMIT);
+    }
+    base = mmap(NULL, page_size + GENERATOR_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == (void*)base) {
+        crb_abort(inter, CRB_STATUS_HEAP_LIMIT);
+    }
+    mprotect(base, page_size, PROT_NONE);
+
+    return base + page_size;
+}
+
+static void free_c_stack(char *c_stack)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    munmap(c_stack - page_size, page_size + GENERATOR_STACK_SIZE);
+}
+
+/*
+ * 生成器的c栈从这里开始. 挂起时c栈可能直接被丢掉, 这里不能持有要释放的内存.
+ * makecontext只能传int, 指针拆成两半
+ * */
+static void generator_main(unsigned int high, unsigned int low)
+{
+    Generator *gen;
+    CRB_Interpreter *inter;
+    jmp_buf recovery;
+
+    gen = (Generator*)(((unsigned long)high << 16 << 16) | low);
+    inter = gen->inter;
+
+    if (0 == setjmp(recovery)) {
+        inter->recovery = &recovery;
+        gen->value = CRB_call_function(inter, gen->func, gen->arg_count, gen->args);
+        gen->status = CRB_STATUS_OK;
+    } else {
+        gen->value.type = CRB_NULL_VALUE;
+        gen->status = inter->status;
+    }
+    gen->arg_count = 0;
+
+    gen->state = GENERATOR_DONE;
+    swapcontext(&gen->context, &gen->caller);
+    DBG_panic(("finished generator resumed\n"));
+}
+
+/* generator("函数名", 参数...): 创建之后不执行, 第一次next()时才开始 */
+CRB_Value crb_nv_generator_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value ret;
+    Generator *gen;
+    FunctionDefinition *func;
+    char *c_stack;
+    unsigned long p;
+    int i;
+
+    if (arg_count < 1) {
+        crb_runtime_error(inter, inter->native_line_number, ARGUMENT_TOO_FEW_ERR, MESSAGE_ARGUMENT_END);
+    }
+    if (args[0].type != CRB_STRING_VALUE) {
+        crb_runtime_error(inter, inter->native_line_number, GENERATOR_ARGUMENT_ERR, MESSAGE_ARGUMENT_END);
+    }
+    func = crb_search_function(inter, crb_c_string(inter, args[0].u.object));
+    if (NULL == func) {
+        crb_runtime_error(inter, inter->native_line_number, FUNCTION_NOT_FOUND_ERR, STRING_MESSAGE_ARGUMENT, "name", crb_c_string(inter, args[0].u.object), MESSAGE_ARGUMENT_END);
+    }
+
+    /* 可能GC, 先分配对象再创建生成器 */
+    ret.type = CRB_GENERATOR_VALUE;
+    ret.u.object = crb_create_generator_i(inter);
+    c_stack = alloc_c_stack(inter);
+
+    gen = MEM_malloc(sizeof(Generator));
+    gen->inter = inter;
+    gen->object = ret.u.object;
+    gen->func = func;
+    gen->arg_count = arg_count - 1;
+    gen->args = MEM_malloc(sizeof(CRB_Value) * arg_count);
+    for (i = 1; i < arg_count; ++i) {
+        gen->args[i - 1] = args[i];
+    }
+    gen->state = GENERATOR_SUSPENDED;
+    gen->c_stack = c_stack;
+    gen->stack.stack_alloc_size = STACK_ALLOC_SIZE;
+    gen->stack.stack_pointer = 0;
+    gen->stack.stack = MEM_malloc(sizeof(CRB_Value) * STACK_ALLOC_SIZE);
+    gen->top_environment = NULL;
+    gen->recovery = NULL;
+    gen->native_callback = CRB_FALSE;
+    gen->value.type = CRB_NULL_VALUE;
+    gen->status = CRB_STATUS_OK;
+    gen->resumer = NULL;
+
+    getcontext(&gen->context);
+    gen->context.uc_stack.ss_sp = gen->c_stack;
+    gen->context.uc_stack.ss_size = GENERATOR_STACK_SIZE;
+    gen->context.uc_link = NULL;
+    p = (unsigned long)gen;
+    makecontext(&gen->context, (void (*)())generator_main, 2,
+            (unsigned int)(p >> 16 >> 16), (unsigned int)(p & 0xffffffffUL));
+
+    ret.u.object->u.generator = gen;
+
+    return ret;
+}
+
+/* 执行到下一个yield, 结束之后返回null. 生成器里的错误在这里重新抛出 */
+CRB_Value crb_generator_next(CRB_Interpreter *inter, Generator *gen, int line_number)
+{
+    CRB_Value null_value;
+
+    if (GENERATOR_DONE == gen->state) {
+        null_value.type = CRB_NULL_VALUE;
+        return null_value;
+    }
+    if (GENERATOR_RUNNING == gen->state) {
+        crb_runtime_error(inter, line_number, GENERATOR_RUNNING_ERR, MESSAGE_ARGUMENT_END);
+    }
+
+    gen->resumer = inter->current_generator;
+    inter->current_generator = gen;
+    gen->state = GENERATOR_RUNNING;
+    swap_state(inter, gen);
+    swapcontext(&gen->caller, &gen->context);
+    swap_state(inter, gen);
+    inter->current_generator = gen->resumer;
+    gen->resumer = NULL;
+
+    if (GENERATOR_DONE == gen->state && gen->status != CRB_STATUS_OK) {
+        crb_abort(inter, gen->status);
+    }
+
+    return gen->value;
+}
+
+CRB_Boolean crb_generator_done(Generator *gen)
+{
+    return GENERATOR_DONE == gen->state;
+}
+
+void crb_generator_yield(CRB_Interpreter *inter, CRB_Value *value, int line_number)
+{
+    Generator *gen = inter->current_generator;
+
+    if (NULL == gen) {
+        crb_runtime_error(inter, line_number, YIELD_OUTSIDE_GENERATOR_ERR, MESSAGE_ARGUMENT_END);
+    }
+    /* 挂起的生成器可能不再恢复就被释放, c栈上不能留着内置函数的栈帧 */
+    if (inter->native_callback) {
+        crb_runtime_error(inter, line_number, YIELD_IN_NATIVE_CALLBACK_ERR, MESSAGE_ARGUMENT_END);
+    }
+
+    gen->value = *value;
+    gen->state = GENERATOR_SUSPENDED;
+    swapcontext(&gen->context, &gen->caller);
+}
+
+/* 栈向低地址增长, 当前位置到栈底的距离就是剩下的空间 */
+void crb_check_generator_stack(CRB_Interpreter *inter, int line_number)
+{
+    char here;
+
+    if ((unsigned long)&here - (unsigned long)inter->current_generator->c_stack < GENERATOR_STACK_MARGIN) {
+        crb_runtime_error(inter, line_number, GENERATOR_STACK_OVERFLOW_ERR, MESSAGE_ARGUMENT_END);
+    }
+}
+
+void crb_mark_generator(Generator *gen)
+{
+    int i;
+
+    if (NULL == gen) {
+        return;
+    }
+    for (i = 0; i < gen->arg_count; ++i) {
+        if (dkc_is_object_value(gen->args[i].type)) {
+            crb_gc_mark(gen->args[i].u.object);
+        }
+    }
+    for (i = 0; i < gen->stack.stack_pointer; ++i) {
+        if (dkc_is_object_value(gen->stack.stack[i].type)) {
+            crb_gc_mark(gen->stack.stack[i].u.object);
+        }
+    }
+    crb_gc_mark_environment(gen->top_environment);
+    if (dkc_is_object_value(gen->value.type)) {
+        crb_gc_mark(gen->value.u.object);
+    }
+}
+
+void crb_mark_running_generators(CRB_Interpreter *inter)
+{
+    Generator *gen;
+
+    for (gen = inter->current_generator; gen; gen = gen->resumer) {
+        crb_gc_mark(gen->object);
+    }
+}
+
+/* 挂起中的生成器直接丢掉c栈, 局部环境单独释放 */
+void crb_dispose_generator(Generator *gen)
+{
+    DBG_assert(gen->state != GENERATOR_RUNNING, ("generator is running\n"));
+
+    crb_dispose_environment_chain(gen->top_environment);
+    MEM_free(gen->args);
+    MEM_free(gen->stack.stack);
+    free_c_stack(gen->c_stack);
+    MEM_free(gen);
+}
+
+/* vim: set tabstop=4 set shiftwidth=4 */
@@ -4,6 +4,7 @@
  * */
 #include <stdio.h>
 #include <string.h>
+#include <limits.h>
 #include "MEM.h"
 #include "DBG.h"
 #include "crowbar.h"
@@ -11,7 +12,7 @@
 /*
  * mark对象,数组则mark其每个元素
  * */
-static void gc_mark(CRB_Object *obj)
+void crb_gc_mark(CRB_Object *obj)
 {
     int i;
     if (obj->marked) {
@@ -20,13 +21,45 @@ static void gc_mark(CRB_Object *obj)
 
     obj->marked = CRB_TRUE;
 
+    /* 生成器mark它挂起时的栈和局部环境 */
+    if (GENERATOR_OBJECT == obj->type) {
+        crb_mark_generator(obj->u.generator);
+        return;
+    }
+    if (MAP_OBJECT == obj->type) {
+        for (i = 0; i < obj->u.map.alloc_size; ++i) {
+            if (obj->u.map.entries[i].state != MAP_ENTRY_USED) {
+                continue;
+            }
+            if (dkc_is_object_value(obj->u.map.entries[i].key.type)) {
+                crb_gc_mark(obj->u.map.entries[i].key.u.object);
+            }
+            if (dkc_is_object_value(obj->u.map.entries[i].value.type)) {
+                crb_gc_mark(obj->u.map.entries[i].value.u.object);
+            }
+        }
+        return;
+    }
+    /* 视图让共享的字符串和矩阵活着 */
+    if (STRING_OBJECT == obj->type) {
+        if (obj->u.string.parent) {
+            crb_gc_mark(obj->u.string.parent);
+        }
+        return;
+    }
+    if (MATRIX_OBJECT == obj->type) {
+        if (obj->u.matrix.base) {
+            crb_gc_mark(obj->u.matrix.base);
+        }
+        return;
+    }
     if (ARRAY_OBJECT != obj->type) {
         return;
     }
 
     for (i = 0; i < obj->u.array.size; ++i) {
         if (dkc_is_object_value(obj->u.array.array[i].type)) {
-            gc_mark(obj->u.array.array[i].u.object);
+            crb_gc_mark(obj->u.array.array[i].u.object);
         }
     }
 }
@@ -41,7 +74,22 @@ static void gc_mark_ref_in_native_method(CRB_LocalEnvironment *env)
     RefInNativeFunc *ref;
 
     for (ref = env->ref_in_native_method; ref; ref = ref->next) {
-        gc_mark(ref->object);
+        crb_gc_mark(ref->object);
+    }
+}
+
+/* 从env开始的整条局部环境链 */
+void crb_gc_mark_environment(CRB_LocalEnvironment *env)
+{
+    Variable *v;
+
+    for (; env; env = env->next) {
+        for (v = env->variable; v; v = v->next) {
+            if (dkc_is_object_value(v->value.type)) {
+                crb_gc_mark(v->value.u.object);
+            }
+        }
+        gc_mark_ref_in_native_method(env);
     }
 }
 
@@ -49,7 +97,6 @@ static void gc_mark_objects(CRB_Interpreter *inter)
 {
     CRB_Object *obj;
     Variable *v;
-    CRB_LocalEnvironment *env;
     int i;
 
     /*
@@ -64,7 +111,7 @@ static void gc_mark_objects(CRB_Interpreter *inter)
      * */
     for (v = inter->variable; v; v = v->next) {
         if (dkc_is_object_value(v->value.type)) {
-            gc_mark(v->value.u.object);
+            crb_gc_mark(v->value.u.object);
         }
     }
 
@@ -72,13 +119,12 @@ static void gc_mark_objects(CRB_Interpreter *inter)
      * 局部环境,引用的对象全部mark
      * 内置函数引用的对象全部mark
      * */
-    for (env = inter->top_environment; env; env = env->next) {
-        for (v = env->variable; v; v = v->next) {
-            if (dkc_is_object_value(v->value.type)) {
-                gc_mark(v->value.u.object);
-            }
-        }
-        gc_mark_ref_in_native_method(env);
+    crb_gc_mark_environment(inter->top_environment);
+    /* 正在执行的生成器, 以及保存在里面的调用者的栈和环境 */
+    crb_mark_running_generators(inter);
+
+    if (dkc_is_object_value(inter->call_result.type)) {
+        crb_gc_mark(inter->call_result.u.object);
     }
 
     /*
@@ -86,7 +132,7 @@ static void gc_mark_objects(CRB_Interpreter *inter)
      * */
     for (i = 0; i < inter->stack.stack_pointer; ++i) {
         if (dkc_is_object_value(inter->stack.stack[i].type)) {
-            gc_mark(inter->stack.stack[i].u.object);
+            crb_gc_mark(inter->stack.stack[i].u.object);
         }
     }
 }
@@ -99,8 +145,30 @@ static void gc_dispose_object(CRB_Interpreter *inter, CRB_Object *obj)
             MEM_free(obj->u.array.array);
             break;
         case STRING_OBJECT:
-            inter->heap.current_heap_size -= strlen(obj->u.string.string) + 1;
-            MEM_free(obj->u.string.string);
+            /* 字面量指向分析树(或mmap的缓存),不能释放. 没拷贝出来的视图没有自己的字符 */
+            if (!obj->u.string.is_literal && obj->u.string.string) {
+                inter->heap.current_heap_size -= obj->u.string.length + 1;
+                MEM_free(obj->u.string.string);
+            }
+            break;
+        case MAP_OBJECT:
+            inter->heap.current_heap_size -= sizeof(MapEntry) * obj->u.map.alloc_size;
+            MEM_free(obj->u.map.entries);
+            break;
+        case MATRIX_OBJECT:
+            if (obj->u.matrix.mapped) {
+                crb_unmap_matrix(&obj->u.matrix);
+            } else if (NULL == obj->u.matrix.base && obj->u.matrix.data) {
+                inter->heap.current_heap_size -= sizeof(double) * obj->u.matrix.shape[0] * obj->u.matrix.stride[0];
+                MEM_free(obj->u.matrix.data);
+            }
+            MEM_free(obj->u.matrix.shape);
+            break;
+        case GENERATOR_OBJECT:
+            inter->heap.current_heap_size -= GENERATOR_STACK_SIZE;
+            if (obj->u.generator) {
+                crb_dispose_generator(obj->u.generator);
+            }
             break;
         case OBJECT_TYPE_COUNT_PLUS_1:
         default:
@@ -140,18 +208,135 @@ void crb_garbage_collect(CRB_Interpreter *inter)
 {
     gc_mark_objects(inter);
     gc_sweep_objects(inter);
+    if (inter->string_dedup) {
+        inter->heap.dedup_pending = CRB_TRUE;
+    }
+}
+
+/*
+ * 字符串去重
+ *
+ * 内容相同的字符串只留一份字符(canonical), 其他的释放自己的字符, 变成canonical的整串视图.
+ * 本地函数可能拿着crb_string_chars/crb_c_string的指针分配对象,
+ * 所以GC时只做标记, 等执行下一个语句之前(没有人拿着字符指针)再合并.
+ * 内置函数回调crowbar函数(ev_run, parallel_map, 生成器的函数体)时外层还有内置函数, 回到外层之后再合并.
+ * */
+/* 找到内容相同的canonical就返回, 没有时obj自己成为canonical(视图不当canonical) */
+static CRB_Object* dedup_lookup(CRB_Object **table, int mask, CRB_Object *obj)
+{
+    char *chars = crb_string_chars(obj);
+    int length = obj->u.string.length;
+    int i;
+
+    for (i = crb_hash_string(chars, length) & mask; table[i]; i = (i + 1) & mask) {
+        if (table[i]->u.string.length == length
+                && 0 == memcmp(table[i]->u.string.string, chars, length)) {
+            return table[i];
+        }
+    }
+    if (obj->u.string.string) {
+        table[i] = obj;
+    }
+
+    return NULL;
+}
+
+void crb_dedup_strings(CRB_Interpreter *inter)
+{
+    CRB_Object **table;
+    CRB_Object *obj;
+    CRB_Object *canonical;
+    CRB_String *str;
+    int count = 0;
+    int alloc_size;
+
+    inter->heap.dedup_pending = CRB_FALSE;
+    for (obj = inter->heap.header; obj; obj = obj->next) {
+        if (STRING_OBJECT == obj->type && obj->u.string.string) {
+            ++count;
+        }
+    }
+    if (count < 2) {
+        return;
+    }
+    for (alloc_size = 16; alloc_size < count * 2; alloc_size *= 2)
+        ;
+    table = MEM_malloc(sizeof(CRB_Object*) * alloc_size);
+    memset(table, 0, sizeof(CRB_Object*) * alloc_size);
+
+    /* 有自己字符的字符串, 重复的释放字符后指向canonical */
+    for (obj = inter->heap.header; obj; obj = obj->next) {
+        str = &obj->u.string;
+        if (STRING_OBJECT != obj->type || NULL == str->string) {
+            continue;
+        }
+        canonical = dedup_lookup(table, alloc_size - 1, obj);
+        if (NULL == canonical || str->is_literal) {
+            continue;
+        }
+        inter->heap.current_heap_size -= str->length + 1;
+        MEM_free(str->string);
+        str->string = NULL;
+        str->parent = canonical;
+        str->offset = 0;
+    }
+
+    /*
+     * 视图: 父字符串刚被合并的话改指canonical(视图不能指向视图),
+     * 和某个canonical相同时也改指它, 原来的大字符串就可以回收了
+     * */
+    for (obj = inter->heap.header; obj; obj = obj->next) {
+        str = &obj->u.string;
+        if (STRING_OBJECT != obj->type || str->string) {
+            continue;
+        }
+        if (NULL == str->parent->u.string.string) {
+            str->offset += str->parent->u.string.offset;
+            str->parent = str->parent->u.string.parent;
+        }
+        canonical = dedup_lookup(table, alloc_size - 1, obj);
+        if (canonical) {
+            str->parent = canonical;
+            str->offset = 0;
+        }
+    }
+    MEM_free(table);
+}
+
+/* 堆大小限制: 再分配request字节会超过时先GC, 还是放不下就中止 */
+static void check_heap_limit(CRB_Interpreter *inter, long request)
+{
+    long limit = inter->limits.max_heap_size;
+
+    if (0 == limit || inter->heap.current_heap_size + request <= limit) {
+        return;
+    }
+    crb_garbage_collect(inter);
+    if (inter->heap.current_heap_size + request > limit) {
+        crb_abort(inter, CRB_STATUS_HEAP_LIMIT);
+    }
 }
 
 static void check_gc(CRB_Interpreter *inter)
 {
+    long growth;
 #if 0
     crb_garbage_collect(inter);
 #endif
 
     if (inter->heap.current_heap_size > inter->heap.current_threshold) {
         crb_garbage_collect(inter);
-        inter->heap.current_threshold = inter->heap.current_heap_size + HEAP_THRESHOLD_SIZE;
+        /*
+         * 活着的对象越多, 到下次GC前允许分配的也越多.
+         * 固定的增量在一直往大数组(散列表)里加元素时每次都要标记全部, 总开销是平方级的.
+         * */
+        growth = inter->heap.current_heap_size > HEAP_THRESHOLD_SIZE ? inter->heap.current_heap_size : HEAP_THRESHOLD_SIZE;
+        if (growth > LONG_MAX - inter->heap.current_heap_size) {
+            growth = LONG_MAX - inter->heap.current_heap_size;
+        }
+        inter->heap.current_threshold = inter->heap.current_heap_size + growth;
     }
+    check_heap_limit(inter, sizeof(CRB_Object));
 }
 
 static CRB_Object* alloc_object(CRB_Interpreter *inter, ObjectType type)
@@ -177,6 +362,8 @@ CRB_Object* crb_create_array_i(CRB_Interpreter *inter, int size)
 {
     CRB_Object *ret;
 
+    /* 新对象还没有根, 要在创建之前检查 */
+    check_heap_limit(inter, (long)sizeof(CRB_Value) * size);
     ret = alloc_object(inter, ARRAY_OBJECT);
     ret->u.array.size = size;
     ret->u.array.alloc_size = size;
@@ -185,6 +372,166 @@ CRB_Object* crb_create_array_i(CRB_Interpreter *inter, int size)
     return ret;
 }
 
+static MapEntry *alloc_map_entries(int alloc_size)
+{
+    MapEntry *entries;
+    int i;
+
+    entries = MEM_malloc(sizeof(MapEntry) * alloc_size);
+    for (i = 0; i < alloc_size; ++i) {
+        entries[i].state = MAP_ENTRY_EMPTY;
+    }
+
+    return entries;
+}
+
+CRB_Object* crb_create_map_i(CRB_Interpreter *inter)
+{
+    CRB_Object *ret;
+
+    check_heap_limit(inter, (long)sizeof(MapEntry) * MAP_ALLOC_SIZE);
+    ret = alloc_object(inter, MAP_OBJECT);
+    ret->u.map.size = 0;
+    ret->u.map.used = 0;
+    ret->u.map.alloc_size = MAP_ALLOC_SIZE;
+    ret->u.map.entries = alloc_map_entries(MAP_ALLOC_SIZE);
+    inter->heap.current_heap_size += sizeof(MapEntry) * MAP_ALLOC_SIZE;
+
+    return ret;
+}
+
+/* 换成new_alloc_size(2的幂)项, 按存着的散列值重新放, 墓碑丢掉. 可能GC */
+void crb_map_rehash(CRB_Interpreter *inter, CRB_Object *obj, int new_alloc_size)
+{
+    MapEntry *old_entries;
+    MapEntry *entries;
+    int old_alloc_size;
+    unsigned int mask;
+    unsigned int pos;
+    int i;
+
+    DBG_assert(MAP_OBJECT == obj->type, ("bad type:%d\n", obj->type));
+
+    check_gc(inter);
+    check_heap_limit(inter, (long)(new_alloc_size - obj->u.map.alloc_size) * sizeof(MapEntry));
+
+    old_entries = obj->u.map.entries;
+    old_alloc_size = obj->u.map.alloc_size;
+    entries = alloc_map_entries(new_alloc_size);
+    mask = new_alloc_size - 1;
+    for (i = 0; i < old_alloc_size; ++i) {
+        if (old_entries[i].state != MAP_ENTRY_USED) {
+            continue;
+        }
+        for (pos = old_entries[i].hash & mask; entries[pos].state != MAP_ENTRY_EMPTY; pos = (pos + 1) & mask) {
+            ;
+        }
+        entries[pos] = old_entries[i];
+    }
+    MEM_free(old_entries);
+
+    obj->u.map.entries = entries;
+    obj->u.map.alloc_size = new_alloc_size;
+    obj->u.map.used = obj->u.map.size;
+    inter->heap.current_heap_size += (new_alloc_size - old_alloc_size) * sizeof(MapEntry);
+}
+
+static void set_matrix_shape(CRB_Matrix *matrix, int dimension, int *shape)
+{
+    int i;
+
+    matrix->dimension = dimension;
+    matrix->shape = MEM_malloc(sizeof(int) * dimension * 2);
+    matrix->stride = matrix->shape + dimension;
+    for (i = dimension - 1; i >= 0; --i) {
+        matrix->shape[i] = shape[i];
+        matrix->stride[i] = (dimension - 1 == i) ? 1 : shape[i + 1] * matrix->stride[i + 1];
+    }
+}
+
+/* 元素全是0, 元素个数由调用者检查过不会溢出 */
+CRB_Object* crb_create_matrix_i(CRB_Interpreter *inter, CRB_Boolean is_int, int dimension, int *shape)
+{
+    CRB_Object *ret;
+    long count = 1;
+    int i;
+
+    for (i = 0; i < dimension; ++i) {
+        count *= shape[i];
+    }
+    check_heap_limit(inter, (long)sizeof(double) * count);
+    ret = alloc_object(inter, MATRIX_OBJECT);
+    ret->u.matrix.is_int = is_int;
+    set_matrix_shape(&ret->u.matrix, dimension, shape);
+    ret->u.matrix.data = MEM_malloc(sizeof(double) * (count > 0 ? count : 1));
+    for (i = 0; i < count; ++i) {
+        ret->u.matrix.data[i] = 0.0;
+    }
+    ret->u.matrix.int_data = NULL;
+    ret->u.matrix.base = NULL;
+    ret->u.matrix.read_only = CRB_FALSE;
+    ret->u.matrix.mapped = NULL;
+    ret->u.matrix.mapped_size = 0;
+    inter->heap.current_heap_size += sizeof(double) * count;
+
+    return ret;
+}
+
+/* matrix去掉前depth维, 从offset开始的视图. 可能GC, matrix要在调用者那边可以被mark到 */
+CRB_Object* crb_create_matrix_view_i(CRB_Interpreter *inter, CRB_Object *matrix, int depth, int offset)
+{
+    CRB_Object *ret;
+    CRB_Matrix *src = &matrix->u.matrix;
+
+    DBG_assert(depth > 0 && depth < src->dimension, ("depth:%d\n", depth));
+    ret = alloc_object(inter, MATRIX_OBJECT);
+    ret->u.matrix.is_int = src->is_int;
+    set_matrix_shape(&ret->u.matrix, src->dimension - depth, src->shape + depth);
+    ret->u.matrix.data = src->data + offset;
+    ret->u.matrix.int_data = NULL;
+    ret->u.matrix.base = src->base ? src->base : matrix;
+    ret->u.matrix.read_only = src->read_only;
+    ret->u.matrix.mapped = NULL;
+    ret->u.matrix.mapped_size = 0;
+
+    return ret;
+}
+
+/*
+ * map_array用, 先创建长度0的一维矩阵, 映射成功之后由matrix.c填进去.
+ * 映射的数据不算在堆里, GC也不扫描
+ * */
+CRB_Object* crb_create_mapped_matrix_i(CRB_Interpreter *inter, CRB_Boolean is_int, CRB_Boolean read_only)
+{
+    CRB_Object *ret;
+    int shape = 0;
+
+    ret = alloc_object(inter, MATRIX_OBJECT);
+    ret->u.matrix.is_int = is_int;
+    set_matrix_shape(&ret->u.matrix, 1, &shape);
+    ret->u.matrix.data = NULL;
+    ret->u.matrix.int_data = NULL;
+    ret->u.matrix.base = NULL;
+    ret->u.matrix.read_only = read_only;
+    ret->u.matrix.mapped = NULL;
+    ret->u.matrix.mapped_size = 0;
+
+    return ret;
+}
+
+/* 生成器的c栈也算在堆里, 生成器本身之后由generator.c挂上来 */
+CRB_Object* crb_create_generator_i(CRB_Interpreter *inter)
+{
+    CRB_Object *ret;
+
+    check_heap_limit(inter, GENERATOR_STACK_SIZE);
+    ret = alloc_object(inter, GENERATOR_OBJECT);
+    ret->u.generator = NULL;
+    inter->heap.current_heap_size += GENERATOR_STACK_SIZE;
+
+    return ret;
+}
+
 static void add_ref_in_native_method(CRB_LocalEnvironment *env, CRB_Object *obj)
 {
     RefInNativeFunc *new_ref;
@@ -209,8 +556,11 @@ CRB_Object* crb_create_crowbar_string_i(CRB_Interpreter *inter, char *str)
     CRB_Object *obj;
     obj = alloc_object(inter, STRING_OBJECT);
     obj->u.string.string = str;
-    inter->heap.current_heap_size += strlen(str) + 1;
+    obj->u.string.length = strlen(str);
+    inter->heap.current_heap_size += obj->u.string.length + 1;
     obj->u.string.is_literal = CRB_FALSE;
+    obj->u.string.parent = NULL;
+    obj->u.string.offset = 0;
 
     return obj;
 }
@@ -229,12 +579,61 @@ CRB_Object* crb_literal_to_crb_string(CRB_Interpreter *inter, char *str)
     CRB_Object *ret;
     ret = alloc_object(inter, STRING_OBJECT);
     ret->u.string.string = str;
-    /* inter->heap.current_heap_size += strlen(str) + 1; */
+    ret->u.string.length = strlen(str);
+    ret->u.string.is_literal = CRB_TRUE;
+    ret->u.string.parent = NULL;
+    ret->u.string.offset = 0;
+
+    return ret;
+}
+
+/* obj从offset开始length个字符的视图, 不拷贝. 可能GC, obj要在调用者那边可以被mark到 */
+CRB_Object* crb_create_string_view_i(CRB_Interpreter *inter, CRB_Object *obj, int offset, int length)
+{
+    CRB_Object *ret;
+
+    DBG_assert(offset >= 0 && length >= 0 && offset + length <= obj->u.string.length,
+            ("offset:%d length:%d\n", offset, length));
+    ret = alloc_object(inter, STRING_OBJECT);
+    ret->u.string.string = NULL;
+    ret->u.string.length = length;
     ret->u.string.is_literal = CRB_FALSE;
+    /* 视图的视图直接指向最初的字符串 */
+    if (NULL == obj->u.string.string) {
+        ret->u.string.parent = obj->u.string.parent;
+        ret->u.string.offset = obj->u.string.offset + offset;
+    } else {
+        ret->u.string.parent = obj;
+        ret->u.string.offset = offset;
+    }
 
     return ret;
 }
 
+/* '\0'结尾的字符串, 视图这时才拷贝出来, 之后不再需要父字符串. 可能GC */
+char* crb_c_string(CRB_Interpreter *inter, CRB_Object *obj)
+{
+    CRB_String *str = &obj->u.string;
+
+    if (str->string) {
+        return str->string;
+    }
+    /* 整串的视图(去重之后都是这样)直接用父字符串的 */
+    if (0 == str->offset && str->length == str->parent->u.string.length) {
+        return str->parent->u.string.string;
+    }
+
+    check_heap_limit(inter, str->length + 1);
+    str->string = MEM_malloc(str->length + 1);
+    memcpy(str->string, str->parent->u.string.string + str->offset, str->length);
+    str->string[str->length] = '\0';
+    inter->heap.current_heap_size += str->length + 1;
+    str->parent = NULL;
+    str->offset = 0;
+
+    return str->string;
+}
+
 void crb_array_add(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value v)
 {
     int new_size;
@@ -247,6 +646,7 @@ void crb_array_add(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value v)
             new_size = obj->u.array.alloc_size + ARRAY_ALLOC_SIZE;
         }
 
+        check_heap_limit(inter, (long)(new_size - obj->u.array.alloc_size) * sizeof(CRB_Value));
         obj->u.array.array = MEM_realloc(obj->u.array.array, new_size * sizeof(CRB_Value));
         inter->heap.current_heap_size += (new_size - obj->u.array.alloc_size) * sizeof(CRB_Value);
         obj->u.array.alloc_size = new_size;
@@ -281,6 +681,7 @@ void crb_array_resize(CRB_Interpreter *inter, CRB_Object *obj, int new_size)
 
     if (need_realloc) {
         check_gc(inter);
+        check_heap_limit(inter, (long)(new_alloc_size - obj->u.array.alloc_size) * sizeof(CRB_Value));
         obj->u.array.array = MEM_realloc(obj->u.array.array, new_alloc_size * sizeof(CRB_Value));
         inter->heap.current_heap_size += (new_alloc_size - obj->u.array.alloc_size) * sizeof(CRB_Value);
         obj->u.array.alloc_size = new_alloc_size;
@@ -3,11 +3,26 @@
  * CreateDate : 2019-11-25 03:41:24
  * */
 
+#define _POSIX_C_SOURCE 200112L
+
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
 #include "MEM.h"
 #include "DBG.h"
 #define GLOBAL_VARIABLE_DEFINE
 #include "crowbar.h"
 
+/*
+ * yacc/lex生成的分析器,字符串字面量缓存和st_current_interpreter都是进程全局的,
+ * 编译(包括延迟编译函数体)和程序的引用计数都在这把锁里做.
+ * 运行时不碰这些全局变量,不同线程上的解释器可以同时执行.
+ * */
+static pthread_mutex_t st_compile_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* 每隔这么多步看一次时间 */
+#define CLOCK_CHECK_STEPS (4096)
+
 void crb_release_string(CRB_String *str);
 
 static void add_native_functions(CRB_Interpreter *inter)
@@ -17,19 +32,103 @@ static void add_native_functions(CRB_Interpreter *inter)
     CRB_add_native_function(inter, "fclose", crb_nv_fclose_proc);
     CRB_add_native_function(inter, "fgets", crb_nv_fgets_proc);
     CRB_add_native_function(inter, "fputs", crb_nv_fputs_proc);
+    CRB_add_native_function(inter, "flush", crb_nv_flush_proc);
+    CRB_add_native_function(inter, "read_all", crb_nv_read_all_proc);
+    CRB_add_native_function(inter, "read_lines", crb_nv_read_lines_proc);
+    CRB_add_native_function(inter, "read", crb_nv_read_proc);
     CRB_add_native_function(inter, "new_array", crb_nv_new_array_proc);
+    CRB_add_native_function(inter, "new_map", crb_nv_new_map_proc);
+    CRB_add_native_function(inter, "heap_size", crb_nv_heap_size_proc);
+    CRB_add_native_function(inter, "new_matrix", crb_nv_new_matrix_proc);
+    CRB_add_native_function(inter, "new_int_matrix", crb_nv_new_int_matrix_proc);
+    CRB_add_native_function(inter, "map_array", crb_nv_map_array_proc);
+    CRB_add_native_function(inter, "parse_int", crb_nv_parse_int_proc);
+    CRB_add_native_function(inter, "parse_double", crb_nv_parse_double_proc);
+    CRB_add_native_function(inter, "json_parse", crb_nv_json_parse_proc);
+    CRB_add_native_function(inter, "json_stringify", crb_nv_json_stringify_proc);
+    CRB_add_native_function(inter, "generator", crb_nv_generator_proc);
+    CRB_add_native_function(inter, "ev_popen", crb_nv_ev_popen_proc);
+    CRB_add_native_function(inter, "ev_open", crb_nv_ev_open_proc);
+    CRB_add_native_function(inter, "ev_connect", crb_nv_ev_connect_proc);
+    CRB_add_native_function(inter, "ev_on_line", crb_nv_ev_on_line_proc);
+    CRB_add_native_function(inter, "ev_write", crb_nv_ev_write_proc);
+    CRB_add_native_function(inter, "ev_close", crb_nv_ev_close_proc);
+    CRB_add_native_function(inter, "ev_timer", crb_nv_ev_timer_proc);
+    CRB_add_native_function(inter, "ev_run", crb_nv_ev_run_proc);
+    CRB_add_native_function(inter, "channel", crb_nv_channel_proc);
+    CRB_add_native_function(inter, "send", crb_nv_send_proc);
+    CRB_add_native_function(inter, "recv", crb_nv_recv_proc);
+    CRB_add_native_function(inter, "close_channel", crb_nv_close_channel_proc);
+    CRB_add_native_function(inter, "spawn", crb_nv_spawn_proc);
+    CRB_add_native_function(inter, "join", crb_nv_join_proc);
+    CRB_add_native_function(inter, "parallel_map", crb_nv_parallel_map_proc);
+    CRB_add_native_function(inter, "parallel_reduce", crb_nv_parallel_reduce_proc);
 }
 
 void CRB_add_native_function(CRB_Interpreter *interpreter, char *name, CRB_NativeFunctionProc *proc)
 {
     FunctionDefinition *fd;
-    fd = crb_malloc(sizeof(FunctionDefinition));
+    fd = MEM_storage_malloc(interpreter->interpreter_storage, sizeof(FunctionDefinition));
     fd->name = name;
     fd->type = NATIVE_FUNCTION_DEFINITION;
     fd->u.native_f.proc = proc;
-    fd->next = interpreter->function_list;
+    fd->next = interpreter->native_function_list;
+
+    interpreter->native_function_list = fd; /* 内置函数列表 */
+}
+
+static CRB_Program *create_program(void)
+{
+    MEM_Storage storage;
+    CRB_Program *program;
+
+    storage = MEM_open_storage(0);
+    program = MEM_storage_malloc(storage, sizeof(CRB_Program));
+    program->program_storage = storage;
+    program->function_list = NULL;
+    program->statement_list = NULL;
+    program->compiled_image = NULL;
+    program->compiled_image_size = 0;
+    program->ref_count = 1;
+
+    return program;
+}
+
+CRB_Program *CRB_get_program(CRB_Interpreter *interpreter)
+{
+    pthread_mutex_lock(&st_compile_mutex);
+    interpreter->program->ref_count++;
+    pthread_mutex_unlock(&st_compile_mutex);
+
+    return interpreter->program;
+}
+
+void CRB_release_program(CRB_Program *program)
+{
+    int ref_count;
+
+    pthread_mutex_lock(&st_compile_mutex);
+    DBG_assert(program->ref_count > 0, ("ref_count:%d\n", program->ref_count));
+    ref_count = --program->ref_count;
+    pthread_mutex_unlock(&st_compile_mutex);
+    if (ref_count > 0) {
+        return;
+    }
 
-    interpreter->function_list = fd; /* 内置函数列表 */
+    crb_dispose_compiled(program);
+    MEM_dispose_storage(program->program_storage);
+}
+
+/* 换成别的程序, 运行时状态一起清掉 */
+void CRB_set_program(CRB_Interpreter *interpreter, CRB_Program *program)
+{
+    CRB_reset_interpreter(interpreter);
+
+    pthread_mutex_lock(&st_compile_mutex);
+    program->ref_count++;
+    pthread_mutex_unlock(&st_compile_mutex);
+    CRB_release_program(interpreter->program);
+    interpreter->program = program;
 }
 
 CRB_Interpreter *CRB_create_interpreter(void)
@@ -44,8 +143,8 @@ CRB_Interpreter *CRB_create_interpreter(void)
     interpreter->interpreter_storage = storage; 
     interpreter->execute_storage = NULL; 
     interpreter->variable = NULL;
-    interpreter->function_list = NULL;
-    interpreter->statement_list = NULL;
+    interpreter->program = create_program();
+    interpreter->native_function_list = NULL;
     interpreter->current_line_number = 1;
 
     /* v2 */
@@ -56,37 +155,284 @@ CRB_Interpreter *CRB_create_interpreter(void)
     interpreter->heap.current_heap_size = 0;
     interpreter->heap.current_threshold = HEAP_THRESHOLD_SIZE;
     interpreter->heap.header = NULL;
+    interpreter->heap.dedup_pending = CRB_FALSE;
     interpreter->top_environment = NULL;
+    interpreter->free_environment = NULL;
+    interpreter->call_result.type = CRB_NULL_VALUE;
+    interpreter->limits.max_steps = 0;
+    interpreter->limits.max_heap_size = 0;
+    interpreter->limits.timeout_msec = 0;
+    interpreter->step_count = 0;
+    interpreter->next_budget_check = LONG_MAX;
+    interpreter->deadline = 0.0;
+    interpreter->recovery = NULL;
+    interpreter->status = CRB_STATUS_OK;
+    interpreter->error_message = NULL;
+    interpreter->compile_recovery = NULL;
     /* v2 */
+    interpreter->strict = CRB_FALSE;
+    interpreter->string_dedup = CRB_FALSE;
+    interpreter->native_callback = CRB_FALSE;
+    interpreter->native_line_number = 0;
+    interpreter->current_function = NULL;
+    interpreter->current_generator = NULL;
+    interpreter->event_loop = NULL;
+    interpreter->thread_group = NULL;
+    interpreter->worker_list = NULL;
+    interpreter->worker_pool = NULL;
+    interpreter->pool_thread = NULL;
+    interpreter->output_list = NULL;
+    interpreter->input_list = NULL;
 
-    crb_set_current_interpreter(interpreter);
     add_native_functions(interpreter);  /* 注册内置函数 */
 
     return interpreter;
 }
 
-void CRB_compile(CRB_Interpreter *interpreter, FILE *fp)
+/* 语法错误时crb_compile_error跳回这里, 错误信息留在解释器里 */
+CRB_Status CRB_compile(CRB_Interpreter *interpreter, FILE *fp)
 {
     extern int yyparse(void);
-    extern FILE *yyin;
+    jmp_buf recovery;
 
+    pthread_mutex_lock(&st_compile_mutex);
     crb_set_current_interpreter(interpreter);
 
-    yyin = fp;
-    if (yyparse()) {
-        fprintf(stderr, "Error\n");
-        exit(1);
+    interpreter->status = CRB_STATUS_OK;
+    if (0 == setjmp(recovery)) {
+        interpreter->compile_recovery = &recovery;
+        crb_restart_lexer(fp);
+        if (yyparse()) {
+            interpreter->status = CRB_STATUS_COMPILE_ERROR;
+        }
+    } else {
+        interpreter->status = CRB_STATUS_COMPILE_ERROR;
     }
+    interpreter->compile_recovery = NULL;
 
     crb_reset_string_literal_buffer(); /* 重置字符串缓存 */
+    crb_set_current_interpreter(NULL);
+    pthread_mutex_unlock(&st_compile_mutex);
+
+    return interpreter->status;
+}
+
+void CRB_set_strict_mode(CRB_Interpreter *interpreter, int strict)
+{
+    interpreter->strict = strict ? CRB_TRUE : CRB_FALSE;
+}
+
+void CRB_set_string_dedup(CRB_Interpreter *interpreter, int dedup)
+{
+    interpreter->string_dedup = dedup ? CRB_TRUE : CRB_FALSE;
+}
+
+/* 重定位缓存里的函数, 分析延迟编译的函数体, 有语法错误时返回CRB_FALSE */
+static CRB_Boolean compile_body(CRB_Interpreter *inter, FunctionDefinition *func)
+{
+    extern int yyparse(void);
+    jmp_buf recovery;
+    CRB_Boolean failed = CRB_FALSE;
+
+    pthread_mutex_lock(&st_compile_mutex);
+    /* 缓存里的函数先重定位, 缓存损坏时不能再重新编译, 当作编译错误 */
+    if (func->u.crowbar_f.cached && !crb_load_cached_function(inter->program, func)) {
+        pthread_mutex_unlock(&st_compile_mutex);
+        return CRB_FALSE;
+    }
+    /* 共享同一个程序的其他解释器可能已经编译好了 */
+    if (func->u.crowbar_f.block) {
+        pthread_mutex_unlock(&st_compile_mutex);
+        return CRB_TRUE;
+    }
+    DBG_assert(func->u.crowbar_f.lazy_body != NULL, ("func:%s\n", func->name));
+    crb_set_current_interpreter(inter);
+    inter->current_line_number = func->u.crowbar_f.lazy_body->line_number;
+    inter->current_function = func;
+
+    if (0 == setjmp(recovery)) {
+        inter->compile_recovery = &recovery;
+        crb_scan_function_body(func->u.crowbar_f.lazy_body->text);
+        if (yyparse()) {
+            failed = CRB_TRUE;
+        }
+    } else {
+        failed = CRB_TRUE;
+    }
+    inter->compile_recovery = NULL;
+    crb_finish_function_body();
+    crb_reset_string_literal_buffer();
+    /* 编译好了就不再需要函数体的文本, 失败时留着, 下次调用再报一次错 */
+    if (!failed) {
+        func->u.crowbar_f.lazy_body = NULL;
+    }
+
+    inter->current_function = NULL;
+    crb_set_current_interpreter(NULL);
+    pthread_mutex_unlock(&st_compile_mutex);
+
+    return !failed;
+}
+
+/*
+ * 第一次调用时在编译锁里分析函数体, 有语法错误时中止执行.
+ * 调用方不加锁检查block, block在函数体完整建好之后才写入.
+ * */
+void crb_compile_function_body(CRB_Interpreter *inter, FunctionDefinition *func)
+{
+    if (!compile_body(inter, func)) {
+        crb_abort(inter, CRB_STATUS_COMPILE_ERROR);
+    }
+}
+
+/*
+ * fork之前把函数体全部编译好, 缓存里的函数全部重定位,
+ * 子进程共享编译结果, 不用每个请求各编译一次.
+ * 有语法错误的函数block一直是NULL, 调用时在锁里再编译一次并报错.
+ * */
+void crb_compile_all_functions(CRB_Interpreter *inter)
+{
+    FunctionDefinition *func;
+
+    for (func = inter->program->function_list; func; func = func->next) {
+        if (CROWBAR_FUNCTION_DEFINITION == func->type
+                && (func->u.crowbar_f.lazy_body || func->u.crowbar_f.cached)) {
+            compile_body(inter, func);
+        }
+    }
+}
+
+/* 全局变量放在运行时存储里,第一次注入全局变量或运行时打开 */
+void crb_open_execute_storage(CRB_Interpreter *inter)
+{
+    inter->execute_storage = MEM_open_storage(0);
+    crb_add_std_fp(inter);
+}
+
+static double now_msec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+void CRB_set_limits(CRB_Interpreter *interpreter, CRB_Limits *limits)
+{
+    if (limits) {
+        interpreter->limits = *limits;
+    } else {
+        interpreter->limits.max_steps = 0;
+        interpreter->limits.max_heap_size = 0;
+        interpreter->limits.timeout_msec = 0;
+    }
+}
+
+CRB_Status CRB_get_status(CRB_Interpreter *interpreter)
+{
+    return interpreter->status;
+}
+
+char *CRB_get_status_message(CRB_Status status)
+{
+    switch (status) {
+    case CRB_STATUS_OK:
+        return "ok";
+    case CRB_STATUS_STEP_LIMIT:
+        return "step limit exceeded";
+    case CRB_STATUS_HEAP_LIMIT:
+        return "heap limit exceeded";
+    case CRB_STATUS_TIMEOUT:
+        return "timeout";
+    case CRB_STATUS_RUNTIME_ERROR:
+        return "runtime error";
+    case CRB_STATUS_COMPILE_ERROR:
+        return "syntax error";
+    default:
+        return "unknown";
+    }
+}
+
+char *CRB_get_error_message(CRB_Interpreter *interpreter)
+{
+    if ((CRB_STATUS_RUNTIME_ERROR == interpreter->status
+                || CRB_STATUS_COMPILE_ERROR == interpreter->status)
+            && interpreter->error_message) {
+        return interpreter->error_message;
+    }
+
+    return CRB_get_status_message(interpreter->status);
+}
+
+static void set_next_budget_check(CRB_Interpreter *inter)
+{
+    long next = LONG_MAX;
+
+    if (inter->limits.timeout_msec > 0) {
+        next = inter->step_count + CLOCK_CHECK_STEPS;
+    }
+    if (inter->limits.max_steps > 0 && inter->limits.max_steps < next) {
+        next = inter->limits.max_steps;
+    }
+    inter->next_budget_check = next;
+}
+
+/* 一次执行开始, 重新计数 */
+void crb_start_budget(CRB_Interpreter *inter)
+{
+    inter->status = CRB_STATUS_OK;
+    inter->step_count = 0;
+    if (inter->limits.timeout_msec > 0) {
+        inter->deadline = now_msec() + inter->limits.timeout_msec;
+    }
+    set_next_budget_check(inter);
+}
+
+void crb_check_budget(CRB_Interpreter *inter)
+{
+    /* 线程池里的解释器先从调用者剩下的步数里再领一批 */
+    if (inter->limits.max_steps > 0 && inter->step_count >= inter->limits.max_steps
+            && !(inter->pool_thread && crb_take_pool_steps(inter))) {
+        crb_abort(inter, CRB_STATUS_STEP_LIMIT);
+    }
+    if (inter->limits.timeout_msec > 0 && now_msec() >= inter->deadline) {
+        crb_abort(inter, CRB_STATUS_TIMEOUT);
+    }
+    set_next_budget_check(inter);
 }
 
-void CRB_interpreter(CRB_Interpreter *interpreter)
+/* 跳回最近的恢复点, 栈和局部环境由恢复点还原 */
+void crb_abort(CRB_Interpreter *inter, CRB_Status status)
 {
-    interpreter->execute_storage = MEM_open_storage(0);
-    crb_add_std_fp(interpreter);
-    crb_execute_statement_list(interpreter, NULL, interpreter->statement_list);
+    DBG_assert(inter->recovery != NULL, ("status:%d\n", status));
+
+    inter->status = status;
+    longjmp(*inter->recovery, 1);
+}
+
+CRB_Status CRB_interpreter(CRB_Interpreter *interpreter)
+{
+    jmp_buf recovery;
+
+    if (NULL == interpreter->execute_storage) {
+        crb_open_execute_storage(interpreter);
+    }
+
+    crb_start_budget(interpreter);
+    if (0 == setjmp(recovery)) {
+        interpreter->recovery = &recovery;
+        crb_execute_statement_list(interpreter, NULL, interpreter->program->statement_list);
+    } else {
+        crb_unwind(interpreter, 0, NULL);
+        /* 可能是从内置函数的回调里跳出来的 */
+        interpreter->native_callback = CRB_FALSE;
+    }
+    interpreter->recovery = NULL;
+    crb_flush_output(interpreter, NULL);
     crb_garbage_collect(interpreter);
+
+    return interpreter->status;
 }
 
 static void release_global_strings(CRB_Interpreter *interpreter)
@@ -97,8 +443,39 @@ static void release_global_strings(CRB_Interpreter *interpreter)
     }
 }
 
+void CRB_reset_interpreter(CRB_Interpreter *interpreter)
+{
+    DBG_assert(NULL == interpreter->top_environment, ("top_environment:%p\n", (void*)interpreter->top_environment));
+
+    /* 上一次运行没关的句柄和没到时间的定时器, 线程池和没有join的线程 */
+    crb_dispose_event_loop(interpreter);
+    crb_dispose_worker_pool(interpreter);
+    crb_dispose_workers(interpreter);
+    crb_dispose_output(interpreter);
+    crb_dispose_input(interpreter);
+
+    /* 全局变量的节点都在运行时存储里,整个释放 */
+    release_global_strings(interpreter);
+    if (interpreter->execute_storage) {
+        MEM_dispose_storage(interpreter->execute_storage);
+        interpreter->execute_storage = NULL;
+    }
+
+    /* 没有根了,堆上剩下的对象全部回收 */
+    interpreter->stack.stack_pointer = 0;
+    interpreter->call_result.type = CRB_NULL_VALUE;
+    crb_garbage_collect(interpreter);
+    interpreter->heap.current_threshold = HEAP_THRESHOLD_SIZE;
+}
+
 void CRB_dispose_interpreter(CRB_Interpreter *interpreter)
 {
+    crb_dispose_event_loop(interpreter);
+    crb_dispose_worker_pool(interpreter);
+    crb_dispose_workers(interpreter);
+    crb_dispose_output(interpreter);
+    crb_dispose_input(interpreter);
+    crb_dispose_free_environments(interpreter);
     release_global_strings(interpreter);
 
     if (interpreter->execute_storage) {
@@ -106,9 +483,12 @@ void CRB_dispose_interpreter(CRB_Interpreter *interpreter)
     }
 
     interpreter->variable = NULL;
+    interpreter->call_result.type = CRB_NULL_VALUE;
     crb_garbage_collect(interpreter);
-    DBG_assert(interpreter->heap.current_heap_size == 0 , ("%d bytes leaked.\n", interpreter->heap.current_heap_size));
+    DBG_assert(interpreter->heap.current_heap_size == 0 , ("%ld bytes leaked.\n", interpreter->heap.current_heap_size));
     MEM_free(interpreter->stack.stack);
+    MEM_free(interpreter->error_message);
+    CRB_release_program(interpreter->program);
     MEM_dispose_storage(interpreter->interpreter_storage);
 }
 
@@ -0,0 +1,642 @@
+/*
+ * File : json.c
+ * CreateDate : 2026-10-20 16:05:12
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <setjmp.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+/*
+ * JSON和数组/散列表的转换
+ *
+ *   m = json_parse("{\"a\": [1, 2.5, \"x\"]}");   # 对象->散列表, 数组->数组
+ *   s = json_stringify(m);                        # {"a":[1,2.5,"x"]}
+ *
+ * 解析一遍扫完, 中间的数组和散列表放在栈上防GC.
+ * 没有转义的字符串直接做成原文的视图, 有转义的才解码到新分配的缓冲.
+ * 视图会让整个原文活着: 结果里只要还有一个这样的字符串值, 原文就不能回收.
+ * 只留下一小部分时用"" + s拷贝出来. 散列表的键插入时crb_map_lvalue已经拷贝了.
+ * 字符串里没转义的控制字符(小于0x20)按格式错误处理.
+ * 整数超出int的范围时变成实数.
+ * 输出写到一个VString里, 最后交给字符串, 不再拷贝.
+ * 散列表整数的键输出成字符串, 矩阵输出成嵌套的数组, nan和inf输出成null.
+ * */
+
+/* 嵌套太深的输入会让递归下降把c栈用完 */
+#define JSON_MAX_DEPTH (512)
+
+typedef struct {
+    CRB_Interpreter *inter;
+    CRB_Object *text;
+    char *chars;
+    int length;
+    int pos;
+    int depth;
+} JsonParser;
+
+/* 正在输出的数组和散列表, 发现循环引用时报错 */
+typedef struct JsonPath_tag {
+    CRB_Object *object;
+    struct JsonPath_tag *outer;
+} JsonPath;
+
+static void parse_value(JsonParser *parser);
+
+static void parse_error(JsonParser *parser)
+{
+    crb_runtime_error(parser->inter, parser->inter->native_line_number, JSON_PARSE_ERR, INT_MESSAGE_ARGUMENT, "position", parser->pos + 1, MESSAGE_ARGUMENT_END);
+}
+
+static void skip_space(JsonParser *parser)
+{
+    char ch;
+
+    for (; parser->pos < parser->length; ++parser->pos) {
+        ch = parser->chars[parser->pos];
+        if (ch != ' ' && ch != '\n' && ch != '\r' && ch != '\t') {
+            break;
+        }
+    }
+}
+
+/* 跳过空白后下一个字符, 到末尾时是'\0' */
+static char peek_char(JsonParser *parser)
+{
+    skip_space(parser);
+    return parser->pos < parser->length ? parser->chars[parser->pos] : '\0';
+}
+
+static void push_object(JsonParser *parser, CRB_ValueType type, CRB_Object *obj)
+{
+    CRB_Value value;
+
+    value.type = type;
+    value.u.object = obj;
+    push_value(parser->inter, &value);
+}
+
+static void parse_literal(JsonParser *parser, char *word, CRB_Value *value)
+{
+    int length = strlen(word);
+
+    if (parser->length - parser->pos < length || memcmp(parser->chars + parser->pos, word, length) != 0) {
+        parse_error(parser);
+    }
+    parser->pos += length;
+    push_value(parser->inter, value);
+}
+
+static int scan_digits(JsonParser *parser)
+{
+    int start = parser->pos;
+
+    while (parser->pos < parser->length && parser->chars[parser->pos] >= '0' && parser->chars[parser->pos] <= '9') {
+        parser->pos++;
+    }
+
+    return parser->pos - start;
+}
+
+/* -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? */
+static void parse_number(JsonParser *parser)
+{
+    CRB_Value value;
+    CRB_Boolean is_int = CRB_TRUE;
+    char *chars = parser->chars;
+    int start = parser->pos;
+    int digits;
+
+    if ('-' == chars[parser->pos]) {
+        parser->pos++;
+    }
+    digits = scan_digits(parser);
+    if (0 == digits) {
+        parse_error(parser);
+    }
+    /* 01这样开头多余的0不认, 指到0后面 */
+    if (digits > 1 && '0' == chars[parser->pos - digits]) {
+        parser->pos -= digits - 1;
+        parse_error(parser);
+    }
+    if (parser->pos < parser->length && '.' == chars[parser->pos]) {
+        is_int = CRB_FALSE;
+        parser->pos++;
+        if (0 == scan_digits(parser)) {
+            parse_error(parser);
+        }
+    }
+    if (parser->pos < parser->length && ('e' == chars[parser->pos] || 'E' == chars[parser->pos])) {
+        is_int = CRB_FALSE;
+        parser->pos++;
+        if (parser->pos < parser->length && ('+' == chars[parser->pos] || '-' == chars[parser->pos])) {
+            parser->pos++;
+        }
+        if (0 == scan_digits(parser)) {
+            parse_error(parser);
+        }
+    }
+
+    value.type = CRB_INT_VALUE;
+    if (!is_int || !crb_parse_int(chars + start, parser->pos - start, &value.u.int_value)) {
+        value.type = CRB_DOUBLE_VALUE;
+        crb_parse_double(chars + start, parser->pos - start, &value.u.double_value);
+    }
+    push_value(parser->inter, &value);
+}
+
+static int hex_value(char ch)
+{
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+    if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
+    return -1;
+}
+
+/* \u后面的4位十六进制, 不对时返回-1 */
+static int read_hex4(char *chars)
+{
+    int code = 0;
+    int digit;
+    int i;
+
+    for (i = 0; i < 4; ++i) {
+        digit = hex_value(chars[i]);
+        if (digit < 0) {
+            return -1;
+        }
+        code = code * 16 + digit;
+    }
+
+    return code;
+}
+
+static int encode_utf8(char *dest, int code)
+{
+    if (code < 0x80) {
+        dest[0] = code;
+        return 1;
+    }
+    if (code < 0x800) {
+        dest[0] = 0xc0 | (code >> 6);
+        dest[1] = 0x80 | (code & 0x3f);
+        return 2;
+    }
+    if (code < 0x10000) {
+        dest[0] = 0xe0 | (code >> 12);
+        dest[1] = 0x80 | ((code >> 6) & 0x3f);
+        dest[2] = 0x80 | (code & 0x3f);
+        return 3;
+    }
+    dest[0] = 0xf0 | (code >> 18);
+    dest[1] = 0x80 | ((code >> 12) & 0x3f);
+    dest[2] = 0x80 | ((code >> 6) & 0x3f);
+    dest[3] = 0x80 | (code & 0x3f);
+    return 4;
+}
+
+/*
+ * 解码from到end(不含结尾的引号)之间的转义, 写到dest, 返回解码后的长度.
+ * 格式不对时返回-1, 这时parser->pos指向出错的转义.
+ * 解码后不会比原文长, dest有end - from + 1就够了.
+ * */
+static int decode_string(JsonParser *parser, int from, int end, char *dest)
+{
+    char *chars = parser->chars;
+    int length = 0;
+    int code;
+    int low;
+    int i;
+
+    for (i = from; i < end; ++i) {
+        parser->pos = i;
+        if ((unsigned char)chars[i] < 0x20) {
+            return -1;
+        }
+        if (chars[i] != '\\') {
+            dest[length++] = chars[i];
+            continue;
+        }
+        switch (chars[++i]) {
+        case '"':  dest[length++] = '"'; break;
+        case '\\': dest[length++] = '\\'; break;
+        case '/':  dest[length++] = '/'; break;
+        case 'b':  dest[length++] = '\b'; break;
+        case 'f':  dest[length++] = '\f'; break;
+        case 'n':  dest[length++] = '\n'; break;
+        case 'r':  dest[length++] = '\r'; break;
+        case 't':  dest[length++] = '\t'; break;
+        case 'u':
+            if (end - i < 5 || (code = read_hex4(chars + i + 1)) < 0) {
+                return -1;
+            }
+            i += 4;
+            /* 代理对合成一个码点, 单独的代理不认 */
+            if (code >= 0xd800 && code <= 0xdbff) {
+                if (end - i < 7 || chars[i + 1] != '\\' || chars[i + 2] != 'u'
+                        || (low = read_hex4(chars + i + 3)) < 0xdc00 || low > 0xdfff) {
+                    return -1;
+                }
+                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                i += 6;
+            } else if (code >= 0xdc00 && code <= 0xdfff) {
+                return -1;
+            }
+            /* 字符串以'\0'结尾, 中间不能有'\0' */
+            if (0 == code) {
+                return -1;
+            }
+            length += encode_utf8(dest + length, code);
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    return length;
+}
+
+/* parser->pos指向开头的引号, 返回的字符串由调用者放到栈上 */
+static CRB_Object *parse_string(JsonParser *parser)
+{
+    unsigned char *chars = (unsigned char *)parser->chars;
+    char *buf;
+    int from = parser->pos + 1;
+    int end;
+    int length;
+
+    /* 大多数字符串没有转义, 扫到结尾的引号就做成视图 */
+    for (end = from; end < parser->length; ++end) {
+        if ('"' == chars[end] || '\\' == chars[end] || chars[end] < 0x20) {
+            break;
+        }
+    }
+    if (end < parser->length && '"' == chars[end]) {
+        parser->pos = end + 1;
+        return crb_create_string_view_i(parser->inter, parser->text, from, end - from);
+    }
+    if (end < parser->length && chars[end] < 0x20) {
+        parser->pos = end;
+        parse_error(parser);
+    }
+
+    /* 有转义时引号可能被转义了, 从第一个转义接着找真正的结尾 */
+    for (; end < parser->length && chars[end] != '"'; ++end) {
+        if ('\\' == chars[end]) {
+            ++end;
+        }
+    }
+    if (end >= parser->length) {
+        parse_error(parser);
+    }
+    buf = MEM_malloc(end - from + 1);
+    length = decode_string(parser, from, end, buf);
+    if (length < 0) {
+        MEM_free(buf);
+        parse_error(parser);
+    }
+    buf[length] = '\0';
+    parser->pos = end + 1;
+
+    return crb_create_crowbar_string_i(parser->inter, buf);
+}
+
+static void enter_container(JsonParser *parser)
+{
+    if (++parser->depth > JSON_MAX_DEPTH) {
+        parse_error(parser);
+    }
+    parser->pos++;
+}
+
+/* 数组放在栈上, 元素解析出来后追加进去 */
+static void parse_array(JsonParser *parser)
+{
+    CRB_Interpreter *inter = parser->inter;
+    char ch;
+
+    enter_container(parser);
+    push_object(parser, CRB_ARRAY_VALUE, crb_create_array_i(inter, 0));
+    if (']' == peek_char(parser)) {
+        parser->pos++;
+        parser->depth--;
+        return;
+    }
+    for (;;) {
+        parse_value(parser);
+        crb_array_add(inter, peek_stack(inter, 1)->u.object, *peek_stack(inter, 0));
+        pop_value(inter);
+        ch = peek_char(parser);
+        if (']' == ch) {
+            break;
+        }
+        if (ch != ',') {
+            parse_error(parser);
+        }
+        parser->pos++;
+    }
+    parser->pos++;
+    parser->depth--;
+}
+
+/* 散列表, 键和值都放到栈上之后再插入 */
+static void parse_object(JsonParser *parser)
+{
+    CRB_Interpreter *inter = parser->inter;
+    CRB_Value *dest;
+    char ch;
+
+    enter_container(parser);
+    push_object(parser, CRB_MAP_VALUE, crb_create_map_i(inter));
+    if ('}' == peek_char(parser)) {
+        parser->pos++;
+        parser->depth--;
+        return;
+    }
+    for (;;) {
+        if (peek_char(parser) != '"') {
+            parse_error(parser);
+        }
+        push_object(parser, CRB_STRING_VALUE, parse_string(parser));
+        if (peek_char(parser) != ':') {
+            parse_error(parser);
+        }
+        parser->pos++;
+        parse_value(parser);
+        dest = crb_map_lvalue(inter, peek_stack(inter, 2)->u.object, peek_stack(inter, 1), 0);
+        *dest = *peek_stack(inter, 0);
+        shrink_stack(inter, 2);
+        ch = peek_char(parser);
+        if ('}' == ch) {
+            break;
+        }
+        if (ch != ',') {
+            parse_error(parser);
+        }
+        parser->pos++;
+    }
+    parser->pos++;
+    parser->depth--;
+}
+
+/* 解析一个值, 结果压到栈上 */
+static void parse_value(JsonParser *parser)
+{
+    CRB_Value value;
+
+    switch (peek_char(parser)) {
+    case '{':
+        parse_object(parser);
+        break;
+    case '[':
+        parse_array(parser);
+        break;
+    case '"':
+        push_object(parser, CRB_STRING_VALUE, parse_string(parser));
+        break;
+    case 't':
+    case 'f':
+        value.type = CRB_BOOLEAN_VALUE;
+        value.u.boolean_value = ('t' == parser->chars[parser->pos]);
+        parse_literal(parser, value.u.boolean_value ? "true" : "false", &value);
+        break;
+    case 'n':
+        value.type = CRB_NULL_VALUE;
+        parse_literal(parser, "null", &value);
+        break;
+    case '-':
+    case '0': case '1': case '2': case '3': case '4':
+    case '5': case '6': case '7': case '8': case '9':
+        parse_number(parser);
+        break;
+    default:
+        parse_error(parser);
+    }
+}
+
+/* json_parse(str): 格式不对时报运行时错误 */
+CRB_Value crb_nv_json_parse_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    JsonParser parser;
+
+    if (arg_count != 1 || args[0].type != CRB_STRING_VALUE) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "json_parse", MESSAGE_ARGUMENT_END);
+    }
+    parser.inter = inter;
+    parser.text = args[0].u.object;
+    parser.chars = crb_string_chars(parser.text);
+    parser.length = parser.text->u.string.length;
+    parser.pos = 0;
+    parser.depth = 0;
+
+    parse_value(&parser);
+    skip_space(&parser);
+    if (parser.pos < parser.length) {
+        parse_error(&parser);
+    }
+
+    return pop_value(inter);
+}
+
+static void value_error(CRB_Interpreter *inter, char *type)
+{
+    crb_runtime_error(inter, inter->native_line_number, JSON_VALUE_ERR, STRING_MESSAGE_ARGUMENT, "type", type, MESSAGE_ARGUMENT_END);
+}
+
+/* 不需要转义的一段一起追加 */
+static void stringify_string(VString *vstr, char *chars, int length)
+{
+    static char hex[] = "0123456789abcdef";
+    char escape[7];
+    unsigned char ch;
+    int from = 0;
+    int i;
+
+    crb_vstr_append_character(vstr, '"');
+    for (i = 0; i < length; ++i) {
+        ch = chars[i];
+        if (ch >= 0x20 && ch != '"' && ch != '\\') {
+            continue;
+        }
+        crb_vstr_append_chars(vstr, chars + from, i - from);
+        from = i + 1;
+        escape[0] = '\\';
+        switch (ch) {
+        case '"':  escape[1] = '"'; break;
+        case '\\': escape[1] = '\\'; break;
+        case '\b': escape[1] = 'b'; break;
+        case '\f': escape[1] = 'f'; break;
+        case '\n': escape[1] = 'n'; break;
+        case '\r': escape[1] = 'r'; break;
+        case '\t': escape[1] = 't'; break;
+        default:
+            sprintf(escape + 1, "u00%c%c", hex[ch >> 4], hex[ch & 0xf]);
+            crb_vstr_append_chars(vstr, escape, 6);
+            continue;
+        }
+        crb_vstr_append_chars(vstr, escape, 2);
+    }
+    crb_vstr_append_chars(vstr, chars + from, length - from);
+    crb_vstr_append_character(vstr, '"');
+}
+
+static void stringify_double(VString *vstr, double value)
+{
+    char buf[NUMBER_BUF_SIZE];
+
+    /* JSON里没有nan和inf */
+    if (value != value || value > DBL_MAX || value < -DBL_MAX) {
+        crb_vstr_append_string(vstr, "null");
+        return;
+    }
+    crb_vstr_append_chars(vstr, buf, crb_format_double(buf, value));
+}
+
+static void stringify_matrix(VString *vstr, CRB_Matrix *matrix, int depth, int offset)
+{
+    char buf[NUMBER_BUF_SIZE];
+    int i;
+
+    crb_vstr_append_character(vstr, '[');
+    for (i = 0; i < matrix->shape[depth]; ++i) {
+        if (i > 0) {
+            crb_vstr_append_character(vstr, ',');
+        }
+        if (depth < matrix->dimension - 1) {
+            stringify_matrix(vstr, matrix, depth + 1, offset + i * matrix->stride[depth]);
+        } else if (matrix->is_int) {
+            crb_vstr_append_chars(vstr, buf, crb_format_int(buf, (int)crb_matrix_element(matrix, offset + i)));
+        } else {
+            stringify_double(vstr, crb_matrix_element(matrix, offset + i));
+        }
+    }
+    crb_vstr_append_character(vstr, ']');
+}
+
+static void stringify_value(CRB_Interpreter *inter, VString *vstr, CRB_Value *value, JsonPath *outer)
+{
+    char buf[NUMBER_BUF_SIZE];
+    JsonPath self;
+    JsonPath *pos;
+    CRB_Array *array;
+    MapEntry *entry;
+    int count;
+    int i;
+
+    switch (value->type) {
+    case CRB_BOOLEAN_VALUE:
+        crb_vstr_append_string(vstr, value->u.boolean_value ? "true" : "false");
+        break;
+    case CRB_INT_VALUE:
+        crb_vstr_append_chars(vstr, buf, crb_format_int(buf, value->u.int_value));
+        break;
+    case CRB_DOUBLE_VALUE:
+        stringify_double(vstr, value->u.double_value);
+        break;
+    case CRB_NULL_VALUE:
+        crb_vstr_append_string(vstr, "null");
+        break;
+    case CRB_STRING_VALUE:
+        stringify_string(vstr, crb_string_chars(value->u.object), value->u.object->u.string.length);
+        break;
+    case CRB_ARRAY_VALUE:
+    case CRB_MAP_VALUE:
+        for (pos = outer; pos; pos = pos->outer) {
+            if (pos->object == value->u.object) {
+                value_error(inter, "cyclic value");
+            }
+        }
+        self.object = value->u.object;
+        self.outer = outer;
+        if (CRB_ARRAY_VALUE == value->type) {
+            array = &value->u.object->u.array;
+            crb_vstr_append_character(vstr, '[');
+            for (i = 0; i < array->size; ++i) {
+                if (i > 0) {
+                    crb_vstr_append_character(vstr, ',');
+                }
+                stringify_value(inter, vstr, &array->array[i], &self);
+            }
+            crb_vstr_append_character(vstr, ']');
+            break;
+        }
+        crb_vstr_append_character(vstr, '{');
+        for (i = 0, count = 0; i < value->u.object->u.map.alloc_size; ++i) {
+            entry = &value->u.object->u.map.entries[i];
+            if (entry->state != MAP_ENTRY_USED) {
+                continue;
+            }
+            if (count++ > 0) {
+                crb_vstr_append_character(vstr, ',');
+            }
+            /* JSON的键只能是字符串 */
+            if (CRB_INT_VALUE == entry->key.type) {
+                crb_vstr_append_character(vstr, '"');
+                crb_vstr_append_chars(vstr, buf, crb_format_int(buf, entry->key.u.int_value));
+                crb_vstr_append_character(vstr, '"');
+            } else {
+                stringify_string(vstr, crb_string_chars(entry->key.u.object), entry->key.u.object->u.string.length);
+            }
+            crb_vstr_append_character(vstr, ':');
+            stringify_value(inter, vstr, &entry->value, &self);
+        }
+        crb_vstr_append_character(vstr, '}');
+        break;
+    case CRB_MATRIX_VALUE:
+        stringify_matrix(vstr, &value->u.object->u.matrix, 0, 0);
+        break;
+    case CRB_NATIVE_POINTER_VALUE:
+        value_error(inter, value->u.native_pointer.info->name);
+        break;
+    case CRB_GENERATOR_VALUE:
+        value_error(inter, "generator");
+        break;
+    default:
+        DBG_panic(("bad value type:%d\n", value->type));
+    }
+}
+
+/* json_stringify(value): 没有空白的紧凑格式 */
+CRB_Value crb_nv_json_stringify_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    VString *vstr;
+    jmp_buf recovery;
+    jmp_buf *outer_recovery;
+
+    if (arg_count != 1) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "json_stringify", MESSAGE_ARGUMENT_END);
+    }
+
+    /* 不能转换的值报错时释放已经输出的部分, 再继续往外跳 */
+    vstr = MEM_malloc(sizeof(VString));
+    crb_vstr_clear(vstr);
+    outer_recovery = inter->recovery;
+    if (setjmp(recovery)) {
+        inter->recovery = outer_recovery;
+        MEM_free(vstr->string);
+        MEM_free(vstr);
+        crb_abort(inter, inter->status);
+    }
+    inter->recovery = &recovery;
+    stringify_value(inter, vstr, &args[0], NULL);
+    inter->recovery = outer_recovery;
+
+    value.type = CRB_STRING_VALUE;
+    value.u.object = crb_create_crowbar_string_i(inter, vstr->string);
+    MEM_free(vstr);
+
+    return value;
+}
+
+/* vim: set tabstop=4 set shiftwidth=4 */
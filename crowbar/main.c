@@ -4,38 +4,123 @@
  * */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "CRB.h"
 #include "MEM.h"
 
+static void usage(char *name)
+{
+    fprintf(stderr, "usage:%s [-s] [-d] [-n steps] [-M heap_bytes] [-t msec] [-f socket entry] filename\n", name);
+    fprintf(stderr, "      %s -j N [-n steps] [-M heap_bytes] [-t msec] [-m manifest] [filename...]\n", name);
+    exit(1);
+}
+
+/*
+ * 选项可以任意组合, 全部读完之后再按模式执行:
+ * -s: 严格模式,编译时检查所有函数体
+ * -d: GC之后合并相同的字符串
+ * -n/-M/-t: 步数, 堆大小和执行时间限制(-j时是每个脚本的限制)
+ * -f socket entry: 执行完顶层代码后作为fork服务, 每个请求调用entry
+ * -j N: 用N个线程批量执行, 每个脚本的状态和耗时输出到stderr
+ * -m manifest: 批量执行的任务清单
+ * */
 int main(int argc , char* argv[])
 {
     CRB_Interpreter *interpreter;
     FILE *fp;
+    char *cache;
+    char *filename;
+    char *socket_path = NULL;
+    char *entry = NULL;
+    char *manifest = NULL;
+    int worker_count = 0;
+    int strict = 0;
+    int dedup = 0;
+    CRB_Limits limits;
+    CRB_Status status;
+    int i;
 
-    if (argc != 2) {
-        fprintf(stderr, "usage:%s filename", argv[0]);
-        exit(1);
+    limits.max_steps = 0;
+    limits.max_heap_size = 0;
+    limits.timeout_msec = 0;
+    for (i = 1; i < argc && '-' == argv[i][0]; ++i) {
+        if (!strcmp(argv[i], "-s")) {
+            strict = 1;
+        } else if (!strcmp(argv[i], "-d")) {
+            dedup = 1;
+        } else if (!strcmp(argv[i], "-f") && i + 2 < argc) {
+            socket_path = argv[++i];
+            entry = argv[++i];
+        } else if (i + 1 >= argc) {
+            usage(argv[0]);
+        } else if (!strcmp(argv[i], "-j")) {
+            worker_count = atoi(argv[++i]);
+            if (worker_count < 1) {
+                usage(argv[0]);
+            }
+        } else if (!strcmp(argv[i], "-m")) {
+            manifest = argv[++i];
+        } else if (!strcmp(argv[i], "-n")) {
+            limits.max_steps = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-M")) {
+            limits.max_heap_size = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-t")) {
+            limits.timeout_msec = atol(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
     }
 
-    fp = fopen(argv[1], "r");
+    /* 批量执行: 每个线程自己创建解释器, -s/-d/-f不适用 */
+    if (worker_count > 0) {
+        if (strict || dedup || socket_path || (NULL == manifest && i == argc)) {
+            usage(argv[0]);
+        }
+        return CRB_run_batch(worker_count, &limits, manifest, argc - i, argv + i, stderr);
+    }
+    if (manifest || i + 1 != argc) {
+        usage(argv[0]);
+    }
+    filename = argv[i];
+
+    fp = fopen(filename, "r");
     if (NULL == fp) {
-        fprintf(stderr, "%s not found", argv[1]);
+        fprintf(stderr, "%s not found", filename);
         exit(1);
     }
 
 
     /* 创建解释器 */
     interpreter = CRB_create_interpreter();
-    /* 编译 */
-    CRB_compile(interpreter, fp);
+    CRB_set_strict_mode(interpreter, strict);
+    CRB_set_string_dedup(interpreter, dedup);
+    CRB_set_limits(interpreter, &limits);
+    /* 编译, 缓存有效时直接加载(严格模式总是重新编译) */
+    cache = CRB_compiled_path(filename);
+    if (strict || !CRB_load_compiled(interpreter, cache, filename)) {
+        if (CRB_compile(interpreter, fp) != CRB_STATUS_OK) {
+            fprintf(stderr, "%s\n", CRB_get_error_message(interpreter));
+            exit(1);
+        }
+        CRB_save_compiled(interpreter, cache, filename);
+    }
+    MEM_free(cache);
+    fclose(fp);
     /* 解释 */
-    CRB_interpreter(interpreter);
+    status = CRB_interpreter(interpreter);
+    if (status != CRB_STATUS_OK) {
+        fprintf(stderr, "%s\n", CRB_get_error_message(interpreter));
+    }
+    /* 顶层代码出错时不提供服务, 限制对每个请求分别生效 */
+    if (socket_path && CRB_STATUS_OK == status) {
+        return CRB_serve_forked(interpreter, socket_path, entry);
+    }
     /* 释放解释器 */
     CRB_dispose_interpreter(interpreter);
 
     MEM_dump_blocks(stdout);
 
-    return 0;
+    return CRB_STATUS_OK == status ? 0 : 1;
 }
 /* vim: set tabstop=4 set shiftwidth=4 */
-
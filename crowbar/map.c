@@ -0,0 +1,181 @@
+/*
+ * File : map.c
+ * CreateDate : 2026-10-19 23:02:16
+ * */
+
+#include <stdio.h>
+#include <string.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+/*
+ * 散列表
+ *
+ *   m = {"apple": 3, 10: "ten"};
+ *   m["pear"] = 5;         # 没有的键赋值时插入
+ *   v = m["none"];         # 没有的键取值是null
+ *   m.contains("apple"); m.remove(10); m.keys(); m.values(); m.size();
+ * 开放寻址, 线性探测, 元素加墓碑超过3/4时扩展(或者只清理墓碑).
+ * 字符串"1"和整数1是不同的键. keys()/values()的顺序是表里的顺序, 不是插入顺序.
+ * */
+
+/* FNV-1a, 键可能是视图, 按长度算 */
+unsigned int crb_hash_string(char *str, int length)
+{
+    unsigned int hash = 2166136261U;
+    int i;
+
+    for (i = 0; i < length; ++i) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+static unsigned int hash_key(CRB_Interpreter *inter, CRB_Value *key, int line_number)
+{
+    if (CRB_STRING_VALUE == key->type) {
+        return crb_hash_string(crb_string_chars(key->u.object), key->u.object->u.string.length);
+    } else if (CRB_INT_VALUE == key->type) {
+        /* 连续的整数也要分散开 */
+        return (unsigned int)key->u.int_value * 2654435761U;
+    }
+
+    crb_runtime_error(inter, line_number, MAP_KEY_TYPE_ERR, MESSAGE_ARGUMENT_END);
+    return 0;
+}
+
+static CRB_Boolean equal_key(MapEntry *entry, unsigned int hash, CRB_Value *key)
+{
+    if (entry->hash != hash || entry->key.type != key->type) {
+        return CRB_FALSE;
+    }
+    if (CRB_INT_VALUE == key->type) {
+        return entry->key.u.int_value == key->u.int_value;
+    }
+
+    return entry->key.u.object == key->u.object
+        || 0 == crb_string_compare(entry->key.u.object, key->u.object);
+}
+
+/* 没有时返回-1 */
+static int search_entry(CRB_Map *map, unsigned int hash, CRB_Value *key)
+{
+    unsigned int mask = map->alloc_size - 1;
+    unsigned int pos;
+
+    for (pos = hash & mask; map->entries[pos].state != MAP_ENTRY_EMPTY; pos = (pos + 1) & mask) {
+        if (MAP_ENTRY_USED == map->entries[pos].state && equal_key(&map->entries[pos], hash, key)) {
+            return pos;
+        }
+    }
+
+    return -1;
+}
+
+/* 没有时返回NULL */
+CRB_Value* crb_map_search(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *key, int line_number)
+{
+    unsigned int hash;
+    int pos;
+
+    hash = hash_key(inter, key, line_number);
+    pos = search_entry(&obj->u.map, hash, key);
+    if (pos < 0) {
+        return NULL;
+    }
+
+    return &obj->u.map.entries[pos].value;
+}
+
+/* 没有时插入一个null, 扩展时可能GC, key要在调用者那边可以被mark到 */
+CRB_Value* crb_map_lvalue(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *key, int line_number)
+{
+    CRB_Map *map = &obj->u.map;
+    MapEntry *entry;
+    unsigned int hash;
+    unsigned int mask;
+    unsigned int pos;
+    int found;
+
+    hash = hash_key(inter, key, line_number);
+    found = search_entry(map, hash, key);
+    if (found >= 0) {
+        return &map->entries[found].value;
+    }
+
+    /* 视图的键拷贝出来, 不让一小段键把整个父字符串留在内存里 */
+    if (CRB_STRING_VALUE == key->type) {
+        crb_c_string(inter, key->u.object);
+    }
+    if ((map->used + 1) * 4 > map->alloc_size * 3) {
+        crb_map_rehash(inter, obj, (map->size + 1) * 2 > map->alloc_size ? map->alloc_size * 2 : map->alloc_size);
+    }
+
+    /* 确认没有之后, 第一个空位或墓碑就是插入的位置 */
+    mask = map->alloc_size - 1;
+    for (pos = hash & mask; MAP_ENTRY_USED == map->entries[pos].state; pos = (pos + 1) & mask) {
+        ;
+    }
+    entry = &map->entries[pos];
+    if (MAP_ENTRY_EMPTY == entry->state) {
+        map->used++;
+    }
+    entry->state = MAP_ENTRY_USED;
+    entry->hash = hash;
+    entry->key = *key;
+    entry->value.type = CRB_NULL_VALUE;
+    map->size++;
+
+    return &entry->value;
+}
+
+CRB_Boolean crb_map_remove(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *key, int line_number)
+{
+    unsigned int hash;
+    int pos;
+
+    hash = hash_key(inter, key, line_number);
+    pos = search_entry(&obj->u.map, hash, key);
+    if (pos < 0) {
+        return CRB_FALSE;
+    }
+
+    obj->u.map.entries[pos].state = MAP_ENTRY_REMOVED;
+    obj->u.map.size--;
+
+    return CRB_TRUE;
+}
+
+/* 创建数组时可能GC, obj要在调用者那边可以被mark到 */
+static CRB_Object* map_to_array(CRB_Interpreter *inter, CRB_Object *obj, CRB_Boolean keys)
+{
+    CRB_Object *array;
+    MapEntry *entry;
+    int i;
+    int j;
+
+    array = crb_create_array_i(inter, obj->u.map.size);
+    for (i = 0, j = 0; i < obj->u.map.alloc_size; ++i) {
+        entry = &obj->u.map.entries[i];
+        if (MAP_ENTRY_USED == entry->state) {
+            array->u.array.array[j++] = keys ? entry->key : entry->value;
+        }
+    }
+
+    return array;
+}
+
+CRB_Object* crb_map_keys(CRB_Interpreter *inter, CRB_Object *obj)
+{
+    return map_to_array(inter, obj, CRB_TRUE);
+}
+
+CRB_Object* crb_map_values(CRB_Interpreter *inter, CRB_Object *obj)
+{
+    return map_to_array(inter, obj, CRB_FALSE);
+}
+
+/* vim: set tabstop=4 set shiftwidth=4 */
@@ -0,0 +1,561 @@
+/*
+ * File : matrix.c
+ * CreateDate : 2026-10-19 23:48:05
+ * */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+/*
+ * 矩阵
+ *
+ *   m = new_matrix(1000, 1000);    # 实数, 全是0
+ *   g = new_int_matrix(9, 9);      # 整数
+ *   m[i][j] = 1.5;                 # 整条下标链只定位一次, 不取出中间的行
+ *   row = m[i];                    # 下标没给全时是共享数据的视图
+ *   m.size(); m.shape(); m.transpose(); m.matmul(b);
+ *   m.sum(axis); m.min(axis); m.max(axis);   # 沿axis归约, 一维时得到数值
+ *
+ * new_array(9, 9)是一行一个数组, 每次a[i][j]要找两次对象;
+ * 矩阵的数据是一整块连续内存, 乘法和转置按块做, 大矩阵也不会反复换出缓存.
+ *
+ *   a = map_array("dump.bin", "double", "r");              # 整个文件
+ *   a = map_array("dump.bin", "int", "rw", start, count);  # 从第start个元素开始的一段
+ *
+ * 把二进制文件(本机字节序的int或double)映射成一维矩阵, 数据由内核按页换入换出,
+ * 不算在堆里, GC也不扫描, 回收时munmap. "rw"时的修改直接写回文件.
+ * 下标是int, 超过INT_MAX个元素的文件要用start和count分段映射, start可以是实数.
+ * */
+
+/* 按块处理时块的边长, 三块一起放得进L2 */
+#define MATRIX_BLOCK_SIZE (64)
+
+static void shape_error(CRB_Interpreter *inter, int line_number, char *name)
+{
+    crb_runtime_error(inter, line_number, MATRIX_SHAPE_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+}
+
+/* 偏移和步长都是int, 元素个数超过INT_MAX的形状不能创建. 先除再比较, 乘积不会溢出 */
+static CRB_Boolean shape_overflows(int dimension, int *shape)
+{
+    int count = 1;
+    int i;
+
+    for (i = 0; i < dimension; ++i) {
+        if (0 == shape[i]) {
+            return CRB_FALSE;
+        }
+    }
+    for (i = 0; i < dimension; ++i) {
+        if (count > INT_MAX / shape[i]) {
+            return CRB_TRUE;
+        }
+        count *= shape[i];
+    }
+
+    return CRB_FALSE;
+}
+
+static CRB_Value new_matrix(CRB_Interpreter *inter, char *name, CRB_Boolean is_int, int arg_count, CRB_Value *args)
+{
+    CRB_Value ret;
+    int shape[MATRIX_MAX_DIMENSION];
+    int i;
+
+    if (arg_count < 1 || arg_count > MATRIX_MAX_DIMENSION) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+    }
+    for (i = 0; i < arg_count; ++i) {
+        if (args[i].type != CRB_INT_VALUE || args[i].u.int_value < 0) {
+            crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+        }
+        shape[i] = args[i].u.int_value;
+    }
+    if (shape_overflows(arg_count, shape)) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+    }
+
+    ret.type = CRB_MATRIX_VALUE;
+    ret.u.object = crb_create_matrix_i(inter, is_int, arg_count, shape);
+
+    return ret;
+}
+
+/* new_matrix(长度...) */
+CRB_Value crb_nv_new_matrix_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    return new_matrix(inter, "new_matrix", CRB_FALSE, arg_count, args);
+}
+
+/* new_int_matrix(长度...) */
+CRB_Value crb_nv_new_int_matrix_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    return new_matrix(inter, "new_int_matrix", CRB_TRUE, arg_count, args);
+}
+
+/* 映射的int文件按int读, 其他都是double */
+double crb_matrix_element(CRB_Matrix *matrix, int offset)
+{
+    if (matrix->int_data) {
+        return matrix->int_data[offset];
+    }
+    return matrix->data[offset];
+}
+
+static double get_position(CRB_Interpreter *inter, CRB_Value *value)
+{
+    double position;
+
+    if (CRB_INT_VALUE == value->type) {
+        position = value->u.int_value;
+    } else if (CRB_DOUBLE_VALUE == value->type) {
+        position = value->u.double_value;
+    } else {
+        position = -1.0;
+    }
+    /* 实数要是2^53以内的整数 */
+    if (position < 0.0 || position > 9007199254740992.0 || position != (double)(off_t)position) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "map_array", MESSAGE_ARGUMENT_END);
+    }
+
+    return position;
+}
+
+static void map_file_error(CRB_Interpreter *inter, char *path, int fd)
+{
+    char *message = strerror(errno);
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    crb_runtime_error(inter, inter->native_line_number, MAP_FILE_ERR, STRING_MESSAGE_ARGUMENT, "name", path,
+            STRING_MESSAGE_ARGUMENT, "message", message, MESSAGE_ARGUMENT_END);
+}
+
+/* map_array(路径, "int"或"double", "r"或"rw" [, 开始的元素, 元素个数]) */
+CRB_Value crb_nv_map_array_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value ret;
+    CRB_Matrix *matrix;
+    CRB_Boolean is_int;
+    CRB_Boolean read_only;
+    struct stat st;
+    char *path;
+    char *type;
+    char *mode;
+    char *address;
+    size_t element_size;
+    off_t start;
+    off_t count;
+    off_t offset;
+    long page_size;
+    int fd;
+
+    if ((arg_count != 3 && arg_count != 5)
+            || args[0].type != CRB_STRING_VALUE || args[1].type != CRB_STRING_VALUE || args[2].type != CRB_STRING_VALUE) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "map_array", MESSAGE_ARGUMENT_END);
+    }
+    path = crb_c_string(inter, args[0].u.object);
+    type = crb_c_string(inter, args[1].u.object);
+    mode = crb_c_string(inter, args[2].u.object);
+    is_int = !strcmp(type, "int");
+    element_size = is_int ? sizeof(int) : sizeof(double);
+    read_only = !strcmp(mode, "r");
+    if ((!is_int && strcmp(type, "double")) || (!read_only && strcmp(mode, "rw"))) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "map_array", MESSAGE_ARGUMENT_END);
+    }
+
+    /* 先创建对象, 映射之后就不会再因为GC或者堆大小限制跳出去了 */
+    ret.type = CRB_MATRIX_VALUE;
+    ret.u.object = crb_create_mapped_matrix_i(inter, is_int, read_only);
+    matrix = &ret.u.object->u.matrix;
+
+    fd = open(path, read_only ? O_RDONLY : O_RDWR);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        map_file_error(inter, path, fd);
+    }
+    if (5 == arg_count) {
+        start = (off_t)get_position(inter, &args[3]);
+        count = (off_t)get_position(inter, &args[4]);
+        if ((start + count) * (off_t)element_size > st.st_size) {
+            close(fd);
+            crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "map_array", MESSAGE_ARGUMENT_END);
+        }
+    } else {
+        start = 0;
+        count = st.st_size / (off_t)element_size;
+    }
+    if (count > INT_MAX) {
+        close(fd);
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "map_array", MESSAGE_ARGUMENT_END);
+    }
+    if (0 == count) {
+        close(fd);
+        return ret;
+    }
+
+    /* mmap的偏移要按页对齐, 多映射的部分留在开头 */
+    page_size = sysconf(_SC_PAGESIZE);
+    offset = start * (off_t)element_size;
+    matrix->mapped_size = (size_t)(offset % page_size + count * (off_t)element_size);
+    address = mmap(NULL, matrix->mapped_size, read_only ? PROT_READ : PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, offset - offset % page_size);
+    if (MAP_FAILED == address) {
+        map_file_error(inter, path, fd);
+    }
+    close(fd);
+
+    matrix->mapped = address;
+    address += offset % page_size;
+    if (is_int) {
+        matrix->int_data = (int*)address;
+    } else {
+        matrix->data = (double*)address;
+    }
+    matrix->shape[0] = (int)count;
+
+    return ret;
+}
+
+void crb_unmap_matrix(CRB_Matrix *matrix)
+{
+    munmap(matrix->mapped, matrix->mapped_size);
+    matrix->mapped = NULL;
+}
+
+/* 下标链的最左边求值之后调用, 不是矩阵时什么也不做 */
+void crb_matrix_index_start(CRB_Value *value, MatrixIndex *index)
+{
+    if (CRB_MATRIX_VALUE == value->type) {
+        index->matrix = value->u.object;
+        index->depth = 0;
+        index->offset = 0;
+    } else {
+        index->matrix = NULL;
+    }
+}
+
+void crb_matrix_index_add(CRB_Interpreter *inter, MatrixIndex *index, CRB_Value *subscript, int line_number)
+{
+    CRB_Matrix *matrix = &index->matrix->u.matrix;
+
+    DBG_assert(index->depth < matrix->dimension, ("depth:%d\n", index->depth));
+    if (subscript->type != CRB_INT_VALUE) {
+        crb_runtime_error(inter, line_number, INDEX_OPERAND_NOT_INT_ERR, MESSAGE_ARGUMENT_END);
+    }
+    if (subscript->u.int_value < 0 || subscript->u.int_value >= matrix->shape[index->depth]) {
+        crb_runtime_error(inter, line_number, ARRAY_INDEX_OUT_OF_BOUNDS_ERR, INT_MESSAGE_ARGUMENT, "size", matrix->shape[index->depth],
+                INT_MESSAGE_ARGUMENT, "index", subscript->u.int_value, MESSAGE_ARGUMENT_END);
+    }
+
+    index->offset += subscript->u.int_value * matrix->stride[index->depth];
+    index->depth++;
+}
+
+/* 取出到index->value, 下标没给全时创建视图, 可能GC */
+void crb_matrix_load(CRB_Interpreter *inter, MatrixIndex *index)
+{
+    CRB_Matrix *matrix = &index->matrix->u.matrix;
+    double element;
+
+    if (index->depth < matrix->dimension) {
+        index->value.type = CRB_MATRIX_VALUE;
+        index->value.u.object = crb_create_matrix_view_i(inter, index->matrix, index->depth, index->offset);
+        return;
+    }
+
+    element = crb_matrix_element(matrix, index->offset);
+    if (matrix->is_int) {
+        index->value.type = CRB_INT_VALUE;
+        index->value.u.int_value = (int)element;
+    } else {
+        index->value.type = CRB_DOUBLE_VALUE;
+        index->value.u.double_value = element;
+    }
+}
+
+/* 把index->value写回去. 整数矩阵里放实数时截断 */
+void crb_matrix_store(CRB_Interpreter *inter, MatrixIndex *index, int line_number)
+{
+    CRB_Matrix *matrix = &index->matrix->u.matrix;
+    double element;
+
+    if (index->depth < matrix->dimension) {
+        shape_error(inter, line_number, "赋值");
+    }
+    if (matrix->read_only) {
+        crb_runtime_error(inter, line_number, MATRIX_READ_ONLY_ERR, MESSAGE_ARGUMENT_END);
+    }
+
+    if (CRB_INT_VALUE == index->value.type) {
+        element = index->value.u.int_value;
+    } else if (CRB_DOUBLE_VALUE == index->value.type) {
+        element = matrix->is_int ? (double)(int)index->value.u.double_value : index->value.u.double_value;
+    } else {
+        crb_runtime_error(inter, line_number, MATRIX_ELEMENT_TYPE_ERR, MESSAGE_ARGUMENT_END);
+        return;
+    }
+    if (matrix->int_data) {
+        matrix->int_data[index->offset] = (int)element;
+    } else {
+        matrix->data[index->offset] = element;
+    }
+}
+
+/* 创建数组时可能GC, obj要在调用者那边可以被mark到 */
+CRB_Object* crb_matrix_shape(CRB_Interpreter *inter, CRB_Object *obj)
+{
+    CRB_Object *array;
+    int i;
+
+    array = crb_create_array_i(inter, obj->u.matrix.dimension);
+    for (i = 0; i < obj->u.matrix.dimension; ++i) {
+        array->u.array.array[i].type = CRB_INT_VALUE;
+        array->u.array.array[i].u.int_value = obj->u.matrix.shape[i];
+    }
+
+    return array;
+}
+
+/* 按块转置, 读和写都在块里, 不会每个元素都跨一整行 */
+CRB_Object* crb_matrix_transpose(CRB_Interpreter *inter, CRB_Object *obj, int line_number)
+{
+    CRB_Object *ret;
+    CRB_Matrix *src = &obj->u.matrix;
+    double *from;
+    double *to;
+    int shape[2];
+    int rows;
+    int cols;
+    int i, j, ii, jj, i_end, j_end;
+
+    if (src->dimension != 2) {
+        shape_error(inter, line_number, "transpose");
+    }
+    rows = src->shape[0];
+    cols = src->shape[1];
+    shape[0] = cols;
+    shape[1] = rows;
+    ret = crb_create_matrix_i(inter, src->is_int, 2, shape);
+
+    from = src->data;
+    to = ret->u.matrix.data;
+    for (ii = 0; ii < rows; ii += MATRIX_BLOCK_SIZE) {
+        i_end = (ii + MATRIX_BLOCK_SIZE < rows) ? ii + MATRIX_BLOCK_SIZE : rows;
+        for (jj = 0; jj < cols; jj += MATRIX_BLOCK_SIZE) {
+            j_end = (jj + MATRIX_BLOCK_SIZE < cols) ? jj + MATRIX_BLOCK_SIZE : cols;
+            for (i = ii; i < i_end; ++i) {
+                for (j = jj; j < j_end; ++j) {
+                    to[j * rows + i] = from[i * cols + j];
+                }
+            }
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * c = a * b, 按块做, 最里层是i-k-j顺序:
+ * a的一个元素乘b的一行加到c的一行上, 三个都是连续访问.
+ * */
+static void matmul_kernel(double *a, double *b, double *c, int n, int m, int p)
+{
+    int i, j, k, ii, jj, kk, i_end, j_end, k_end;
+    double a_ik;
+    double *b_row;
+    double *c_row;
+
+    for (ii = 0; ii < n; ii += MATRIX_BLOCK_SIZE) {
+        i_end = (ii + MATRIX_BLOCK_SIZE < n) ? ii + MATRIX_BLOCK_SIZE : n;
+        for (kk = 0; kk < m; kk += MATRIX_BLOCK_SIZE) {
+            k_end = (kk + MATRIX_BLOCK_SIZE < m) ? kk + MATRIX_BLOCK_SIZE : m;
+            for (jj = 0; jj < p; jj += MATRIX_BLOCK_SIZE) {
+                j_end = (jj + MATRIX_BLOCK_SIZE < p) ? jj + MATRIX_BLOCK_SIZE : p;
+                for (i = ii; i < i_end; ++i) {
+                    c_row = c + i * p;
+                    for (k = kk; k < k_end; ++k) {
+                        a_ik = a[i * m + k];
+                        b_row = b + k * p;
+                        for (j = jj; j < j_end; ++j) {
+                            c_row[j] += a_ik * b_row[j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* 两个都是整数矩阵时结果也是整数矩阵. left和right要在调用者那边可以被mark到 */
+CRB_Object* crb_matrix_matmul(CRB_Interpreter *inter, CRB_Object *left, CRB_Object *right, int line_number)
+{
+    CRB_Object *ret;
+    CRB_Matrix *a = &left->u.matrix;
+    CRB_Matrix *b = &right->u.matrix;
+    int shape[2];
+
+    if (a->dimension != 2 || b->dimension != 2 || a->shape[1] != b->shape[0]) {
+        shape_error(inter, line_number, "matmul");
+    }
+    shape[0] = a->shape[0];
+    shape[1] = b->shape[1];
+    if (shape_overflows(2, shape)) {
+        shape_error(inter, line_number, "matmul");
+    }
+    ret = crb_create_matrix_i(inter, a->is_int && b->is_int, 2, shape);
+    matmul_kernel(a->data, b->data, ret->u.matrix.data, a->shape[0], a->shape[1], b->shape[1]);
+
+    return ret;
+}
+
+typedef enum {
+    REDUCE_SUM,
+    REDUCE_MIN,
+    REDUCE_MAX
+} ReduceOperator;
+
+static double reduce_ints(int *data, int size, ReduceOperator operator)
+{
+    double result;
+    int i;
+
+    if (0 == size) {
+        return 0.0;
+    }
+    result = data[0];
+    for (i = 1; i < size; ++i) {
+        if (REDUCE_SUM == operator) {
+            result += data[i];
+        } else if ((REDUCE_MIN == operator) ? data[i] < result : data[i] > result) {
+            result = data[i];
+        }
+    }
+
+    return result;
+}
+
+/*
+ * 沿axis归约, 结果少一维. 把矩阵看成outer x n x inner,
+ * 每个outer块里按行把n个inner长的切片合到一起, 不管哪个axis都是顺序读.
+ * 一维矩阵归约成一个数值. obj要在调用者那边可以被mark到
+ * */
+CRB_Value crb_matrix_reduce(CRB_Interpreter *inter, CRB_Object *obj, char *name, CRB_Value *axis_value, int line_number)
+{
+    CRB_Value ret;
+    CRB_Object *result;
+    CRB_Matrix *matrix = &obj->u.matrix;
+    ReduceOperator operator;
+    int shape[MATRIX_MAX_DIMENSION];
+    double *src;
+    double *dest;
+    double *slice;
+    double scalar;
+    int axis;
+    int outer;
+    int n;
+    int inner;
+    int o, k, j;
+
+    if (!strcmp(name, "sum")) {
+        operator = REDUCE_SUM;
+    } else if (!strcmp(name, "min")) {
+        operator = REDUCE_MIN;
+    } else {
+        DBG_assert(!strcmp(name, "max"), ("name:%s\n", name));
+        operator = REDUCE_MAX;
+    }
+    if (axis_value->type != CRB_INT_VALUE
+            || axis_value->u.int_value < 0 || axis_value->u.int_value >= matrix->dimension) {
+        crb_runtime_error(inter, line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+    }
+    axis = axis_value->u.int_value;
+    n = matrix->shape[axis];
+    if (0 == n && operator != REDUCE_SUM) {
+        shape_error(inter, line_number, name);
+    }
+
+    for (outer = 1, k = 0; k < axis; ++k) {
+        outer *= matrix->shape[k];
+    }
+    inner = matrix->stride[axis];
+    if (1 == matrix->dimension) {
+        result = NULL;
+        dest = &scalar;
+    } else {
+        memcpy(shape, matrix->shape, sizeof(int) * axis);
+        memcpy(shape + axis, matrix->shape + axis + 1, sizeof(int) * (matrix->dimension - axis - 1));
+        result = crb_create_matrix_i(inter, matrix->is_int, matrix->dimension - 1, shape);
+        dest = result->u.matrix.data;
+    }
+
+    if (matrix->int_data) {
+        /* 映射的int文件只有一维 */
+        scalar = reduce_ints(matrix->int_data, n, operator);
+    } else {
+        src = matrix->data;
+        for (o = 0; o < outer; ++o, dest += inner, src += n * inner) {
+            if (0 == n) {
+                for (j = 0; j < inner; ++j) {
+                    dest[j] = 0.0;
+                }
+                continue;
+            }
+            memcpy(dest, src, sizeof(double) * inner);
+            for (k = 1; k < n; ++k) {
+                slice = src + k * inner;
+                switch (operator) {
+                case REDUCE_SUM:
+                    for (j = 0; j < inner; ++j) {
+                        dest[j] += slice[j];
+                    }
+                    break;
+                case REDUCE_MIN:
+                    for (j = 0; j < inner; ++j) {
+                        if (slice[j] < dest[j]) {
+                            dest[j] = slice[j];
+                        }
+                    }
+                    break;
+                case REDUCE_MAX:
+                    for (j = 0; j < inner; ++j) {
+                        if (slice[j] > dest[j]) {
+                            dest[j] = slice[j];
+                        }
+                    }
+                    break;
+                default:
+                    DBG_panic(("bad operator:%d\n", operator));
+                }
+            }
+        }
+    }
+
+    if (result) {
+        ret.type = CRB_MATRIX_VALUE;
+        ret.u.object = result;
+    } else if (matrix->is_int && scalar >= INT_MIN && scalar <= INT_MAX) {
+        ret.type = CRB_INT_VALUE;
+        ret.u.int_value = (int)scalar;
+    } else {
+        /* 整数的和超出int时也返回实数 */
+        ret.type = CRB_DOUBLE_VALUE;
+        ret.u.double_value = scalar;
+    }
+
+    return ret;
+}
+
+/* vim: set tabstop=4 set shiftwidth=4 */
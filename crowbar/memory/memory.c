@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 static void default_error_handler(MEM_Controller controller, char *filename, int line, char *msg);
 
@@ -19,6 +20,9 @@ MEM_Controller mem_default_controller = &st_default_controller;
 
 #ifdef DEBUG
 
+/* 所有线程的内存块都挂在controller的同一个链表上 */
+static pthread_mutex_t st_block_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 void check_mark_sub(unsigned char *mark, int size)
 {
     int i;
@@ -60,19 +64,7 @@ void check_mark(Header *header)
     check_mark_sub(tail, MARK_SIZE);
 }
 
-static void rechain_block(MEM_Controller controller, Header *header)
-{
-    if (header->s.prev) {
-        header->s.prev->s.next = header;
-    } else {
-        controller->block_header = header;
-    }
-
-    if (header->s.next) {
-        header->s.next->s.prev = header;
-    }
-}
-
+/* 调用者持有st_block_mutex */
 static void unchain_block(MEM_Controller controller, Header *header)
 {
     if (header->s.prev) {
@@ -95,12 +87,14 @@ void MEM_dump_blocks_func(MEM_Controller controller, FILE *fp)
     Header *pos;
     int counter = 0;
 
+    pthread_mutex_lock(&st_block_mutex);
     for (pos = controller->block_header; pos; pos = pos->s.next) {
         check_mark(pos);
         fprintf(fp, "[%04d]%p***************\n", counter, (char*)pos + sizeof(Header));
         fprintf(fp, "%s line %d size...%d\n", pos->s.filename, pos->s.line, pos->s.size);
         counter++;
     }
+    pthread_mutex_unlock(&st_block_mutex);
 #endif
 }
 
@@ -141,12 +135,14 @@ void set_tail(void *ptr, int alloc_size)
 
 static void chain_block(MEM_Controller controller, Header *new_header)
 {
+    pthread_mutex_lock(&st_block_mutex);
     if (controller->block_header) {
         controller->block_header->s.prev = new_header;
     }
     new_header->s.prev = NULL;
     new_header->s.next = controller->block_header;
     controller->block_header = new_header;
+    pthread_mutex_unlock(&st_block_mutex);
 }
 
 #endif
@@ -194,12 +190,14 @@ void MEM_free_func(MEM_Controller controller, void *ptr)
 #ifdef DEBUG
     real_ptr = (char *)ptr - sizeof(Header);
     header = (Header*) real_ptr;
+    pthread_mutex_lock(&st_block_mutex);
     tail = ((unsigned char *)header) + header->s.size + sizeof(Header);
     fprintf(stderr, "MEM_free_func pre:%p real_ptr:%p\n", ptr, real_ptr);
     fprintf(stderr,  "Header[size:%d,filename:%s,line:%d prev:%p next:%p mark:%p {%x,%x,%x,%x} tail:%p {%x,%x,%x,%x}]\n", header->s.size, header->s.filename, header->s.line, header->s.prev, header->s.next,header->s.mark, header->s.mark[0], header->s.mark[1], header->s.mark[2], header->s.mark[3], tail, tail[0],tail[1], tail[2], tail[2]);  
     check_mark((Header*)real_ptr);
     size = ((Header*)real_ptr)->s.size;
     unchain_block(controller, real_ptr);
+    pthread_mutex_unlock(&st_block_mutex);
     memset(real_ptr, NULL_VALUE, size + sizeof(Header));
 #else
     real_ptr = ptr;
@@ -222,10 +220,12 @@ void* MEM_realloc_func(MEM_Controller controller, char *fn, int line, void *ptr,
 
     if (NULL != ptr) {
         real_ptr = (char *)ptr - sizeof(Header);
+        pthread_mutex_lock(&st_block_mutex);
         check_mark((Header*)real_ptr);
         old_header = *((Header*)real_ptr);
         old_size = old_header.s.size;
         unchain_block(controller, real_ptr);
+        pthread_mutex_unlock(&st_block_mutex);
     } else {
         real_ptr = NULL;
         old_size = 0;
@@ -249,7 +249,8 @@ void* MEM_realloc_func(MEM_Controller controller, char *fn, int line, void *ptr,
     if (ptr) {
         *((Header*)new_ptr) = old_header;
         ((Header*)new_ptr)->s.size = size;
-        rechain_block(controller, (Header*)new_ptr);
+        /* 原来的前后块可能已经被别的线程释放了, 重新挂到表头 */
+        chain_block(controller, (Header*)new_ptr);
         set_tail(new_ptr, alloc_size);
     } else {
         set_header(new_ptr, size, fn, line);
@@ -3,9 +3,14 @@
  * CreateDate : 2019-11-26 09:17:46
  * */
 
+#define _POSIX_C_SOURCE 200112L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #include "MEM.h"
 #include "DBG.h"
 #include "CRB_dev.h"
@@ -17,25 +22,107 @@ static CRB_NativePointerInfo st_native_lib_info = {
     NATIVE_LIB_NAME
 };
 
-static void check_argument_count(int arg_count, int true_count)
+static void check_argument_count(CRB_Interpreter *inter, int arg_count, int true_count)
 {
-    if (arg_count < 1) {
-        crb_runtime_error(0, ARGUMENT_TOO_FEW_ERR, MESSAGE_ARGUMENT_END);
-    } else if (arg_count > 1) {
-        crb_runtime_error(0, ARGUMENT_TOO_MANY_ERR, MESSAGE_ARGUMENT_END);
+    if (arg_count < true_count) {
+        crb_runtime_error(inter, inter->native_line_number, ARGUMENT_TOO_FEW_ERR, MESSAGE_ARGUMENT_END);
+    } else if (arg_count > true_count) {
+        crb_runtime_error(inter, inter->native_line_number, ARGUMENT_TOO_MANY_ERR, MESSAGE_ARGUMENT_END);
+    }
+}
+
+/*
+ * 输出缓冲
+ *
+ * print和fputs把值直接格式化到fp的缓冲区里, 满了才整块写出去.
+ * flush()/fclose/执行结束/出错时写出剩下的. 终端和stderr不缓冲, 和以前一样马上能看到.
+ * */
+static OutputBuffer *search_output(CRB_Interpreter *inter, FILE *fp, OutputBuffer ***prev)
+{
+    OutputBuffer **pos;
+
+    for (pos = &inter->output_list; *pos; pos = &(*pos)->next) {
+        if ((*pos)->buffer.fp == fp) {
+            if (prev) {
+                *prev = pos;
+            }
+            return *pos;
+        }
+    }
+
+    return NULL;
+}
+
+static OutputBuffer *get_output(CRB_Interpreter *inter, FILE *fp)
+{
+    OutputBuffer *out;
+
+    out = search_output(inter, fp, NULL);
+    if (out) {
+        return out;
+    }
+    out = MEM_malloc(sizeof(OutputBuffer));
+    crb_vstr_open_file(&out->buffer, fp);
+    out->write_through = (fp == stderr || isatty(fileno(fp))) ? CRB_TRUE : CRB_FALSE;
+    out->next = inter->output_list;
+    inter->output_list = out;
+
+    return out;
+}
+
+static void flush_output(OutputBuffer *out)
+{
+    crb_vstr_flush(&out->buffer);
+    fflush(out->buffer.fp);
+}
+
+static void written(OutputBuffer *out)
+{
+    if (out->write_through) {
+        flush_output(out);
+    }
+}
+
+/* fp是NULL时写出所有的缓冲 */
+void crb_flush_output(CRB_Interpreter *inter, FILE *fp)
+{
+    OutputBuffer *out;
+
+    for (out = inter->output_list; out; out = out->next) {
+        if (NULL == fp || out->buffer.fp == fp) {
+            flush_output(out);
+        }
+    }
+}
+
+static void dispose_output(OutputBuffer *out)
+{
+    flush_output(out);
+    MEM_free(out->buffer.string);
+    MEM_free(out);
+}
+
+void crb_dispose_output(CRB_Interpreter *inter)
+{
+    OutputBuffer *out;
+
+    while (inter->output_list) {
+        out = inter->output_list;
+        inter->output_list = out->next;
+        dispose_output(out);
     }
 }
 
 CRB_Value crb_nv_print_proc(CRB_Interpreter *interpreter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
 {
     CRB_Value value;
-    char *str;
+    OutputBuffer *out;
     value.type = CRB_NULL_VALUE;
 
-    check_argument_count(arg_count, 1);
-    str = CRB_value_to_string(&args[0]);
-    printf("%s", str);
-    MEM_free(str);
+    check_argument_count(interpreter, arg_count, 1);
+    out = get_output(interpreter, stdout);
+    crb_vstr_append_value(&out->buffer, &args[0]);
+    written(out);
 
     return value;
 }
@@ -44,14 +131,14 @@ CRB_Value crb_nv_fopen_proc(CRB_Interpreter *interpreter, CRB_LocalEnvironment *
 {
     CRB_Value value;
     FILE *fp;
-    check_argument_count(arg_count, 2);
+    check_argument_count(interpreter, arg_count, 2);
 
     if (args[0].type != CRB_STRING_VALUE ||
             args[1].type != CRB_STRING_VALUE) {
-        crb_runtime_error(0, FOPEN_ARGUMENT_TYPE_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(interpreter, interpreter->native_line_number, FOPEN_ARGUMENT_TYPE_ERR, MESSAGE_ARGUMENT_END);
     }
 
-    fp = fopen(args[0].u.object->u.string.string, args[1].u.object->u.string.string);
+    fp = fopen(crb_c_string(interpreter, args[0].u.object), crb_c_string(interpreter, args[1].u.object));
     if (NULL == fp) {
         value.type = CRB_NULL_VALUE;
     } else {
@@ -68,19 +155,181 @@ static CRB_Boolean check_native_pointer(CRB_Value *value)
     return value->u.native_pointer.info == &st_native_lib_info;
 }
 
+/*
+ * 输入缓冲
+ *
+ *   line = fgets(fp);          # 带"\n"的一行, 读完了是null
+ *   text = read_all(fp);       # 剩下的全部
+ *   lines = read_lines(fp);    # 剩下的按行切开(不带"\n"), 每行都是text的视图
+ *   chunk = read(fp, 4096);    # 最多4096个字符, 读完了是null
+ *
+ * 一次预读READ_BUF_SIZE, 在缓冲区里用memchr找换行, 一行只分配一次.
+ * 行比缓冲区长时缓冲区翻倍, 不会一段一段拼接.
+ * */
+static InputBuffer *get_input(CRB_Interpreter *inter, FILE *fp)
+{
+    InputBuffer *in;
+    struct stat st;
+
+    for (in = inter->input_list; in; in = in->next) {
+        if (in->fp == fp) {
+            return in;
+        }
+    }
+    in = MEM_malloc(sizeof(InputBuffer));
+    in->fp = fp;
+    in->buffer = NULL;
+    in->start = 0;
+    in->end = 0;
+    in->alloc_size = 0;
+    in->regular = (0 == fstat(fileno(fp), &st) && S_ISREG(st.st_mode)) ? CRB_TRUE : CRB_FALSE;
+    in->next = inter->input_list;
+    inter->input_list = in;
+
+    return in;
+}
+
+void crb_dispose_file_input(CRB_Interpreter *inter, FILE *fp)
+{
+    InputBuffer **pos;
+    InputBuffer *in;
+
+    for (pos = &inter->input_list; *pos; pos = &(*pos)->next) {
+        if ((*pos)->fp == fp) {
+            in = *pos;
+            *pos = in->next;
+            MEM_free(in->buffer);
+            MEM_free(in);
+            return;
+        }
+    }
+}
+
+void crb_dispose_input(CRB_Interpreter *inter)
+{
+    while (inter->input_list) {
+        crb_dispose_file_input(inter, inter->input_list->fp);
+    }
+}
+
+/* 没读走的移到开头, 满了就翻倍, 再读一次. 返回读到的字符数, 0是读完了 */
+static int fill_input(InputBuffer *in)
+{
+    int length;
+
+    if (in->start > 0) {
+        memmove(in->buffer, in->buffer + in->start, in->end - in->start);
+        in->end -= in->start;
+        in->start = 0;
+    }
+    if (in->end + 1 >= in->alloc_size) {
+        in->alloc_size = in->alloc_size ? in->alloc_size * 2 : READ_BUF_SIZE;
+        in->buffer = MEM_realloc(in->buffer, in->alloc_size);
+    }
+
+    if (in->regular) {
+        length = fread(in->buffer + in->end, 1, in->alloc_size - in->end - 1, in->fp);
+    } else if (fgets(in->buffer + in->end, in->alloc_size - in->end, in->fp)) {
+        length = strlen(in->buffer + in->end);
+    } else {
+        length = 0;
+    }
+    in->end += length;
+
+    return length;
+}
+
+/* 缓冲区里start开始的length个字符拷贝成字符串 */
+static char *take_input(InputBuffer *in, int length)
+{
+    char *str;
+
+    str = MEM_malloc(length + 1);
+    memcpy(str, in->buffer + in->start, length);
+    str[length] = '\0';
+    in->start += length;
+
+    return str;
+}
+
+/* 一行(带换行), 读完了返回NULL */
+static char *read_line(InputBuffer *in)
+{
+    char *newline;
+    int scanned = 0;
+
+    for (;;) {
+        newline = NULL;
+        if (in->end - in->start > scanned) {
+            newline = memchr(in->buffer + in->start + scanned, '\n', in->end - in->start - scanned);
+        }
+        if (newline) {
+            return take_input(in, newline - (in->buffer + in->start) + 1);
+        }
+        scanned = in->end - in->start;
+        if (0 == fill_input(in)) {
+            break;
+        }
+    }
+    if (in->end == in->start) {
+        return NULL;
+    }
+
+    return take_input(in, in->end - in->start);
+}
+
+/* 剩下的全部, 缓冲区直接交给字符串 */
+static char *read_rest(InputBuffer *in)
+{
+    char *str;
+
+    while (fill_input(in) > 0) {
+        ;
+    }
+    if (in->start > 0) {
+        memmove(in->buffer, in->buffer + in->start, in->end - in->start);
+        in->end -= in->start;
+    }
+    str = MEM_realloc(in->buffer, in->end + 1);
+    str[in->end] = '\0';
+    in->buffer = NULL;
+    in->start = 0;
+    in->end = 0;
+    in->alloc_size = 0;
+
+    return str;
+}
+
+static FILE *get_file_argument(CRB_Interpreter *inter, char *name, CRB_Value *value)
+{
+    if (value->type != CRB_NATIVE_POINTER_VALUE || !check_native_pointer(value)) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+    }
+
+    return value->u.native_pointer.pointer;
+}
+
 CRB_Value crb_nv_fclose_proc(CRB_Interpreter *interpreter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
 {
     CRB_Value value;
     FILE *fp;
+    OutputBuffer *out;
+    OutputBuffer **prev;
     value.type = CRB_NULL_VALUE;
 
-    check_argument_count(arg_count, 1);
+    check_argument_count(interpreter, arg_count, 1);
 
     if (args[0].type != CRB_NATIVE_POINTER_VALUE || !check_native_pointer(&args[0])) {
-        crb_runtime_error(0, FCLOSE_ARGUMENT_TYPE_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(interpreter, interpreter->native_line_number, FCLOSE_ARGUMENT_TYPE_ERR, MESSAGE_ARGUMENT_END);
     }
 
     fp = args[0].u.native_pointer.pointer;
+    out = search_output(interpreter, fp, &prev);
+    if (out) {
+        *prev = out->next;
+        dispose_output(out);
+    }
+    crb_dispose_file_input(interpreter, fp);
     fclose(fp);
 
     return value;
@@ -89,42 +338,107 @@ CRB_Value crb_nv_fclose_proc(CRB_Interpreter *interpreter, CRB_LocalEnvironment
 CRB_Value crb_nv_fgets_proc(CRB_Interpreter *interpreter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
 {
     CRB_Value value;
-    FILE *fp;
-    char buf[LINE_BUF_SIZE];
-    char *ret_buf = NULL;
-    int ret_len = 0;
+    char *line;
 
-    check_argument_count(arg_count, 1);
+    check_argument_count(interpreter, arg_count, 1);
 
     if (args[0].type != CRB_NATIVE_POINTER_VALUE || !check_native_pointer(&args[0])) {
-        crb_runtime_error(0, FGETS_ARGUMENT_TYPE_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(interpreter, interpreter->native_line_number, FGETS_ARGUMENT_TYPE_ERR, MESSAGE_ARGUMENT_END);
     }
 
-    fp = args[0].u.native_pointer.pointer;
+    line = read_line(get_input(interpreter, args[0].u.native_pointer.pointer));
+    if (line) {
+        value.type = CRB_STRING_VALUE;
+        value.u.object = crb_create_crowbar_string(interpreter, env, line);
+    } else {
+        value.type = CRB_NULL_VALUE;
+    }
 
-    while(fgets(buf, LINE_BUF_SIZE, fp)) {
-        int new_len;
-        new_len = ret_len + strlen(buf);
-        ret_buf = MEM_realloc(ret_buf, new_len + 1);
+    return value;
+}
 
-        if (0 == ret_len) {
-            strcpy(ret_buf, buf);
-        } else {
-            strcat(ret_buf, buf);
-        }
+CRB_Value crb_nv_read_all_proc(CRB_Interpreter *interpreter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    FILE *fp;
+
+    check_argument_count(interpreter, arg_count, 1);
+    fp = get_file_argument(interpreter, "read_all", &args[0]);
+
+    value.type = CRB_STRING_VALUE;
+    value.u.object = crb_create_crowbar_string(interpreter, env, read_rest(get_input(interpreter, fp)));
+
+    return value;
+}
+
+CRB_Value crb_nv_read_lines_proc(CRB_Interpreter *interpreter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    CRB_Object *text;
+    CRB_Object *line;
+    char *chars;
+    char *newline;
+    int length;
+    int count;
+    int from;
+    int i;
+
+    check_argument_count(interpreter, arg_count, 1);
+    text = crb_create_crowbar_string(interpreter, env,
+            read_rest(get_input(interpreter, get_file_argument(interpreter, "read_lines", &args[0]))));
+    chars = text->u.string.string;
+    length = text->u.string.length;
+
+    /* 最后一个换行后面没有字符时不算一行 */
+    for (count = 0, from = 0; from < length; ++count) {
+        newline = memchr(chars + from, '\n', length - from);
+        from = newline ? newline - chars + 1 : length;
+    }
+
+    value.type = CRB_ARRAY_VALUE;
+    value.u.object = CRB_create_array(interpreter, env, count);
+    for (i = 0; i < count; ++i) {
+        value.u.object->u.array.array[i].type = CRB_NULL_VALUE;
+    }
+    for (i = 0, from = 0; i < count; ++i) {
+        newline = memchr(chars + from, '\n', length - from);
+        line = crb_create_string_view_i(interpreter, text, from, (newline ? newline - chars : length) - from);
+        value.u.object->u.array.array[i].type = CRB_STRING_VALUE;
+        value.u.object->u.array.array[i].u.object = line;
+        from = newline ? newline - chars + 1 : length;
+    }
+
+    return value;
+}
 
-        ret_len = new_len;
-        if ('\n' == ret_buf[ret_len - 1]) {
+CRB_Value crb_nv_read_proc(CRB_Interpreter *interpreter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    InputBuffer *in;
+    int size;
+
+    check_argument_count(interpreter, arg_count, 2);
+    in = get_input(interpreter, get_file_argument(interpreter, "read", &args[0]));
+    if (args[1].type != CRB_INT_VALUE || args[1].u.int_value <= 0) {
+        crb_runtime_error(interpreter, interpreter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "read", MESSAGE_ARGUMENT_END);
+    }
+    size = args[1].u.int_value;
+
+    /* 管道和终端有数据就返回, 不等凑满size */
+    while (in->end - in->start < size && (in->regular || in->end == in->start)) {
+        if (0 == fill_input(in)) {
             break;
         }
     }
-
-    if (ret_len > 0) {
-        value.type = CRB_STRING_VALUE;
-        value.u.object = crb_create_crowbar_string(interpreter, env, ret_buf);
-    } else {
+    if (in->end == in->start) {
         value.type = CRB_NULL_VALUE;
+        return value;
     }
+    if (size > in->end - in->start) {
+        size = in->end - in->start;
+    }
+    value.type = CRB_STRING_VALUE;
+    value.u.object = crb_create_crowbar_string(interpreter, env, take_input(in, size));
 
     return value;
 }
@@ -132,19 +446,41 @@ CRB_Value crb_nv_fgets_proc(CRB_Interpreter *interpreter, CRB_LocalEnvironment *
 CRB_Value crb_nv_fputs_proc(CRB_Interpreter *interpreter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
 {
     CRB_Value value;
-    FILE *fp;
+    OutputBuffer *out;
     value.type = CRB_NULL_VALUE;
 
-    check_argument_count(arg_count, 2);
+    check_argument_count(interpreter, arg_count, 2);
 
     if (args[0].type != CRB_STRING_VALUE ||
             args[1].type != CRB_NATIVE_POINTER_VALUE ||
             !check_native_pointer(&args[1])) {
-        crb_runtime_error(0, FPUTS_ARGUMENT_TYPE_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(interpreter, interpreter->native_line_number, FPUTS_ARGUMENT_TYPE_ERR, MESSAGE_ARGUMENT_END);
     }
 
-    fp = args[1].u.native_pointer.pointer;
-    fputs(args[0].u.object->u.string.string, fp);
+    out = get_output(interpreter, args[1].u.native_pointer.pointer);
+    crb_vstr_append_chars(&out->buffer, crb_string_chars(args[0].u.object), args[0].u.object->u.string.length);
+    written(out);
+
+    return value;
+}
+
+/* flush(): 写出所有缓冲, flush(fp): 只写fp的 */
+CRB_Value crb_nv_flush_proc(CRB_Interpreter *interpreter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    value.type = CRB_NULL_VALUE;
+
+    if (arg_count > 1) {
+        crb_runtime_error(interpreter, interpreter->native_line_number, ARGUMENT_TOO_MANY_ERR, MESSAGE_ARGUMENT_END);
+    }
+    if (0 == arg_count) {
+        crb_flush_output(interpreter, NULL);
+        return value;
+    }
+    if (args[0].type != CRB_NATIVE_POINTER_VALUE || !check_native_pointer(&args[0])) {
+        crb_runtime_error(interpreter, interpreter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "flush", MESSAGE_ARGUMENT_END);
+    }
+    crb_flush_output(interpreter, args[0].u.native_pointer.pointer);
 
     return value;
 }
@@ -173,7 +509,7 @@ CRB_Value new_array_sub(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int a
     int i;
 
     if (args[arg_index].type != CRB_INT_VALUE) {
-        crb_runtime_error(0, NEW_ARRAY_ARGUMENT_TYPE_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, inter->native_line_number, NEW_ARRAY_ARGUMENT_TYPE_ERR, MESSAGE_ARGUMENT_END);
     }
 
     size = args[arg_index].u.int_value;
@@ -198,7 +534,7 @@ CRB_Value crb_nv_new_array_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *en
 {
     CRB_Value value;
     if (arg_count < 1) {
-        crb_runtime_error(0, ARGUMENT_TOO_FEW_ERR, MESSAGE_ARGUMENT_END);
+        crb_runtime_error(inter, inter->native_line_number, ARGUMENT_TOO_FEW_ERR, MESSAGE_ARGUMENT_END);
     }
 
     value = new_array_sub(inter, env, arg_count, args, 0);
@@ -206,5 +542,39 @@ CRB_Value crb_nv_new_array_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *en
     return value;
 }
 
+/* 空的散列表, 也可以写成{k: v, ...} */
+CRB_Value crb_nv_new_map_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+
+    check_argument_count(inter, arg_count, 0);
+    value.type = CRB_MAP_VALUE;
+    value.u.object = crb_create_map_i(inter);
+
+    return value;
+}
+
+/*
+ * heap_size(): GC之后堆上还活着的字节数.
+ * 开了-d时字符串在下一个语句之前才合并, 连着调用两次就能看到合并省下的大小.
+ * */
+CRB_Value crb_nv_heap_size_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+
+    check_argument_count(inter, arg_count, 0);
+    crb_garbage_collect(inter);
+    /* 超过int的范围时用实数 */
+    if (inter->heap.current_heap_size > INT_MAX) {
+        value.type = CRB_DOUBLE_VALUE;
+        value.u.double_value = (double)inter->heap.current_heap_size;
+    } else {
+        value.type = CRB_INT_VALUE;
+        value.u.int_value = (int)inter->heap.current_heap_size;
+    }
+
+    return value;
+}
+
 /* vim: set tabstop=4 set shiftwidth=4 */
 
@@ -0,0 +1,731 @@
+/*
+ * File : number.c
+ * CreateDate : 2026-10-20 10:12:37
+ * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <float.h>
+#include <math.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+/*
+ * 数值和文本的转换
+ *
+ *   print(0.1);                 # 0.1, 读回来还是同一个double
+ *   n = parse_int(" 42\n");     # 42, 不是整数时是null
+ *   x = parse_double("2.5e3");  # 2500.0
+ *
+ * 输出: 整数两位一查表; 实数是整数值时按整数转换再加".0",
+ * 其他的用能原样读回来的最短写法: 先用Grisu3直接生成最短的数字;
+ * 它确定不了的和非规格化数才用sprintf取一次20位, 舍入成15~17位后和半个ulp比较找能读回的.
+ * 解析: 有效数字不超过15位, 10的指数不超过22时, 尾数和10的幂都能精确表示,
+ * 一次乘除就是正确舍入的结果(Clinger); 其他情况才交给strtod.
+ * */
+
+#define FORMAT_DIGITS (20)
+
+static char st_digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static double st_power_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+    1e21, 1e22
+};
+
+#define MAX_EXACT_POWER (22)
+#define MAX_EXACT_DIGITS (15)
+
+/* 返回长度, buf至少NUMBER_BUF_SIZE */
+int crb_format_int(char *buf, int value)
+{
+    char tmp[NUMBER_BUF_SIZE];
+    char *p = tmp + sizeof(tmp);
+    unsigned int u;
+    int length;
+
+    /* INT_MIN取反会溢出, 用unsigned算 */
+    u = value < 0 ? 0U - (unsigned int)value : (unsigned int)value;
+    while (u >= 100) {
+        p -= 2;
+        memcpy(p, &st_digit_pairs[(u % 100) * 2], 2);
+        u /= 100;
+    }
+    if (u >= 10) {
+        p -= 2;
+        memcpy(p, &st_digit_pairs[u * 2], 2);
+    } else {
+        *--p = '0' + u;
+    }
+    if (value < 0) {
+        *--p = '-';
+    }
+    length = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, length);
+    buf[length] = '\0';
+
+    return length;
+}
+
+/*
+ * digits里是precision位有效数字, 小数点在第一位后面, 乘10的exponent次方.
+ * 按%.{precision}g的规则写出来: 去掉末尾的0, 指数小于-4或者不小于precision时用指数形式.
+ * */
+static int write_digits(char *buf, CRB_Boolean negative, char *digits, int precision, int exponent)
+{
+    char *p = buf;
+    int count = precision;
+    int i;
+
+    while (count > 1 && '0' == digits[count - 1]) {
+        --count;
+    }
+    if (negative) {
+        *p++ = '-';
+    }
+    if (exponent < -4 || exponent >= precision) {
+        *p++ = digits[0];
+        if (count > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, count - 1);
+            p += count - 1;
+        }
+        *p++ = 'e';
+        *p++ = exponent < 0 ? '-' : '+';
+        if (exponent < 0) {
+            exponent = -exponent;
+        }
+        if (exponent >= 100) {
+            *p++ = '0' + exponent / 100;
+        }
+        *p++ = '0' + exponent / 10 % 10;
+        *p++ = '0' + exponent % 10;
+    } else if (exponent < 0) {
+        *p++ = '0';
+        *p++ = '.';
+        for (i = -1; i > exponent; --i) {
+            *p++ = '0';
+        }
+        memcpy(p, digits, count);
+        p += count;
+    } else {
+        for (i = 0; i <= exponent; ++i) {
+            *p++ = i < count ? digits[i] : '0';
+        }
+        if (count > exponent + 1) {
+            *p++ = '.';
+            memcpy(p, digits + exponent + 1, count - exponent - 1);
+            p += count - exponent - 1;
+        }
+    }
+    *p = '\0';
+
+    return p - buf;
+}
+
+/*
+ * 把value的20位有效数字digits舍入成precision位写到buf, 能读回value时返回长度, 否则返回0.
+ * 20位和value只差半个末位, 舍入改了distance个末位时离value在distance±0.5之间,
+ * 和半个ulp比就知道能不能读回, 只有贴着边的时候才用strtod确认.
+ * |value| = f * 2^e (0.5 <= f < 1), 按20位末位算的半个ulp是 m * 10^19 * 2^-54 / f,
+ * m是digits当成d.ddd的值. 2的幂往下的ulp只有一半. 非规格化数直接用strtod.
+ * */
+static int try_precision(char *buf, double value, CRB_Boolean negative, char *digits, int exponent, int precision)
+{
+    char rounded[FORMAT_DIGITS];
+    long rest = 0;
+    long unit = 1;
+    long distance;
+    double half_ulp;
+    double m;
+    double f;
+    int e;
+    int i;
+    int length;
+
+    for (i = precision; i < FORMAT_DIGITS; ++i) {
+        rest = rest * 10 + (digits[i] - '0');
+        unit *= 10;
+    }
+    /* 正好一半时舍入方向要看20位以后, 交给sprintf */
+    if (rest * 2 == unit) {
+        length = sprintf(buf, "%.*g", precision, value);
+        return strtod(buf, NULL) == value ? length : 0;
+    }
+    memcpy(rounded, digits, precision);
+    if (rest * 2 < unit) {
+        distance = rest;
+    } else {
+        distance = unit - rest;
+        for (i = precision - 1; i >= 0 && '9' == rounded[i]; --i) {
+            rounded[i] = '0';
+        }
+        if (i >= 0) {
+            ++rounded[i];
+        } else {
+            rounded[0] = '1';
+            ++exponent;
+        }
+    }
+    length = write_digits(buf, negative, rounded, precision, exponent);
+    if (0 == distance) {
+        return length;
+    }
+    if (value < DBL_MIN && value > -DBL_MIN) {
+        return strtod(buf, NULL) == value ? length : 0;
+    }
+
+    /* m只取前9位, 相对误差不到1e-8 */
+    m = 0.0;
+    for (i = 0; i < 9; ++i) {
+        m = m * 10 + (digits[i] - '0');
+    }
+    f = fabs(frexp(value, &e));
+    half_ulp = m * 1e11 * (DBL_EPSILON / 4) / f;
+    if (rest * 2 < unit && 0.5 == f) {
+        half_ulp /= 2;
+    }
+    if (distance + 0.5 < half_ulp * (1 - 1e-7)) {
+        return length;
+    }
+    if (distance - 0.5 > half_ulp * (1 + 1e-7)) {
+        return 0;
+    }
+    return strtod(buf, NULL) == value ? length : 0;
+}
+
+#if ULONG_MAX > 0xffffffffUL
+/*
+ * Grisu3 (Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers").
+ * 64位整数的尾数乘上缓存的10的幂, 在v的上下界之间直接生成最短的数字, 不用sprintf.
+ * 误差大到不能确定最短/最接近时返回0, 交给下面的sprintf; 大约0.5%的数会这样.
+ * unsigned long不够64位时不编译这部分.
+ * */
+typedef struct {
+    unsigned long f;
+    int e;
+} DiyFp;
+
+typedef struct {
+    unsigned long f;
+    int e;
+    int decimal_exponent;
+} CachedPower;
+
+/* 10^-348到10^340, 每隔8个一项, 尾数64位舍入 */
+static CachedPower st_cached_power[] = {
+    {0xfa8fd5a0081c0288UL, -1220, -348},
+    {0xbaaee17fa23ebf76UL, -1193, -340},
+    {0x8b16fb203055ac76UL, -1166, -332},
+    {0xcf42894a5dce35eaUL, -1140, -324},
+    {0x9a6bb0aa55653b2dUL, -1113, -316},
+    {0xe61acf033d1a45dfUL, -1087, -308},
+    {0xab70fe17c79ac6caUL, -1060, -300},
+    {0xff77b1fcbebcdc4fUL, -1034, -292},
+    {0xbe5691ef416bd60cUL, -1007, -284},
+    {0x8dd01fad907ffc3cUL, -980, -276},
+    {0xd3515c2831559a83UL, -954, -268},
+    {0x9d71ac8fada6c9b5UL, -927, -260},
+    {0xea9c227723ee8bcbUL, -901, -252},
+    {0xaecc49914078536dUL, -874, -244},
+    {0x823c12795db6ce57UL, -847, -236},
+    {0xc21094364dfb5637UL, -821, -228},
+    {0x9096ea6f3848984fUL, -794, -220},
+    {0xd77485cb25823ac7UL, -768, -212},
+    {0xa086cfcd97bf97f4UL, -741, -204},
+    {0xef340a98172aace5UL, -715, -196},
+    {0xb23867fb2a35b28eUL, -688, -188},
+    {0x84c8d4dfd2c63f3bUL, -661, -180},
+    {0xc5dd44271ad3cdbaUL, -635, -172},
+    {0x936b9fcebb25c996UL, -608, -164},
+    {0xdbac6c247d62a584UL, -582, -156},
+    {0xa3ab66580d5fdaf6UL, -555, -148},
+    {0xf3e2f893dec3f126UL, -529, -140},
+    {0xb5b5ada8aaff80b8UL, -502, -132},
+    {0x87625f056c7c4a8bUL, -475, -124},
+    {0xc9bcff6034c13053UL, -449, -116},
+    {0x964e858c91ba2655UL, -422, -108},
+    {0xdff9772470297ebdUL, -396, -100},
+    {0xa6dfbd9fb8e5b88fUL, -369, -92},
+    {0xf8a95fcf88747d94UL, -343, -84},
+    {0xb94470938fa89bcfUL, -316, -76},
+    {0x8a08f0f8bf0f156bUL, -289, -68},
+    {0xcdb02555653131b6UL, -263, -60},
+    {0x993fe2c6d07b7facUL, -236, -52},
+    {0xe45c10c42a2b3b06UL, -210, -44},
+    {0xaa242499697392d3UL, -183, -36},
+    {0xfd87b5f28300ca0eUL, -157, -28},
+    {0xbce5086492111aebUL, -130, -20},
+    {0x8cbccc096f5088ccUL, -103, -12},
+    {0xd1b71758e219652cUL, -77, -4},
+    {0x9c40000000000000UL, -50, 4},
+    {0xe8d4a51000000000UL, -24, 12},
+    {0xad78ebc5ac620000UL, 3, 20},
+    {0x813f3978f8940984UL, 30, 28},
+    {0xc097ce7bc90715b3UL, 56, 36},
+    {0x8f7e32ce7bea5c70UL, 83, 44},
+    {0xd5d238a4abe98068UL, 109, 52},
+    {0x9f4f2726179a2245UL, 136, 60},
+    {0xed63a231d4c4fb27UL, 162, 68},
+    {0xb0de65388cc8ada8UL, 189, 76},
+    {0x83c7088e1aab65dbUL, 216, 84},
+    {0xc45d1df942711d9aUL, 242, 92},
+    {0x924d692ca61be758UL, 269, 100},
+    {0xda01ee641a708deaUL, 295, 108},
+    {0xa26da3999aef774aUL, 322, 116},
+    {0xf209787bb47d6b85UL, 348, 124},
+    {0xb454e4a179dd1877UL, 375, 132},
+    {0x865b86925b9bc5c2UL, 402, 140},
+    {0xc83553c5c8965d3dUL, 428, 148},
+    {0x952ab45cfa97a0b3UL, 455, 156},
+    {0xde469fbd99a05fe3UL, 481, 164},
+    {0xa59bc234db398c25UL, 508, 172},
+    {0xf6c69a72a3989f5cUL, 534, 180},
+    {0xb7dcbf5354e9beceUL, 561, 188},
+    {0x88fcf317f22241e2UL, 588, 196},
+    {0xcc20ce9bd35c78a5UL, 614, 204},
+    {0x98165af37b2153dfUL, 641, 212},
+    {0xe2a0b5dc971f303aUL, 667, 220},
+    {0xa8d9d1535ce3b396UL, 694, 228},
+    {0xfb9b7cd9a4a7443cUL, 720, 236},
+    {0xbb764c4ca7a44410UL, 747, 244},
+    {0x8bab8eefb6409c1aUL, 774, 252},
+    {0xd01fef10a657842cUL, 800, 260},
+    {0x9b10a4e5e9913129UL, 827, 268},
+    {0xe7109bfba19c0c9dUL, 853, 276},
+    {0xac2820d9623bf429UL, 880, 284},
+    {0x80444b5e7aa7cf85UL, 907, 292},
+    {0xbf21e44003acdd2dUL, 933, 300},
+    {0x8e679c2f5e44ff8fUL, 960, 308},
+    {0xd433179d9c8cb841UL, 986, 316},
+    {0x9e19db92b4e31ba9UL, 1013, 324},
+    {0xeb96bf6ebadf77d9UL, 1039, 332},
+    {0xaf87023b9bf0ee6bUL, 1066, 340}
+};
+
+#define CACHED_POWER_OFFSET (348)
+#define CACHED_POWER_STEP (8)
+/* 乘完之后的二进制指数范围, 整数部分不超过32位 */
+#define GRISU_MIN_EXPONENT (-60)
+#define GRISU_MAX_EXPONENT (-32)
+
+/* 64x64位乘法只留高64位, 舍入 */
+static DiyFp diy_multiply(DiyFp x, DiyFp y)
+{
+    DiyFp ret;
+    unsigned long a = x.f >> 32;
+    unsigned long b = x.f & 0xffffffffUL;
+    unsigned long c = y.f >> 32;
+    unsigned long d = y.f & 0xffffffffUL;
+    unsigned long ad = a * d;
+    unsigned long bc = b * c;
+    unsigned long tmp;
+
+    tmp = ((b * d) >> 32) + (ad & 0xffffffffUL) + (bc & 0xffffffffUL) + (1UL << 31);
+    ret.f = a * c + (ad >> 32) + (bc >> 32) + (tmp >> 32);
+    ret.e = x.e + y.e + 64;
+
+    return ret;
+}
+
+/* 选一个10的幂, 让w乘上它之后的二进制指数落在GRISU_MIN_EXPONENT~GRISU_MAX_EXPONENT */
+static CachedPower *cached_power(int e)
+{
+    int min_exponent = GRISU_MIN_EXPONENT - (e + 64);
+    int k = (int)ceil((min_exponent + 63) * 0.30102999566398114);
+    CachedPower *power;
+
+    power = &st_cached_power[(CACHED_POWER_OFFSET + k - 1) / CACHED_POWER_STEP + 1];
+    DBG_assert(power->e >= min_exponent && power->e <= GRISU_MAX_EXPONENT - (e + 64),
+            ("e..%d power->e..%d\n", e, power->e));
+
+    return power;
+}
+
+/*
+ * 最后一位往下调, 尽量接近w. 误差范围内分不清哪个更接近,
+ * 或者结果可能不在上下界之内时返回CRB_FALSE.
+ * distance是too_high到w的距离, rest是too_high到现在的数字的距离, 都以ten_kappa的单位算
+ * */
+static CRB_Boolean round_weed(char *digits, int length, unsigned long distance, unsigned long unsafe_interval,
+        unsigned long rest, unsigned long ten_kappa, unsigned long unit)
+{
+    unsigned long small_distance = distance - unit;
+    unsigned long big_distance = distance + unit;
+
+    while (rest < small_distance && unsafe_interval - rest >= ten_kappa
+            && (rest + ten_kappa < small_distance || small_distance - rest >= rest + ten_kappa - small_distance)) {
+        --digits[length - 1];
+        rest += ten_kappa;
+    }
+    if (rest < big_distance && unsafe_interval - rest >= ten_kappa
+            && (rest + ten_kappa < big_distance || big_distance - rest > rest + ten_kappa - big_distance)) {
+        return CRB_FALSE;
+    }
+
+    return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+}
+
+/*
+ * low, w, high已经乘过10的幂, 误差不超过1个unit.
+ * 从(low-unit, high+unit)的上端开始生成数字, 第一次落进区间就停, 这时的位数就是最短的.
+ * 返回位数, 失败时返回0. kappa是最后一位的10的指数
+ * */
+static int generate_digits(DiyFp low, DiyFp w, DiyFp high, char *digits, int *kappa)
+{
+    unsigned long unit = 1;
+    unsigned long too_high = high.f + unit;
+    unsigned long unsafe_interval = too_high - (low.f - unit);
+    unsigned long one = 1UL << -w.e;
+    unsigned long integrals = too_high >> -w.e;
+    unsigned long fractionals = too_high & (one - 1);
+    unsigned long divisor;
+    unsigned long rest;
+    int length = 0;
+
+    for (divisor = 1, *kappa = 1; divisor <= integrals / 10; divisor *= 10) {
+        ++*kappa;
+    }
+    if (0 == integrals) {
+        *kappa = 0;
+    }
+    while (*kappa > 0) {
+        digits[length++] = '0' + (char)(integrals / divisor);
+        integrals %= divisor;
+        --*kappa;
+        rest = (integrals << -w.e) + fractionals;
+        if (rest < unsafe_interval) {
+            return round_weed(digits, length, too_high - w.f, unsafe_interval, rest, divisor << -w.e, unit)
+                ? length : 0;
+        }
+        divisor /= 10;
+    }
+    for (;;) {
+        fractionals *= 10;
+        unit *= 10;
+        unsafe_interval *= 10;
+        digits[length++] = '0' + (char)(fractionals >> -w.e);
+        fractionals &= one - 1;
+        --*kappa;
+        if (fractionals < unsafe_interval) {
+            return round_weed(digits, length, (too_high - w.f) * unit, unsafe_interval, fractionals, one, unit)
+                ? length : 0;
+        }
+    }
+}
+
+/* 正的规格化数, 写出最短的数字和d.ddd形式的指数, 失败时返回0 */
+static int shortest_digits(double value, char *digits, int *exponent)
+{
+    DiyFp w;
+    DiyFp plus;
+    DiyFp minus;
+    DiyFp power;
+    CachedPower *cached;
+    double fraction;
+    int e;
+    int kappa;
+    int length;
+
+    /* value = f * 2^e, f是53位整数 */
+    fraction = frexp(value, &e);
+    w.f = (unsigned long)(fraction * 9007199254740992.0);
+    w.e = e - 53;
+
+    /* 上下界是和相邻的double的中点, 2的幂往下的间隔只有一半 */
+    plus.f = ((w.f << 1) + 1) << 10;
+    plus.e = w.e - 11;
+    if (0.5 == fraction && e != DBL_MIN_EXP) {
+        minus.f = ((w.f << 2) - 1) << 9;
+    } else {
+        minus.f = ((w.f << 1) - 1) << 10;
+    }
+    minus.e = plus.e;
+    w.f <<= 11;
+    w.e -= 11;
+
+    cached = cached_power(w.e);
+    power.f = cached->f;
+    power.e = cached->e;
+    length = generate_digits(diy_multiply(minus, power), diy_multiply(w, power), diy_multiply(plus, power),
+            digits, &kappa);
+    *exponent = kappa - cached->decimal_exponent + length - 1;
+
+    return length;
+}
+#endif /* ULONG_MAX > 0xffffffffUL */
+
+int crb_format_double(char *buf, double value)
+{
+    char text[32];
+    char digits[FORMAT_DIGITS];
+    CRB_Boolean negative;
+    int exponent;
+    int length;
+
+    if (value != value) {
+        strcpy(buf, "nan");
+        return 3;
+    }
+    if (value > DBL_MAX || value < -DBL_MAX) {
+        strcpy(buf, value > 0 ? "inf" : "-inf");
+        return strlen(buf);
+    }
+    /* 整数值最常见, 不用sprintf */
+    if (value > INT_MIN && value < INT_MAX && value == (int)value) {
+        length = crb_format_int(buf, (int)value);
+        strcpy(buf + length, ".0");
+        return length + 2;
+    }
+
+    length = 0;
+#if ULONG_MAX > 0xffffffffUL
+    /* 非规格化数的上下界不一样, 交给sprintf */
+    if (value >= DBL_MIN || value <= -DBL_MIN) {
+        int count;
+        int precision;
+
+        negative = value < 0 ? CRB_TRUE : CRB_FALSE;
+        count = shortest_digits(fabs(value), digits, &exponent);
+        if (count > 0) {
+            /* 和%.15g~%.17g的写法一致, 不足15位的后面补0 */
+            for (precision = count; precision < 15; ++precision) {
+                digits[precision] = '0';
+            }
+            length = write_digits(buf, negative, digits, precision, exponent);
+        }
+    }
+#endif
+    if (0 == length) {
+        /* 只调一次sprintf拿到20位, 再从里面找15~17位中最短的能读回的写法 */
+        sprintf(text, "%.*e", FORMAT_DIGITS - 1, value);
+        negative = '-' == text[0];
+        digits[0] = text[negative];
+        memcpy(digits + 1, text + negative + 2, FORMAT_DIGITS - 1);
+        exponent = atoi(text + negative + FORMAT_DIGITS + 2);
+
+        length = try_precision(buf, value, negative, digits, exponent, 15);
+        if (0 == length) {
+            length = try_precision(buf, value, negative, digits, exponent, 16);
+        }
+        if (0 == length) {
+            length = try_precision(buf, value, negative, digits, exponent, 17);
+        }
+    }
+    /* 1e+18这样的也要看得出是实数, 小数点补在指数前面: 1.0e+18 */
+    if (NULL == strchr(buf, '.')) {
+        char *e = strchr(buf, 'e');
+
+        if (NULL == e) {
+            e = buf + length;
+        }
+        memmove(e + 2, e, buf + length - e + 1);
+        e[0] = '.';
+        e[1] = '0';
+        length += 2;
+    }
+
+    return length;
+}
+
+static CRB_Boolean is_space(int ch)
+{
+    return ' ' == ch || '\t' == ch || '\r' == ch || '\n' == ch;
+}
+
+/* 去掉前后的空白 */
+static void trim_number(char **chars, int *length)
+{
+    while (*length > 0 && is_space((*chars)[0])) {
+        ++*chars;
+        --*length;
+    }
+    while (*length > 0 && is_space((*chars)[*length - 1])) {
+        --*length;
+    }
+}
+
+/* 十进制整数, 可以有符号. 不是整数或超出int的范围时返回CRB_FALSE */
+CRB_Boolean crb_parse_int(char *chars, int length, int *value)
+{
+    unsigned int limit;
+    unsigned int u = 0;
+    CRB_Boolean negative = CRB_FALSE;
+    int i = 0;
+
+    trim_number(&chars, &length);
+    if (length > 0 && ('-' == chars[0] || '+' == chars[0])) {
+        negative = ('-' == chars[0]);
+        i = 1;
+    }
+    if (i == length) {
+        return CRB_FALSE;
+    }
+    limit = negative ? 0U - (unsigned int)INT_MIN : (unsigned int)INT_MAX;
+    for (; i < length; ++i) {
+        if (chars[i] < '0' || chars[i] > '9') {
+            return CRB_FALSE;
+        }
+        if (u > (limit - (chars[i] - '0')) / 10) {
+            return CRB_FALSE;
+        }
+        u = u * 10 + (chars[i] - '0');
+    }
+    *value = negative ? (int)(0U - u) : (int)u;
+
+    return CRB_TRUE;
+}
+
+/* 复杂的情况交给strtod, 视图后面没有'\0', 先拷贝出来 */
+static CRB_Boolean parse_double_slow(char *chars, int length, double *value)
+{
+    char buf[NUMBER_BUF_SIZE];
+    char *str = buf;
+
+    if (length >= NUMBER_BUF_SIZE) {
+        str = MEM_malloc(length + 1);
+    }
+    memcpy(str, chars, length);
+    str[length] = '\0';
+    *value = strtod(str, NULL);
+    if (str != buf) {
+        MEM_free(str);
+    }
+
+    return CRB_TRUE;
+}
+
+/* 1.5, -2, .5, 3e-2这样的十进制实数, 不认inf/nan和十六进制 */
+CRB_Boolean crb_parse_double(char *chars, int length, double *value)
+{
+    double mantissa = 0.0;
+    int digits = 0;
+    int exponent = 0;
+    int exp_value = 0;
+    int exp_sign = 1;
+    CRB_Boolean negative = CRB_FALSE;
+    CRB_Boolean seen_digit = CRB_FALSE;
+    int i = 0;
+
+    trim_number(&chars, &length);
+    if (length > 0 && ('-' == chars[0] || '+' == chars[0])) {
+        negative = ('-' == chars[0]);
+        i = 1;
+    }
+    /* 整数部分和小数部分, 开头的0不算有效数字 */
+    for (; i < length && chars[i] >= '0' && chars[i] <= '9'; ++i) {
+        seen_digit = CRB_TRUE;
+        if (digits > 0 || chars[i] != '0') {
+            if (digits < MAX_EXACT_DIGITS) {
+                mantissa = mantissa * 10 + (chars[i] - '0');
+            } else {
+                exponent++;
+            }
+            digits++;
+        }
+    }
+    if (i < length && '.' == chars[i]) {
+        for (++i; i < length && chars[i] >= '0' && chars[i] <= '9'; ++i) {
+            seen_digit = CRB_TRUE;
+            if (digits > 0 || chars[i] != '0') {
+                if (digits < MAX_EXACT_DIGITS) {
+                    mantissa = mantissa * 10 + (chars[i] - '0');
+                    exponent--;
+                }
+                digits++;
+            } else {
+                exponent--;
+            }
+        }
+    }
+    if (!seen_digit) {
+        return CRB_FALSE;
+    }
+    if (i < length && ('e' == chars[i] || 'E' == chars[i])) {
+        if (++i < length && ('-' == chars[i] || '+' == chars[i])) {
+            exp_sign = ('-' == chars[i]) ? -1 : 1;
+            ++i;
+        }
+        if (i == length) {
+            return CRB_FALSE;
+        }
+        for (; i < length && chars[i] >= '0' && chars[i] <= '9'; ++i) {
+            if (exp_value < 100000) {
+                exp_value = exp_value * 10 + (chars[i] - '0');
+            }
+        }
+    }
+    if (i != length) {
+        return CRB_FALSE;
+    }
+
+    exponent += exp_sign * exp_value;
+    if (digits > MAX_EXACT_DIGITS || exponent > MAX_EXACT_POWER || exponent < -MAX_EXACT_POWER) {
+        return parse_double_slow(chars, length, value);
+    }
+    if (exponent < 0) {
+        mantissa /= st_power_of_ten[-exponent];
+    } else {
+        mantissa *= st_power_of_ten[exponent];
+    }
+    *value = negative ? -mantissa : mantissa;
+
+    return CRB_TRUE;
+}
+
+static CRB_Object *get_text_argument(CRB_Interpreter *inter, char *name, int arg_count, CRB_Value *args)
+{
+    if (arg_count != 1 || args[0].type != CRB_STRING_VALUE) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+    }
+
+    return args[0].u.object;
+}
+
+/* parse_int(str): 不是整数时返回null */
+CRB_Value crb_nv_parse_int_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    CRB_Object *text;
+
+    text = get_text_argument(inter, "parse_int", arg_count, args);
+    if (crb_parse_int(crb_string_chars(text), text->u.string.length, &value.u.int_value)) {
+        value.type = CRB_INT_VALUE;
+    } else {
+        value.type = CRB_NULL_VALUE;
+    }
+
+    return value;
+}
+
+/* parse_double(str): 整数的写法也可以, 不是数值时返回null */
+CRB_Value crb_nv_parse_double_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    CRB_Object *text;
+
+    text = get_text_argument(inter, "parse_double", arg_count, args);
+    if (crb_parse_double(crb_string_chars(text), text->u.string.length, &value.u.double_value)) {
+        value.type = CRB_DOUBLE_VALUE;
+    } else {
+        value.type = CRB_NULL_VALUE;
+    }
+
+    return value;
+}
+
+/* vim: set tabstop=4 set shiftwidth=4 */
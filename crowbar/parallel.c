@@ -0,0 +1,482 @@
+/*
+ * File : parallel.c
+ * CreateDate : 2026-10-19 22:14:37
+ * */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+/*
+ * 数据并行
+ *
+ *   b = parallel_map(a, "f");          # b[i] = f(a[i])
+ *   s = parallel_reduce(a, "add", 0);  # add(...add(add(0, a[0]), a[1])..., a[n-1])
+ * 第一次调用时按cpu个数创建线程池, 每个线程一个解释器, 共享调用者的程序,
+ * 之后一直留着, 解释器重置或释放时才结束. 数组分成比线程数多几倍的段,
+ * 线程做完一段再取下一段. 元素和结果都按Message拷贝, 函数里看不到全局变量.
+ * parallel_reduce每段各自从init开始, 最后在调用者这边按顺序合并各段的结果,
+ * 所以func要满足结合律, init要是单位元.
+ * 线程池里不重新计数: 步数每次从调用者剩下的里面领STEP_GRANT步, 用完再领,
+ * 期限也用调用者的, 超限时调用者按同样的状态中止. func里不能再调用parallel_*.
+ * */
+
+#define POOL_MAX_THREADS (64)
+#define CHUNKS_PER_THREAD (4)
+#define STEP_GRANT (10000)
+
+typedef enum {
+    PARALLEL_MAP = 1,
+    PARALLEL_REDUCE
+} ParallelMode;
+
+typedef struct {
+    ParallelMode mode;
+    FunctionDefinition *func;
+    int count;
+    Message *input;
+    Message *output;            /* map: 每个元素, reduce: 每一段 */
+    Message init;
+    int chunk_size;
+    int chunk_count;
+    int next_chunk;
+    int pending;                /* 还没做完的段 */
+    char *error_message;        /* 第一个错误, 之后的段不再执行 */
+    CRB_Status status;          /* 第一个错误的状态 */
+    CRB_Boolean limit_steps;
+    long steps_left;            /* 调用者还剩的步数, 线程领走后减少, 没用完的还回来 */
+    long timeout_msec;
+    double deadline;            /* 调用者的期限 */
+} ParallelJob;
+
+struct PoolThread_tag {
+    WorkerPool *pool;
+    CRB_Interpreter *inter;
+    pthread_t thread;
+};
+
+struct WorkerPool_tag {
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    ParallelJob *job;
+    CRB_Boolean shutdown;
+    int thread_count;
+    PoolThread *threads;
+};
+
+/* 步数用完时从调用者剩下的步数里再领一批, 领不到返回CRB_FALSE */
+CRB_Boolean crb_take_pool_steps(CRB_Interpreter *inter)
+{
+    WorkerPool *pool = inter->pool_thread->pool;
+    long grant;
+
+    pthread_mutex_lock(&pool->mutex);
+    grant = pool->job->steps_left < STEP_GRANT ? pool->job->steps_left : STEP_GRANT;
+    pool->job->steps_left -= grant;
+    pthread_mutex_unlock(&pool->mutex);
+    inter->limits.max_steps += grant;
+
+    return grant > 0;
+}
+
+/* 出错时返回错误信息 */
+static char *run_chunk(CRB_Interpreter *inter, ParallelJob *job, int chunk)
+{
+    CRB_Value args[2];
+    CRB_Value result;
+    jmp_buf recovery;
+    char *error_message = NULL;
+    int from;
+    int to;
+    int i;
+
+    from = chunk * job->chunk_size;
+    to = from + job->chunk_size;
+    if (to > job->count) {
+        to = job->count;
+    }
+
+    /* 不用crb_start_budget, 接着调用者的步数和期限算 */
+    inter->status = CRB_STATUS_OK;
+    inter->step_count = 0;
+    inter->limits.max_steps = 0;
+    inter->limits.timeout_msec = job->timeout_msec;
+    inter->deadline = job->deadline;
+    if (0 == setjmp(recovery)) {
+        inter->recovery = &recovery;
+        if (job->limit_steps && !crb_take_pool_steps(inter)) {
+            crb_abort(inter, CRB_STATUS_STEP_LIMIT);
+        }
+        crb_check_budget(inter);
+        if (PARALLEL_MAP == job->mode) {
+            for (i = from; i < to; ++i) {
+                args[0] = crb_message_to_value(inter, &job->input[i]);
+                push_value(inter, &args[0]);
+                result = CRB_call_function(inter, job->func, 1, args);
+                pop_value(inter);
+                crb_value_to_message(inter, &result, &job->output[i]);
+            }
+        } else {
+            /* 累加值一直放在栈顶 */
+            result = crb_message_to_value(inter, &job->init);
+            push_value(inter, &result);
+            for (i = from; i < to; ++i) {
+                args[0] = result;
+                args[1] = crb_message_to_value(inter, &job->input[i]);
+                push_value(inter, &args[1]);
+                result = CRB_call_function(inter, job->func, 2, args);
+                shrink_stack(inter, 2);
+                push_value(inter, &result);
+            }
+            crb_value_to_message(inter, &result, &job->output[chunk]);
+        }
+    } else {
+        error_message = MEM_strdup(CRB_get_error_message(inter));
+    }
+    inter->recovery = NULL;
+    inter->stack.stack_pointer = 0;
+
+    return error_message;
+}
+
+static void *pool_main(void *arg)
+{
+    PoolThread *thread = arg;
+    WorkerPool *pool = thread->pool;
+    ParallelJob *job;
+    char *error_message;
+    int chunk;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        while (!pool->shutdown
+                && (NULL == pool->job || pool->job->next_chunk == pool->job->chunk_count)) {
+            pthread_cond_wait(&pool->work, &pool->mutex);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        job = pool->job;
+        chunk = job->next_chunk++;
+        if (NULL == job->error_message) {
+            pthread_mutex_unlock(&pool->mutex);
+            error_message = run_chunk(thread->inter, job, chunk);
+            pthread_mutex_lock(&pool->mutex);
+            if (job->limit_steps) {
+                job->steps_left += thread->inter->limits.max_steps - thread->inter->step_count;
+            }
+            if (error_message && job->error_message) {
+                MEM_free(error_message);
+            } else if (error_message) {
+                job->error_message = error_message;
+                job->status = thread->inter->status;
+            }
+        }
+        if (0 == --job->pending) {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+static WorkerPool *get_pool(CRB_Interpreter *inter)
+{
+    WorkerPool *pool = inter->worker_pool;
+    long thread_count;
+    int error = 0;
+    int i;
+
+    if (pool) {
+        return pool;
+    }
+
+    thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (thread_count < 1) {
+        thread_count = 1;
+    } else if (thread_count > POOL_MAX_THREADS) {
+        thread_count = POOL_MAX_THREADS;
+    }
+
+    pool = MEM_malloc(sizeof(WorkerPool));
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->job = NULL;
+    pool->shutdown = CRB_FALSE;
+    pool->threads = MEM_malloc(sizeof(PoolThread) * thread_count);
+    for (i = 0; i < thread_count; ++i) {
+        pool->threads[i].pool = pool;
+        pool->threads[i].inter = CRB_create_interpreter();
+        CRB_set_program(pool->threads[i].inter, inter->program);
+        CRB_set_limits(pool->threads[i].inter, &inter->limits);
+        crb_share_thread_group(inter, pool->threads[i].inter);
+        pool->threads[i].inter->pool_thread = &pool->threads[i];
+        error = pthread_create(&pool->threads[i].thread, NULL, pool_main, &pool->threads[i]);
+        if (error) {
+            CRB_dispose_interpreter(pool->threads[i].inter);
+            break;
+        }
+    }
+
+    /* 起来几个线程就用几个, 一个也没有时报错 */
+    if (0 == i) {
+        MEM_free(pool->threads);
+        pthread_mutex_destroy(&pool->mutex);
+        pthread_cond_destroy(&pool->work);
+        pthread_cond_destroy(&pool->done);
+        MEM_free(pool);
+        crb_runtime_error(inter, inter->native_line_number, WORKER_ERR, STRING_MESSAGE_ARGUMENT, "message", strerror(error), MESSAGE_ARGUMENT_END);
+    }
+    pool->thread_count = i;
+    inter->worker_pool = pool;
+
+    return pool;
+}
+
+static void run_job(CRB_Interpreter *inter, ParallelJob *job)
+{
+    WorkerPool *pool;
+    long steps_left;
+
+    job->error_message = NULL;
+    job->status = CRB_STATUS_OK;
+    if (0 == job->count) {
+        job->chunk_count = 0;
+        return;
+    }
+
+    pool = get_pool(inter);
+    job->chunk_size = job->count / (pool->thread_count * CHUNKS_PER_THREAD);
+    if (job->chunk_size < 1) {
+        job->chunk_size = 1;
+    }
+    job->chunk_count = (job->count + job->chunk_size - 1) / job->chunk_size;
+    job->next_chunk = 0;
+    job->pending = job->chunk_count;
+    job->limit_steps = inter->limits.max_steps > 0;
+    steps_left = 0;
+    if (job->limit_steps && inter->limits.max_steps > inter->step_count) {
+        steps_left = inter->limits.max_steps - inter->step_count;
+    }
+    job->steps_left = steps_left;
+    job->timeout_msec = inter->limits.timeout_msec;
+    job->deadline = inter->deadline;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->job = job;
+    pthread_cond_broadcast(&pool->work);
+    while (job->pending > 0) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pool->job = NULL;
+    pthread_mutex_unlock(&pool->mutex);
+
+    /* 各线程用掉的步数算在调用者头上 */
+    if (job->limit_steps) {
+        inter->step_count += steps_left - job->steps_left;
+    }
+}
+
+static void dispose_messages(Message *messages, int count)
+{
+    int i;
+
+    for (i = 0; i < count; ++i) {
+        crb_dispose_message(&messages[i]);
+    }
+    MEM_free(messages);
+}
+
+static Message *alloc_messages(int count)
+{
+    Message *messages;
+    int i;
+
+    messages = MEM_malloc(sizeof(Message) * (count + 1));
+    for (i = 0; i < count; ++i) {
+        messages[i].type = CRB_NULL_VALUE;
+    }
+
+    return messages;
+}
+
+/* 检查参数并拷贝数组, 拷贝出错时释放之后继续往外跳 */
+static void prepare_job(CRB_Interpreter *inter, char *name, ParallelJob *job,
+        ParallelMode mode, CRB_Value *array, CRB_Value *func_name, CRB_Value *init)
+{
+    jmp_buf recovery;
+    jmp_buf *outer_recovery;
+    int i;
+
+    /* 每个线程再建一个线程池, 线程数会变成cpu个数的平方 */
+    if (inter->pool_thread) {
+        crb_runtime_error(inter, inter->native_line_number, PARALLEL_NESTED_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+    }
+    if (array->type != CRB_ARRAY_VALUE || func_name->type != CRB_STRING_VALUE) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+    }
+    job->func = crb_search_function(inter, crb_c_string(inter, func_name->u.object));
+    if (NULL == job->func || job->func->type != CROWBAR_FUNCTION_DEFINITION) {
+        crb_runtime_error(inter, inter->native_line_number, FUNCTION_NOT_FOUND_ERR, STRING_MESSAGE_ARGUMENT, "name", crb_c_string(inter, func_name->u.object), MESSAGE_ARGUMENT_END);
+    }
+
+    job->mode = mode;
+    job->count = array->u.object->u.array.size;
+    /* 线程池创建失败会报错, 放在拷贝之前 */
+    if (job->count > 0) {
+        get_pool(inter);
+    }
+    job->input = alloc_messages(job->count);
+    job->output = NULL;
+    job->init.type = CRB_NULL_VALUE;
+
+    outer_recovery = inter->recovery;
+    if (setjmp(recovery)) {
+        inter->recovery = outer_recovery;
+        dispose_messages(job->input, job->count);
+        crb_dispose_message(&job->init);
+        crb_abort(inter, inter->status);
+    }
+    inter->recovery = &recovery;
+    for (i = 0; i < job->count; ++i) {
+        crb_value_to_message(inter, &array->u.object->u.array.array[i], &job->input[i]);
+    }
+    if (init) {
+        crb_value_to_message(inter, init, &job->init);
+    }
+    inter->recovery = outer_recovery;
+}
+
+static void check_job_error(CRB_Interpreter *inter, ParallelJob *job)
+{
+    CRB_Object *error_message;
+
+    dispose_messages(job->input, job->count);
+    crb_dispose_message(&job->init);
+    if (NULL == job->error_message) {
+        return;
+    }
+
+    dispose_messages(job->output, job->count);
+    /* 超过步数,期限或者堆的限制时调用者也按同样的状态中止 */
+    if (CRB_STATUS_STEP_LIMIT == job->status || CRB_STATUS_TIMEOUT == job->status
+            || CRB_STATUS_HEAP_LIMIT == job->status) {
+        MEM_free(job->error_message);
+        crb_abort(inter, job->status);
+    }
+    /* 报错之后就没人释放了, 错误信息交给堆 */
+    error_message = crb_create_crowbar_string_i(inter, job->error_message);
+    crb_runtime_error(inter, inter->native_line_number, WORKER_ERR, STRING_MESSAGE_ARGUMENT, "message",
+            error_message->u.string.string, MESSAGE_ARGUMENT_END);
+}
+
+/* parallel_map(array, "func"): 返回新数组 */
+CRB_Value crb_nv_parallel_map_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    ParallelJob job;
+    int i;
+
+    if (arg_count != 2) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "parallel_map", MESSAGE_ARGUMENT_END);
+    }
+    prepare_job(inter, "parallel_map", &job, PARALLEL_MAP, &args[0], &args[1], NULL);
+    job.output = alloc_messages(job.count);
+    run_job(inter, &job);
+    check_job_error(inter, &job);
+
+    value.type = CRB_ARRAY_VALUE;
+    value.u.object = crb_create_array_i(inter, job.count);
+    for (i = 0; i < job.count; ++i) {
+        value.u.object->u.array.array[i].type = CRB_NULL_VALUE;
+    }
+    push_value(inter, &value);
+    for (i = 0; i < job.count; ++i) {
+        value.u.object->u.array.array[i] = crb_message_to_value(inter, &job.output[i]);
+    }
+    pop_value(inter);
+    dispose_messages(job.output, job.count);
+
+    return value;
+}
+
+/* parallel_reduce(array, "func", init): func(累加值, 元素)返回新的累加值 */
+CRB_Value crb_nv_parallel_reduce_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value call_args[2];
+    CRB_Value value;
+    ParallelJob job;
+    int chunk_count;
+    int i;
+
+    if (arg_count != 3) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "parallel_reduce", MESSAGE_ARGUMENT_END);
+    }
+    prepare_job(inter, "parallel_reduce", &job, PARALLEL_REDUCE, &args[0], &args[1], &args[2]);
+    /* 段数在run_job里才知道, 按最多的情况(每个元素一段)分配 */
+    job.output = alloc_messages(job.count);
+    run_job(inter, &job);
+    chunk_count = job.chunk_count;
+    check_job_error(inter, &job);
+    if (0 == chunk_count) {
+        dispose_messages(job.output, job.count);
+        return args[2];
+    }
+
+    /* 各段的结果先全部放到栈上, 释放拷贝之后再合并, 合并时出错也不会泄漏 */
+    for (i = 0; i < chunk_count; ++i) {
+        value = crb_message_to_value(inter, &job.output[i]);
+        push_value(inter, &value);
+    }
+    dispose_messages(job.output, job.count);
+
+    value = *peek_stack(inter, chunk_count - 1);
+    for (i = 1; i < chunk_count; ++i) {
+        call_args[0] = value;
+        call_args[1] = *peek_stack(inter, chunk_count - 1 - i);
+        value = CRB_call_function(inter, job.func, 2, call_args);
+        /* 用不到的段结果的位置放累加值 */
+        *peek_stack(inter, chunk_count - 1 - i) = value;
+    }
+    shrink_stack(inter, chunk_count);
+
+    return value;
+}
+
+/* 解释器重置或释放时结束线程池 */
+void crb_dispose_worker_pool(CRB_Interpreter *inter)
+{
+    WorkerPool *pool = inter->worker_pool;
+    int i;
+
+    if (NULL == pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->shutdown = CRB_TRUE;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->mutex);
+    for (i = 0; i < pool->thread_count; ++i) {
+        pthread_join(pool->threads[i].thread, NULL);
+        CRB_dispose_interpreter(pool->threads[i].inter);
+    }
+
+    MEM_free(pool->threads);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    MEM_free(pool);
+    inter->worker_pool = NULL;
+}
+
+/* vim: set tabstop=4 set shiftwidth=4 */
@@ -5,11 +5,15 @@
 
 #include <stdio.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "MEM.h"
 #include "crowbar.h"
 
 #define STRING_ALLOC_SIZE (256)
 
+/* 只在编译时用, 受编译锁保护 */
 static char *st_string_literal_buffer = NULL;
 static int st_string_literal_buffer_size = 0;
 static int st_string_literal_buffer_alloc_size = 0;
@@ -60,5 +64,340 @@ char *crb_create_identifier(char *str)
     return new_str;
 }
 
+/*
+ * 运行时的字符串操作
+ *
+ *   s.substr(start, length); s.trim(); s.split(",");
+ * 结果都是共享s的字符的视图, 切很大的文本也不会一段一段拷贝.
+ *
+ *   s.find("ab"); s.rfind("ab"); s.count("ab");   # 找不到时find/rfind是-1
+ *   s.starts_with("ab"); s.ends_with("ab");
+ *   s.replace("old", "new"); ", ".join(array);     # 先算好长度, 结果只分配一次
+ * */
+
+/* 第一个字符, 视图的时候后面不一定有'\0', 要和length一起用 */
+char* crb_string_chars(CRB_Object *obj)
+{
+    if (obj->u.string.string) {
+        return obj->u.string.string;
+    }
+    return obj->u.string.parent->u.string.string + obj->u.string.offset;
+}
+
+/* 和strcmp一样的大小关系 */
+int crb_string_compare(CRB_Object *left, CRB_Object *right)
+{
+    int left_length = left->u.string.length;
+    int right_length = right->u.string.length;
+    int cmp;
+
+    cmp = memcmp(crb_string_chars(left), crb_string_chars(right),
+            left_length < right_length ? left_length : right_length);
+    if (cmp != 0) {
+        return cmp;
+    }
+
+    return left_length - right_length;
+}
+
+static void string_argument_error(CRB_Interpreter *inter, int line_number, char *name)
+{
+    crb_runtime_error(inter, line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+}
+
+/* 可能GC, obj要在调用者那边可以被mark到 */
+CRB_Object* crb_string_substr(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *start, CRB_Value *length, int line_number)
+{
+    if (start->type != CRB_INT_VALUE || length->type != CRB_INT_VALUE
+            || start->u.int_value < 0 || length->u.int_value < 0
+            || start->u.int_value > obj->u.string.length - length->u.int_value) {
+        string_argument_error(inter, line_number, "substr");
+    }
+
+    return crb_create_string_view_i(inter, obj, start->u.int_value, length->u.int_value);
+}
+
+static CRB_Boolean is_space(char c)
+{
+    return ' ' == c || '\t' == c || '\n' == c || '\r' == c;
+}
+
+/* 两边都没有空白时返回obj本身 */
+CRB_Object* crb_string_trim(CRB_Interpreter *inter, CRB_Object *obj)
+{
+    char *chars = crb_string_chars(obj);
+    int start = 0;
+    int end = obj->u.string.length;
+
+    while (start < end && is_space(chars[start])) {
+        ++start;
+    }
+    while (end > start && is_space(chars[end - 1])) {
+        --end;
+    }
+    if (0 == start && obj->u.string.length == end) {
+        return obj;
+    }
+
+    return crb_create_string_view_i(inter, obj, start, end - start);
+}
+
+/*
+ * 从from开始找sub, 没有时返回-1.
+ * 有SSE2时一次比较16个位置的首字符和末字符, 两个都对上的才memcmp;
+ * 单个字符和剩下的零头用memchr.
+ * */
+static int search_substring(char *chars, int length, int from, char *sub, int sub_length)
+{
+    char *pos;
+    int last = length - sub_length; /* 最后一个可能的开始位置 */
+
+    if (0 == sub_length) {
+        return from <= length ? from : -1;
+    }
+#ifdef __SSE2__
+    if (sub_length > 1) {
+        __m128i first = _mm_set1_epi8(sub[0]);
+        __m128i tail = _mm_set1_epi8(sub[sub_length - 1]);
+        __m128i head_block;
+        __m128i tail_block;
+        int mask;
+        int bit;
+
+        for (; from + 15 <= last; from += 16) {
+            head_block = _mm_loadu_si128((__m128i*)(chars + from));
+            tail_block = _mm_loadu_si128((__m128i*)(chars + from + sub_length - 1));
+            mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head_block, first),
+                        _mm_cmpeq_epi8(tail_block, tail)));
+            for (bit = 0; mask; ++bit, mask >>= 1) {
+                if ((mask & 1) && !memcmp(chars + from + bit + 1, sub + 1, sub_length - 2)) {
+                    return from + bit;
+                }
+            }
+        }
+    }
+#endif
+    while (from <= last) {
+        pos = memchr(chars + from, sub[0], last - from + 1);
+        if (NULL == pos) {
+            return -1;
+        }
+        if (!memcmp(pos, sub, sub_length)) {
+            return pos - chars;
+        }
+        from = pos - chars + 1;
+    }
+
+    return -1;
+}
+
+static int rsearch_substring(char *chars, int length, char *sub, int sub_length)
+{
+    int i;
+
+    for (i = length - sub_length; i >= 0; --i) {
+        if ((0 == sub_length || chars[i] == sub[0]) && !memcmp(chars + i, sub, sub_length)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static CRB_Object *get_string_argument(CRB_Interpreter *inter, CRB_Value *value, int line_number, char *name)
+{
+    if (value->type != CRB_STRING_VALUE) {
+        string_argument_error(inter, line_number, name);
+    }
+
+    return value->u.object;
+}
+
+/* s.find(sub)/s.rfind(sub): 第一次/最后一次出现的位置 */
+int crb_string_find(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *sub, CRB_Boolean reverse, int line_number)
+{
+    CRB_Object *sub_obj = get_string_argument(inter, sub, line_number, reverse ? "rfind" : "find");
+
+    if (reverse) {
+        return rsearch_substring(crb_string_chars(obj), obj->u.string.length,
+                crb_string_chars(sub_obj), sub_obj->u.string.length);
+    }
+
+    return search_substring(crb_string_chars(obj), obj->u.string.length, 0,
+            crb_string_chars(sub_obj), sub_obj->u.string.length);
+}
+
+/* 不重叠地数 */
+int crb_string_count(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *sub, int line_number)
+{
+    CRB_Object *sub_obj = get_string_argument(inter, sub, line_number, "count");
+    char *chars = crb_string_chars(obj);
+    char *sub_chars = crb_string_chars(sub_obj);
+    int sub_length = sub_obj->u.string.length;
+    int count;
+    int pos;
+
+    if (0 == sub_length) {
+        string_argument_error(inter, line_number, "count");
+    }
+    for (count = 0, pos = 0; (pos = search_substring(chars, obj->u.string.length, pos, sub_chars, sub_length)) >= 0; ++count) {
+        pos += sub_length;
+    }
+
+    return count;
+}
+
+/* s.starts_with(prefix), at_end时是s.ends_with(suffix) */
+CRB_Boolean crb_string_starts_with(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *affix, CRB_Boolean at_end, int line_number)
+{
+    CRB_Object *affix_obj = get_string_argument(inter, affix, line_number, at_end ? "ends_with" : "starts_with");
+    int length = affix_obj->u.string.length;
+
+    if (length > obj->u.string.length) {
+        return CRB_FALSE;
+    }
+
+    return !memcmp(crb_string_chars(obj) + (at_end ? obj->u.string.length - length : 0),
+            crb_string_chars(affix_obj), length);
+}
+
+/* 全部替换, 没有old时返回obj本身. 可能GC, 参数要在调用者那边可以被mark到 */
+CRB_Object* crb_string_replace(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *old_value, CRB_Value *new_value, int line_number)
+{
+    CRB_Object *old_obj = get_string_argument(inter, old_value, line_number, "replace");
+    CRB_Object *new_obj = get_string_argument(inter, new_value, line_number, "replace");
+    char *chars = crb_string_chars(obj);
+    char *old_chars = crb_string_chars(old_obj);
+    char *new_chars = crb_string_chars(new_obj);
+    int length = obj->u.string.length;
+    int old_length = old_obj->u.string.length;
+    int new_length = new_obj->u.string.length;
+    char *str;
+    char *dest;
+    int count;
+    int from;
+    int pos;
+
+    if (0 == old_length) {
+        string_argument_error(inter, line_number, "replace");
+    }
+    count = crb_string_count(inter, obj, old_value, line_number);
+    if (0 == count) {
+        return obj;
+    }
+
+    str = MEM_malloc(length + count * (new_length - old_length) + 1);
+    for (dest = str, from = 0; (pos = search_substring(chars, length, from, old_chars, old_length)) >= 0; from = pos + old_length) {
+        memcpy(dest, chars + from, pos - from);
+        dest += pos - from;
+        memcpy(dest, new_chars, new_length);
+        dest += new_length;
+    }
+    memcpy(dest, chars + from, length - from);
+    dest[length - from] = '\0';
+
+    return crb_create_crowbar_string_i(inter, str);
+}
+
+/* sep.join(array): 元素都是字符串时先算总长度, 其他的值转换成字符串 */
+CRB_Object* crb_string_join(CRB_Interpreter *inter, CRB_Object *sep, CRB_Value *array, int line_number)
+{
+    CRB_Object *obj;
+    CRB_Value *elements;
+    VString vstr;
+    char *str;
+    char *dest;
+    int size;
+    int total;
+    int i;
+
+    if (array->type != CRB_ARRAY_VALUE) {
+        string_argument_error(inter, line_number, "join");
+    }
+    elements = array->u.object->u.array.array;
+    size = array->u.object->u.array.size;
+
+    for (i = 0, total = 0; i < size && CRB_STRING_VALUE == elements[i].type; ++i) {
+        total += elements[i].u.object->u.string.length;
+    }
+    if (i < size) {
+        crb_vstr_clear(&vstr);
+        crb_vstr_append_chars(&vstr, "", 0);
+        for (i = 0; i < size; ++i) {
+            if (i > 0) {
+                crb_vstr_append_chars(&vstr, crb_string_chars(sep), sep->u.string.length);
+            }
+            crb_vstr_append_value(&vstr, &elements[i]);
+        }
+        return crb_create_crowbar_string_i(inter, vstr.string);
+    }
+
+    if (size > 1) {
+        total += (size - 1) * sep->u.string.length;
+    }
+    str = MEM_malloc(total + 1);
+    for (i = 0, dest = str; i < size; ++i) {
+        if (i > 0) {
+            memcpy(dest, crb_string_chars(sep), sep->u.string.length);
+            dest += sep->u.string.length;
+        }
+        obj = elements[i].u.object;
+        memcpy(dest, crb_string_chars(obj), obj->u.string.length);
+        dest += obj->u.string.length;
+    }
+    *dest = '\0';
+
+    return crb_create_crowbar_string_i(inter, str);
+}
+
+/*
+ * 按separator切开, 连着的分隔符之间是空字符串.
+ * 每一段都是obj的视图. 可能GC, obj和separator要在调用者那边可以被mark到
+ * */
+CRB_Object* crb_string_split(CRB_Interpreter *inter, CRB_Object *obj, CRB_Value *separator, int line_number)
+{
+    CRB_Value array;
+    CRB_Object *piece;
+    char *chars;
+    char *sep;
+    int length = obj->u.string.length;
+    int sep_length;
+    int count;
+    int from;
+    int pos;
+    int i;
+
+    if (separator->type != CRB_STRING_VALUE || 0 == separator->u.object->u.string.length) {
+        string_argument_error(inter, line_number, "split");
+    }
+    sep = crb_string_chars(separator->u.object);
+    sep_length = separator->u.object->u.string.length;
+
+    /* 先数出段数, 数组一次分配好 */
+    chars = crb_string_chars(obj);
+    for (count = 1, from = 0; (pos = search_substring(chars, length, from, sep, sep_length)) >= 0; ++count) {
+        from = pos + sep_length;
+    }
+
+    array.type = CRB_ARRAY_VALUE;
+    array.u.object = crb_create_array_i(inter, count);
+    for (i = 0; i < count; ++i) {
+        array.u.object->u.array.array[i].type = CRB_NULL_VALUE;
+    }
+    push_value(inter, &array);
+
+    /* GC不会移动字符, chars和sep一直有效. separator指向栈, push之后不能再用 */
+    for (i = 0, from = 0; i < count; ++i) {
+        pos = (i == count - 1) ? length : search_substring(chars, length, from, sep, sep_length);
+        piece = crb_create_string_view_i(inter, obj, from, pos - from);
+        array.u.object->u.array.array[i].type = CRB_STRING_VALUE;
+        array.u.object->u.array.array[i].u.object = piece;
+        from = pos + sep_length;
+    }
+    pop_value(inter);
+
+    return array.u.object;
+}
+
 /* vim: set tabstop=4 set shiftwidth=4 */
 
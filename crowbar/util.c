@@ -10,6 +10,7 @@
 #include "DBG.h"
 #include "crowbar.h"
 
+/* 正在编译的解释器, 只在编译锁里面用(见interpreter.c) */
 static CRB_Interpreter *st_current_interpreter;
 
 CRB_Interpreter *crb_get_current_interpreter(void)
@@ -112,6 +113,7 @@ char* crb_get_operator_string(ExpressionType type)
             break;
         case FUNCTION_CALL_EXPRESSION:
         case NULL_EXPRESSION:
+        case MAP_EXPRESSION:
         case EXPRESSION_TYPE_COUNT_PLUS_1:
         default:
             DBG_panic(("bad expression type..%d\n", type));
@@ -120,19 +122,21 @@ char* crb_get_operator_string(ExpressionType type)
     return str;
 }
 
-FunctionDefinition *crb_search_function(char *name)
+FunctionDefinition *crb_search_function(CRB_Interpreter *inter, char *name)
 {
     FunctionDefinition *pos;
-    CRB_Interpreter *inter;
-
-    inter = crb_get_current_interpreter();
 
-    for (pos = inter->function_list; pos; pos = pos->next) {
+    for (pos = inter->program->function_list; pos; pos = pos->next) {
         if (!strcmp(pos->name, name)) {
-            break;
+            return pos;
         }
     }
-    return pos;
+    for (pos = inter->native_function_list; pos; pos = pos->next) {
+        if (!strcmp(pos->name, name)) {
+            return pos;
+        }
+    }
+    return NULL;
 }
 
 void* crb_execute_malloc(CRB_Interpreter *inter, size_t size)
@@ -147,6 +151,10 @@ void CRB_add_global_variable(CRB_Interpreter *inter, char *identifier, CRB_Value
 {
     Variable *new_variable;
 
+    if (NULL == inter->execute_storage) {
+        crb_open_execute_storage(inter);
+    }
+
     new_variable = crb_add_global_variable(inter, identifier);
     new_variable->value = *value;
 }
@@ -171,7 +179,8 @@ void* crb_malloc(size_t size) {
 
     inter = crb_get_current_interpreter();
 
-    p = MEM_storage_malloc(inter->interpreter_storage, size);
+    /* 分析树都分配在程序的存储里 */
+    p = MEM_storage_malloc(inter->program->program_storage, size);
 
     return p;
 }
@@ -188,96 +197,232 @@ Variable* crb_add_local_variable(CRB_LocalEnvironment *env, char *identifier)
 }
 
 /* v2 */
-void crb_vstr_clear(VString *str)
+/*
+ * 可变长字符串
+ *
+ * 容量每次翻倍, 追加不再每次realloc和strlen.
+ * fp不是NULL时缓冲区满了就写到fp(容量不变), 最后用crb_vstr_flush写完.
+ * */
+void crb_vstr_clear(VString *v)
 {
-    if (NULL == str) {
+    if (NULL == v) {
         return;
     }
-    str->string = NULL;
+    v->string = NULL;
+    v->length = 0;
+    v->alloc_size = 0;
+    v->fp = NULL;
 }
 
-static int my_strlen(char *str)
+void crb_vstr_open_file(VString *v, FILE *fp)
 {
-    if (NULL == str) {
-        return 0;
+    crb_vstr_clear(v);
+    v->alloc_size = VSTR_FILE_BUF_SIZE;
+    v->string = MEM_malloc(v->alloc_size);
+    v->string[0] = '\0';
+    v->fp = fp;
+}
+
+void crb_vstr_flush(VString *v)
+{
+    if (v->fp && v->length > 0) {
+        fwrite(v->string, 1, v->length, v->fp);
+        v->length = 0;
+        v->string[0] = '\0';
     }
-    return strlen(str);
 }
 
-void crb_vstr_append_string(VString *v, char *str)
+/* 按长度追加, 视图的字符后面没有'\0' */
+void crb_vstr_append_chars(VString *v, char *chars, int length)
 {
     int new_size;
-    int old_len;
 
-    old_len = my_strlen(v->string);
-    new_size = old_len + strlen(str) + 1;
-    v->string = MEM_realloc(v->string, new_size);
-    strcpy(&v->string[old_len], str);
+    if (v->length + length + 1 > v->alloc_size) {
+        if (v->fp) {
+            crb_vstr_flush(v);
+            if (length + 1 > v->alloc_size) {
+                fwrite(chars, 1, length, v->fp);
+                return;
+            }
+        } else {
+            new_size = v->alloc_size ? v->alloc_size : VSTR_ALLOC_SIZE;
+            while (new_size < v->length + length + 1) {
+                new_size *= 2;
+            }
+            v->string = MEM_realloc(v->string, new_size);
+            v->alloc_size = new_size;
+        }
+    }
+    memcpy(&v->string[v->length], chars, length);
+    v->length += length;
+    v->string[v->length] = '\0';
+}
+
+void crb_vstr_append_string(VString *v, char *str)
+{
+    crb_vstr_append_chars(v, str, strlen(str));
 }
 
-char* CRB_value_to_string(CRB_Value *value)
+void crb_vstr_append_character(VString *v, int ch)
 {
-    VString vstr;
-    char buf[LINE_BUF_SIZE];
+    char c = ch;
+
+    crb_vstr_append_chars(v, &c, 1);
+}
+
+/* 和数组一样一层一层加括号 */
+static void matrix_to_string(VString *vstr, CRB_Matrix *matrix, int depth, int offset)
+{
+    char buf[NUMBER_BUF_SIZE];
     int i;
 
-    crb_vstr_clear(&vstr);
+    crb_vstr_append_string(vstr, "(");
+    for (i = 0; i < matrix->shape[depth]; ++i) {
+        if (i > 0) {
+            crb_vstr_append_string(vstr, ", ");
+        }
+        if (depth < matrix->dimension - 1) {
+            matrix_to_string(vstr, matrix, depth + 1, offset + i * matrix->stride[depth]);
+            continue;
+        }
+        if (matrix->is_int) {
+            crb_vstr_append_chars(vstr, buf, crb_format_int(buf, (int)crb_matrix_element(matrix, offset + i)));
+        } else {
+            crb_vstr_append_chars(vstr, buf, crb_format_double(buf, crb_matrix_element(matrix, offset + i)));
+        }
+    }
+    crb_vstr_append_string(vstr, ")");
+}
+
+/* 正在输出的数组和散列表, 在c栈上一层一层往外连 */
+typedef struct ValuePath_tag {
+    CRB_Object *object;
+    struct ValuePath_tag *outer;
+} ValuePath;
+
+static CRB_Boolean is_on_path(ValuePath *path, CRB_Object *obj)
+{
+    for (; path; path = path->outer) {
+        if (path->object == obj) {
+            return CRB_TRUE;
+        }
+    }
+
+    return CRB_FALSE;
+}
+
+/* 包含自己的数组/散列表(a.add(a))在里面输出成(...)/{...} */
+static void append_value(VString *vstr, CRB_Value *value, ValuePath *outer)
+{
+    char buf[LINE_BUF_SIZE];
+    ValuePath path;
+    CRB_Object *obj;
+    int i;
+    int j;
 
-    /* fprintf(stderr, "CRB_value_to_string value:%d %p\n", value->type, value); */
     switch (value->type) {
         case CRB_BOOLEAN_VALUE:
-            if (value->u.boolean_value) {
-                crb_vstr_append_string(&vstr, "true");
-            } else {
-                crb_vstr_append_string(&vstr, "false");
-            }
+            crb_vstr_append_string(vstr, value->u.boolean_value ? "true" : "false");
             break;
         case CRB_INT_VALUE:
-            sprintf(buf, "%d", value->u.int_value);
-            crb_vstr_append_string(&vstr, buf);
+            crb_vstr_append_chars(vstr, buf, crb_format_int(buf, value->u.int_value));
             break;
         case CRB_DOUBLE_VALUE:
-            sprintf(buf, "%f", value->u.double_value);
-            crb_vstr_append_string(&vstr, buf);
+            crb_vstr_append_chars(vstr, buf, crb_format_double(buf, value->u.double_value));
             break;
         case CRB_STRING_VALUE:
-            crb_vstr_append_string(&vstr, value->u.object->u.string.string);
+            crb_vstr_append_chars(vstr, crb_string_chars(value->u.object), value->u.object->u.string.length);
             break;
         case CRB_NATIVE_POINTER_VALUE:
             sprintf(buf, "(%s:%p)",
                     value->u.native_pointer.info->name,
                     value->u.native_pointer.pointer);
-            crb_vstr_append_string(&vstr, buf);
+            crb_vstr_append_string(vstr, buf);
             break;
         case CRB_NULL_VALUE:
-            crb_vstr_append_string(&vstr, "null");
+            crb_vstr_append_string(vstr, "null");
             break;
         case CRB_ARRAY_VALUE:
-            /* fprintf(stderr, "ARRAY value-- CRB_ARRAY_VALUE:%d object:%p\n", value->type, value->u.object); */
-            crb_vstr_append_string(&vstr, "(");
-            /* fprintf(stderr, "ARRAY value----object:%p\n", value->u.object); */
-            /* fprintf(stderr, "ARRAY value----object:%p array_size:%d\n", value->u.object, value->u.object->u.array.size); */
-            for (i = 0; i < value->u.object->u.array.size; ++i) {
-                char *new_str;
+            obj = value->u.object;
+            if (is_on_path(outer, obj)) {
+                crb_vstr_append_string(vstr, "(...)");
+                break;
+            }
+            path.object = obj;
+            path.outer = outer;
+            crb_vstr_append_string(vstr, "(");
+            for (i = 0; i < obj->u.array.size; ++i) {
                 if (i > 0) {
-                    crb_vstr_append_string(&vstr, ", ");
+                    crb_vstr_append_string(vstr, ", ");
                 }
-                /* fprintf(stderr, "ARRAY value----object:%p array_size:%d before new_str:%s\n", value->u.object, value->u.object->u.array.size, "=="); */
-                /* fprintf(stderr, "-----split-----type:%d array[%d]:%p\n", value->type, i, value->u.object->u.array.array[i]); */
-                new_str = CRB_value_to_string(&value->u.object->u.array.array[i]);
-                /* fprintf(stderr, "ARRAY value----object:%p array_size:%d new_str:%p\n", value->u.object, value->u.object->u.array.size, new_str); */
-                crb_vstr_append_string(&vstr, new_str);
-                MEM_free(new_str);
+                append_value(vstr, &obj->u.array.array[i], &path);
             }
-            crb_vstr_append_string(&vstr, ")");
+            crb_vstr_append_string(vstr, ")");
+            break;
+        case CRB_GENERATOR_VALUE:
+            crb_vstr_append_string(vstr, "(generator)");
+            break;
+        case CRB_MAP_VALUE:
+            obj = value->u.object;
+            if (is_on_path(outer, obj)) {
+                crb_vstr_append_string(vstr, "{...}");
+                break;
+            }
+            path.object = obj;
+            path.outer = outer;
+            crb_vstr_append_string(vstr, "{");
+            for (i = 0, j = 0; i < obj->u.map.alloc_size; ++i) {
+                MapEntry *entry = &obj->u.map.entries[i];
+                if (entry->state != MAP_ENTRY_USED) {
+                    continue;
+                }
+                if (j++ > 0) {
+                    crb_vstr_append_string(vstr, ", ");
+                }
+                append_value(vstr, &entry->key, &path);
+                crb_vstr_append_string(vstr, ": ");
+                append_value(vstr, &entry->value, &path);
+            }
+            crb_vstr_append_string(vstr, "}");
+            break;
+        case CRB_MATRIX_VALUE:
+            matrix_to_string(vstr, &value->u.object->u.matrix, 0, 0);
             break;
         default:
             DBG_panic(("value type:%d\n", value->type));
     }
+}
+
+void crb_vstr_append_value(VString *v, CRB_Value *value)
+{
+    append_value(v, value, NULL);
+}
+
+/* 返回的字符串由调用者MEM_free */
+char* CRB_value_to_string(CRB_Value *value)
+{
+    VString vstr;
+
+    crb_vstr_clear(&vstr);
+    crb_vstr_append_value(&vstr, value);
+    if (NULL == vstr.string) {
+        crb_vstr_append_chars(&vstr, "", 0);
+    }
 
     return vstr.string;
 }
 
+/* 不拼出整个字符串, 直接写到fp */
+void CRB_write_value(FILE *fp, CRB_Value *value)
+{
+    VString vstr;
+
+    crb_vstr_open_file(&vstr, fp);
+    crb_vstr_append_value(&vstr, value);
+    crb_vstr_flush(&vstr);
+    MEM_free(vstr.string);
+}
+
 char* getEvalType(int type) 
 {
     switch (type) {
@@ -335,6 +480,8 @@ char* getEvalType(int type)
     return "INCREMENT_EXPRESSION";
     case DECREMENT_EXPRESSION:
     return "DECREMENT_EXPRESSION";
+    case MAP_EXPRESSION:
+    return "MAP_EXPRESSION";
     case EXPRESSION_TYPE_COUNT_PLUS_1:
     return "EXPRESSION_TYPE_COUNT_PLUS_1";
     }
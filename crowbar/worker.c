@@ -0,0 +1,634 @@
+/*
+ * File : worker.c
+ * CreateDate : 2026-10-19 21:05:42
+ * */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "MEM.h"
+#include "DBG.h"
+#include "crowbar.h"
+
+/*
+ * 工作线程和通道
+ *
+ * 堆和GC不是线程安全的, 所以工作线程各有一个解释器, 和创建它的解释器共享编译好的程序,
+ * 但不共享全局变量和堆. 线程之间只能通过参数,返回值和通道传值, 传的时候深拷贝成Message,
+ * 到了对方那边再在对方的堆上创建对象.
+ *   ch = channel(16);
+ *   w = spawn("worker", ch, 100);  # 在新线程里执行worker(ch, 100)
+ *   v = recv(ch);                  # 通道空时等待, 通道关闭并且空了之后返回null
+ *   result = join(w);              # 等线程结束, 返回worker的返回值
+ * 通道由根解释器(不是工作线程的那个)统一管理, 根解释器重置或释放时先关闭所有通道,
+ * 再等所有工作线程结束.
+ * */
+
+#define WORKER_NAME "crowbar.worker"
+#define CHANNEL_NAME "crowbar.channel"
+
+static CRB_NativePointerInfo st_worker_info = {
+    WORKER_NAME
+};
+
+static CRB_NativePointerInfo st_channel_info = {
+    CHANNEL_NAME
+};
+
+typedef struct Channel_tag {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    Message *queue;             /* 环形队列 */
+    int capacity;
+    int head;
+    int count;
+    CRB_Boolean closed;
+    struct Channel_tag *next;
+} Channel;
+
+struct ThreadGroup_tag {
+    CRB_Interpreter *owner;     /* 根解释器 */
+    pthread_mutex_t mutex;
+    Channel *channel_list;
+};
+
+struct WorkerThread_tag {
+    CRB_Interpreter *inter;     /* 工作线程自己的解释器, 线程结束时释放 */
+    pthread_t thread;
+    FunctionDefinition *func;
+    int arg_count;
+    Message *args;
+    Message result;
+    CRB_Status status;
+    char *error_message;
+    CRB_Boolean joined;
+    WorkerThread *next;
+};
+
+/* 把祖先数组(散列表)串起来, 发现循环引用时报错 */
+typedef struct CopyPath_tag {
+    CRB_Object *object;
+    struct CopyPath_tag *parent;
+} CopyPath;
+
+static void value_error(CRB_Interpreter *inter, char *type)
+{
+    crb_runtime_error(inter, inter->native_line_number, MESSAGE_VALUE_ERR, STRING_MESSAGE_ARGUMENT, "type", type, MESSAGE_ARGUMENT_END);
+}
+
+static void copy_to_message(CRB_Interpreter *inter, CRB_Value *value, Message *msg, CopyPath *path)
+{
+    CopyPath self;
+    CopyPath *pos;
+    CRB_Array *array;
+    CRB_Matrix *matrix;
+    MapEntry *entry;
+    int count;
+    int i;
+    int j;
+
+    msg->type = value->type;
+    switch (value->type) {
+    case CRB_BOOLEAN_VALUE:
+        msg->u.boolean_value = value->u.boolean_value;
+        break;
+    case CRB_INT_VALUE:
+        msg->u.int_value = value->u.int_value;
+        break;
+    case CRB_DOUBLE_VALUE:
+        msg->u.double_value = value->u.double_value;
+        break;
+    case CRB_NULL_VALUE:
+        break;
+    case CRB_STRING_VALUE:
+        /* 可能是视图, 按长度拷贝 */
+        msg->u.string = MEM_malloc(value->u.object->u.string.length + 1);
+        memcpy(msg->u.string, crb_string_chars(value->u.object), value->u.object->u.string.length);
+        msg->u.string[value->u.object->u.string.length] = '\0';
+        break;
+    case CRB_NATIVE_POINTER_VALUE:
+        /* 通道本身就是给线程之间共用的, 其他的指针只在自己的线程里有意义 */
+        if (value->u.native_pointer.info != &st_channel_info) {
+            msg->type = CRB_NULL_VALUE;
+            value_error(inter, value->u.native_pointer.info->name);
+        }
+        msg->u.channel = value->u.native_pointer.pointer;
+        break;
+    case CRB_ARRAY_VALUE:
+    case CRB_MAP_VALUE:
+        for (pos = path; pos; pos = pos->parent) {
+            if (pos->object == value->u.object) {
+                msg->type = CRB_NULL_VALUE;
+                value_error(inter, "cyclic value");
+            }
+        }
+        self.object = value->u.object;
+        self.parent = path;
+        if (CRB_MAP_VALUE == value->type) {
+            /* 键和值交替放在elements里 */
+            msg->u.array.size = value->u.object->u.map.size * 2;
+            msg->u.array.elements = MEM_malloc(sizeof(Message) * (msg->u.array.size + 1));
+            for (i = 0; i < msg->u.array.size; ++i) {
+                msg->u.array.elements[i].type = CRB_NULL_VALUE;
+            }
+            for (i = 0, j = 0; i < value->u.object->u.map.alloc_size; ++i) {
+                entry = &value->u.object->u.map.entries[i];
+                if (MAP_ENTRY_USED == entry->state) {
+                    copy_to_message(inter, &entry->key, &msg->u.array.elements[j++], &self);
+                    copy_to_message(inter, &entry->value, &msg->u.array.elements[j++], &self);
+                }
+            }
+            break;
+        }
+        array = &value->u.object->u.array;
+        msg->u.array.size = array->size;
+        msg->u.array.elements = MEM_malloc(sizeof(Message) * (array->size + 1));
+        /* 中途报错时已经拷贝的部分也能释放 */
+        for (i = 0; i < array->size; ++i) {
+            msg->u.array.elements[i].type = CRB_NULL_VALUE;
+        }
+        for (i = 0; i < array->size; ++i) {
+            copy_to_message(inter, &array->array[i], &msg->u.array.elements[i], &self);
+        }
+        break;
+    case CRB_MATRIX_VALUE:
+        /* 视图和映射的文件也拷贝成独立的矩阵 */
+        matrix = &value->u.object->u.matrix;
+        count = matrix->shape[0] * matrix->stride[0];
+        msg->u.matrix.is_int = matrix->is_int;
+        msg->u.matrix.dimension = matrix->dimension;
+        msg->u.matrix.shape = MEM_malloc(sizeof(int) * matrix->dimension);
+        memcpy(msg->u.matrix.shape, matrix->shape, sizeof(int) * matrix->dimension);
+        msg->u.matrix.data = MEM_malloc(sizeof(double) * (count > 0 ? count : 1));
+        for (i = 0; i < count; ++i) {
+            msg->u.matrix.data[i] = crb_matrix_element(matrix, i);
+        }
+        break;
+    case CRB_GENERATOR_VALUE:
+        msg->type = CRB_NULL_VALUE;
+        value_error(inter, "generator");
+        break;
+    default:
+        DBG_panic(("bad value type:%d\n", value->type));
+    }
+}
+
+void crb_dispose_message(Message *msg)
+{
+    int i;
+
+    if (CRB_STRING_VALUE == msg->type) {
+        MEM_free(msg->u.string);
+    } else if (CRB_ARRAY_VALUE == msg->type || CRB_MAP_VALUE == msg->type) {
+        for (i = 0; i < msg->u.array.size; ++i) {
+            crb_dispose_message(&msg->u.array.elements[i]);
+        }
+        MEM_free(msg->u.array.elements);
+    } else if (CRB_MATRIX_VALUE == msg->type) {
+        MEM_free(msg->u.matrix.shape);
+        MEM_free(msg->u.matrix.data);
+    }
+    msg->type = CRB_NULL_VALUE;
+}
+
+/*
+ * 深拷贝value. 不能传的值(文件,生成器,循环引用的数组)报运行时错误,
+ * 这时msg里已经拷贝的部分由调用者用crb_dispose_message释放.
+ * */
+void crb_value_to_message(CRB_Interpreter *inter, CRB_Value *value, Message *msg)
+{
+    msg->type = CRB_NULL_VALUE;
+    copy_to_message(inter, value, msg, NULL);
+}
+
+/* 在inter的堆上重新创建对象, 创建数组时可能GC, 先放到栈上 */
+CRB_Value crb_message_to_value(CRB_Interpreter *inter, Message *msg)
+{
+    CRB_Value value;
+    CRB_Value element;
+    CRB_Value *dest;
+    CRB_Matrix *matrix;
+    int i;
+
+    value.type = msg->type;
+    switch (msg->type) {
+    case CRB_BOOLEAN_VALUE:
+        value.u.boolean_value = msg->u.boolean_value;
+        break;
+    case CRB_INT_VALUE:
+        value.u.int_value = msg->u.int_value;
+        break;
+    case CRB_DOUBLE_VALUE:
+        value.u.double_value = msg->u.double_value;
+        break;
+    case CRB_NULL_VALUE:
+        break;
+    case CRB_STRING_VALUE:
+        value.u.object = crb_create_crowbar_string_i(inter, MEM_strdup(msg->u.string));
+        break;
+    case CRB_NATIVE_POINTER_VALUE:
+        value.u.native_pointer.info = &st_channel_info;
+        value.u.native_pointer.pointer = msg->u.channel;
+        break;
+    case CRB_ARRAY_VALUE:
+        value.u.object = crb_create_array_i(inter, msg->u.array.size);
+        for (i = 0; i < msg->u.array.size; ++i) {
+            value.u.object->u.array.array[i].type = CRB_NULL_VALUE;
+        }
+        push_value(inter, &value);
+        for (i = 0; i < msg->u.array.size; ++i) {
+            element = crb_message_to_value(inter, &msg->u.array.elements[i]);
+            value.u.object->u.array.array[i] = element;
+        }
+        pop_value(inter);
+        break;
+    case CRB_MAP_VALUE:
+        value.u.object = crb_create_map_i(inter);
+        push_value(inter, &value);
+        for (i = 0; i < msg->u.array.size; i += 2) {
+            element = crb_message_to_value(inter, &msg->u.array.elements[i]);
+            push_value(inter, &element);
+            element = crb_message_to_value(inter, &msg->u.array.elements[i + 1]);
+            push_value(inter, &element);
+            dest = crb_map_lvalue(inter, value.u.object, peek_stack(inter, 1), 0);
+            *dest = *peek_stack(inter, 0);
+            shrink_stack(inter, 2);
+        }
+        pop_value(inter);
+        break;
+    case CRB_MATRIX_VALUE:
+        value.u.object = crb_create_matrix_i(inter, msg->u.matrix.is_int, msg->u.matrix.dimension, msg->u.matrix.shape);
+        matrix = &value.u.object->u.matrix;
+        memcpy(matrix->data, msg->u.matrix.data, sizeof(double) * matrix->shape[0] * matrix->stride[0]);
+        break;
+    case CRB_GENERATOR_VALUE:
+        /* copy_to_message已经拒绝了生成器, 不会走到这里 */
+        value_error(inter, "generator");
+        break;
+    default:
+        DBG_panic(("bad message type:%d\n", msg->type));
+    }
+
+    return value;
+}
+
+static void check_arguments(CRB_Interpreter *inter, char *name, int arg_count, int true_count)
+{
+    if (arg_count != true_count) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+    }
+}
+
+static void *get_pointer(CRB_Interpreter *inter, char *name, CRB_Value *value, CRB_NativePointerInfo *info)
+{
+    if (value->type != CRB_NATIVE_POINTER_VALUE || value->u.native_pointer.info != info) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", name, MESSAGE_ARGUMENT_END);
+    }
+
+    return value->u.native_pointer.pointer;
+}
+
+static ThreadGroup *get_group(CRB_Interpreter *inter)
+{
+    ThreadGroup *group = inter->thread_group;
+
+    if (NULL == group) {
+        group = MEM_malloc(sizeof(ThreadGroup));
+        group->owner = inter;
+        pthread_mutex_init(&group->mutex, NULL);
+        group->channel_list = NULL;
+        inter->thread_group = group;
+    }
+
+    return group;
+}
+
+/* child创建的通道也归parent的根解释器管理 */
+void crb_share_thread_group(CRB_Interpreter *parent, CRB_Interpreter *child)
+{
+    child->thread_group = get_group(parent);
+}
+
+/* channel(capacity): 通道满了之后send等待 */
+CRB_Value crb_nv_channel_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    ThreadGroup *group;
+    Channel *ch;
+
+    check_arguments(inter, "channel", arg_count, 1);
+    if (args[0].type != CRB_INT_VALUE || args[0].u.int_value <= 0) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "channel", MESSAGE_ARGUMENT_END);
+    }
+
+    ch = MEM_malloc(sizeof(Channel));
+    pthread_mutex_init(&ch->mutex, NULL);
+    pthread_cond_init(&ch->not_empty, NULL);
+    pthread_cond_init(&ch->not_full, NULL);
+    ch->capacity = args[0].u.int_value;
+    ch->queue = MEM_malloc(sizeof(Message) * ch->capacity);
+    ch->head = 0;
+    ch->count = 0;
+    ch->closed = CRB_FALSE;
+
+    group = get_group(inter);
+    pthread_mutex_lock(&group->mutex);
+    ch->next = group->channel_list;
+    group->channel_list = ch;
+    pthread_mutex_unlock(&group->mutex);
+
+    value.type = CRB_NATIVE_POINTER_VALUE;
+    value.u.native_pointer.info = &st_channel_info;
+    value.u.native_pointer.pointer = ch;
+
+    return value;
+}
+
+/* send(ch, value): 拷贝之后放进通道, 通道关闭之后报错 */
+CRB_Value crb_nv_send_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    Channel *ch;
+    Message msg;
+
+    check_arguments(inter, "send", arg_count, 2);
+    ch = get_pointer(inter, "send", &args[0], &st_channel_info);
+    /* 拷贝在锁外面做, 出错时不会拿着锁跳走 */
+    crb_value_to_message(inter, &args[1], &msg);
+
+    pthread_mutex_lock(&ch->mutex);
+    while (ch->count == ch->capacity && !ch->closed) {
+        pthread_cond_wait(&ch->not_full, &ch->mutex);
+    }
+    if (ch->closed) {
+        pthread_mutex_unlock(&ch->mutex);
+        crb_dispose_message(&msg);
+        crb_runtime_error(inter, inter->native_line_number, CHANNEL_CLOSED_ERR, MESSAGE_ARGUMENT_END);
+    }
+    ch->queue[(ch->head + ch->count) % ch->capacity] = msg;
+    ch->count++;
+    pthread_cond_signal(&ch->not_empty);
+    pthread_mutex_unlock(&ch->mutex);
+
+    value.type = CRB_NULL_VALUE;
+    return value;
+}
+
+/* recv(ch): 通道关闭并且取完之后返回null */
+CRB_Value crb_nv_recv_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    Channel *ch;
+    Message msg;
+
+    check_arguments(inter, "recv", arg_count, 1);
+    ch = get_pointer(inter, "recv", &args[0], &st_channel_info);
+
+    pthread_mutex_lock(&ch->mutex);
+    while (0 == ch->count && !ch->closed) {
+        pthread_cond_wait(&ch->not_empty, &ch->mutex);
+    }
+    if (0 == ch->count) {
+        pthread_mutex_unlock(&ch->mutex);
+        value.type = CRB_NULL_VALUE;
+        return value;
+    }
+    msg = ch->queue[ch->head];
+    ch->head = (ch->head + 1) % ch->capacity;
+    ch->count--;
+    pthread_cond_signal(&ch->not_full);
+    pthread_mutex_unlock(&ch->mutex);
+
+    value = crb_message_to_value(inter, &msg);
+    crb_dispose_message(&msg);
+
+    return value;
+}
+
+static void close_channel(Channel *ch)
+{
+    pthread_mutex_lock(&ch->mutex);
+    ch->closed = CRB_TRUE;
+    pthread_cond_broadcast(&ch->not_empty);
+    pthread_cond_broadcast(&ch->not_full);
+    pthread_mutex_unlock(&ch->mutex);
+}
+
+/* close_channel(ch): 之后send报错, recv取完剩下的值之后返回null */
+CRB_Value crb_nv_close_channel_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+
+    check_arguments(inter, "close_channel", arg_count, 1);
+    close_channel(get_pointer(inter, "close_channel", &args[0], &st_channel_info));
+
+    value.type = CRB_NULL_VALUE;
+    return value;
+}
+
+static void *worker_main(void *arg)
+{
+    WorkerThread *worker = arg;
+    CRB_Interpreter *inter = worker->inter;
+    CRB_Value *args;
+    CRB_Value result;
+    jmp_buf recovery;
+    int i;
+
+    /* 栈扩展时会重新分配, 参数另外复制一份传给函数, 栈上的那份防止被回收 */
+    args = MEM_malloc(sizeof(CRB_Value) * (worker->arg_count + 1));
+
+    /* 恢复参数和拷贝返回值时也可能超过限制或出错 */
+    crb_start_budget(inter);
+    if (0 == setjmp(recovery)) {
+        inter->recovery = &recovery;
+        for (i = 0; i < worker->arg_count; ++i) {
+            args[i] = crb_message_to_value(inter, &worker->args[i]);
+            push_value(inter, &args[i]);
+        }
+        result = CRB_call_function(inter, worker->func, worker->arg_count, args);
+        crb_value_to_message(inter, &result, &worker->result);
+        worker->status = CRB_STATUS_OK;
+    } else {
+        crb_dispose_message(&worker->result);
+        worker->status = inter->status;
+        worker->error_message = MEM_strdup(CRB_get_error_message(inter));
+    }
+    inter->recovery = NULL;
+    inter->stack.stack_pointer = 0;
+    MEM_free(args);
+
+    CRB_dispose_interpreter(inter);
+    worker->inter = NULL;
+
+    return NULL;
+}
+
+/* spawn("函数名", 参数...): 在新线程上执行, 参数是拷贝 */
+CRB_Value crb_nv_spawn_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    CRB_Value value;
+    FunctionDefinition *func;
+    WorkerThread *worker;
+    Message *messages;
+    jmp_buf recovery;
+    jmp_buf *outer_recovery;
+    int i;
+    int error;
+
+    if (arg_count < 1) {
+        crb_runtime_error(inter, inter->native_line_number, ARGUMENT_TOO_FEW_ERR, MESSAGE_ARGUMENT_END);
+    }
+    if (args[0].type != CRB_STRING_VALUE) {
+        crb_runtime_error(inter, inter->native_line_number, NATIVE_ARGUMENT_ERR, STRING_MESSAGE_ARGUMENT, "name", "spawn", MESSAGE_ARGUMENT_END);
+    }
+    func = crb_search_function(inter, crb_c_string(inter, args[0].u.object));
+    if (NULL == func || func->type != CROWBAR_FUNCTION_DEFINITION) {
+        crb_runtime_error(inter, inter->native_line_number, FUNCTION_NOT_FOUND_ERR, STRING_MESSAGE_ARGUMENT, "name", crb_c_string(inter, args[0].u.object), MESSAGE_ARGUMENT_END);
+    }
+
+    /* 拷贝参数出错时释放已经拷贝的, 再继续往外跳 */
+    messages = MEM_malloc(sizeof(Message) * arg_count);
+    for (i = 0; i < arg_count; ++i) {
+        messages[i].type = CRB_NULL_VALUE;
+    }
+    outer_recovery = inter->recovery;
+    if (setjmp(recovery)) {
+        inter->recovery = outer_recovery;
+        for (i = 0; i < arg_count - 1; ++i) {
+            crb_dispose_message(&messages[i]);
+        }
+        MEM_free(messages);
+        crb_abort(inter, inter->status);
+    }
+    inter->recovery = &recovery;
+    for (i = 1; i < arg_count; ++i) {
+        crb_value_to_message(inter, &args[i], &messages[i - 1]);
+    }
+    inter->recovery = outer_recovery;
+
+    worker = MEM_malloc(sizeof(WorkerThread));
+    worker->inter = CRB_create_interpreter();
+    CRB_set_program(worker->inter, inter->program);
+    CRB_set_limits(worker->inter, &inter->limits);
+    crb_share_thread_group(inter, worker->inter);
+    worker->func = func;
+    worker->arg_count = arg_count - 1;
+    worker->args = messages;
+    worker->result.type = CRB_NULL_VALUE;
+    worker->status = CRB_STATUS_OK;
+    worker->error_message = NULL;
+    worker->joined = CRB_FALSE;
+
+    /* 线程没起来就不挂到worker_list上, 否则释放时会join一个无效的线程 */
+    error = pthread_create(&worker->thread, NULL, worker_main, worker);
+    if (error) {
+        CRB_dispose_interpreter(worker->inter);
+        for (i = 0; i < worker->arg_count; ++i) {
+            crb_dispose_message(&messages[i]);
+        }
+        MEM_free(messages);
+        MEM_free(worker);
+        crb_runtime_error(inter, inter->native_line_number, WORKER_ERR, STRING_MESSAGE_ARGUMENT, "message", strerror(error), MESSAGE_ARGUMENT_END);
+    }
+    worker->next = inter->worker_list;
+    inter->worker_list = worker;
+
+    value.type = CRB_NATIVE_POINTER_VALUE;
+    value.u.native_pointer.info = &st_worker_info;
+    value.u.native_pointer.pointer = worker;
+
+    return value;
+}
+
+static void join_worker(WorkerThread *worker)
+{
+    if (!worker->joined) {
+        pthread_join(worker->thread, NULL);
+        worker->joined = CRB_TRUE;
+    }
+}
+
+/* join(w): 返回函数的返回值, 工作线程出错时在这里报错 */
+CRB_Value crb_nv_join_proc(CRB_Interpreter *inter, CRB_LocalEnvironment *env, int arg_count, CRB_Value *args)
+{
+    WorkerThread *worker;
+
+    check_arguments(inter, "join", arg_count, 1);
+    worker = get_pointer(inter, "join", &args[0], &st_worker_info);
+    join_worker(worker);
+
+    if (worker->status != CRB_STATUS_OK) {
+        crb_runtime_error(inter, inter->native_line_number, WORKER_ERR, STRING_MESSAGE_ARGUMENT, "message", worker->error_message, MESSAGE_ARGUMENT_END);
+    }
+
+    return crb_message_to_value(inter, &worker->result);
+}
+
+/* 还有没join的线程. fork之后子进程里没有这些线程, 它们拿着的锁也不会放开 */
+CRB_Boolean crb_has_running_workers(CRB_Interpreter *inter)
+{
+    WorkerThread *worker;
+
+    for (worker = inter->worker_list; worker; worker = worker->next) {
+        if (!worker->joined) {
+            return CRB_TRUE;
+        }
+    }
+
+    return CRB_FALSE;
+}
+
+/*
+ * 解释器重置或释放时调用. 根解释器先关闭所有通道, 让等着通道的线程都能结束,
+ * 然后等自己创建的线程结束, 最后释放通道.
+ * */
+void crb_dispose_workers(CRB_Interpreter *inter)
+{
+    ThreadGroup *group = inter->thread_group;
+    Channel *ch;
+    WorkerThread *worker;
+    int i;
+
+    if (group && group->owner == inter) {
+        for (ch = group->channel_list; ch; ch = ch->next) {
+            close_channel(ch);
+        }
+    }
+
+    while (inter->worker_list) {
+        worker = inter->worker_list;
+        inter->worker_list = worker->next;
+        join_worker(worker);
+        for (i = 0; i < worker->arg_count; ++i) {
+            crb_dispose_message(&worker->args[i]);
+        }
+        MEM_free(worker->args);
+        crb_dispose_message(&worker->result);
+        MEM_free(worker->error_message);
+        MEM_free(worker);
+    }
+
+    if (group && group->owner == inter) {
+        while (group->channel_list) {
+            ch = group->channel_list;
+            group->channel_list = ch->next;
+            for (i = 0; i < ch->count; ++i) {
+                crb_dispose_message(&ch->queue[(ch->head + i) % ch->capacity]);
+            }
+            MEM_free(ch->queue);
+            pthread_mutex_destroy(&ch->mutex);
+            pthread_cond_destroy(&ch->not_empty);
+            pthread_cond_destroy(&ch->not_full);
+            MEM_free(ch);
+        }
+        pthread_mutex_destroy(&group->mutex);
+        MEM_free(group);
+    }
+    inter->thread_group = NULL;
+}
+
+/* vim: set tabstop=4 set shiftwidth=4 */